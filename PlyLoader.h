@@ -3,6 +3,12 @@
 
 #include "rply.h"
 #include "triangle_mesh_data.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
 
 namespace Raytr_Core
 {
@@ -57,9 +63,308 @@ namespace Raytr_Core
 			return 1;
 		}
 
+		//! a scalar type of a binary ply file
+		struct ply_type
+		{
+			enum kind { cINT, cUINT, cFLOAT };
+			kind type;
+			int size;		//!< in bytes, 0 for an unknown type
+		};
+
+		static ply_type plyType(const std::string& name)
+		{
+			ply_type t = { ply_type::cINT, 0 };
+			if (name == "char" || name == "int8") { t.type = ply_type::cINT; t.size = 1; }
+			else if (name == "uchar" || name == "uint8") { t.type = ply_type::cUINT; t.size = 1; }
+			else if (name == "short" || name == "int16") { t.type = ply_type::cINT; t.size = 2; }
+			else if (name == "ushort" || name == "uint16") { t.type = ply_type::cUINT; t.size = 2; }
+			else if (name == "int" || name == "int32") { t.type = ply_type::cINT; t.size = 4; }
+			else if (name == "uint" || name == "uint32") { t.type = ply_type::cUINT; t.size = 4; }
+			else if (name == "float" || name == "float32") { t.type = ply_type::cFLOAT; t.size = 4; }
+			else if (name == "double" || name == "float64") { t.type = ply_type::cFLOAT; t.size = 8; }
+			return t;
+		}
+
+		//! reads a value of type t at p, swapping the bytes if the file's endianness differs from the machine's
+		static double plyValue(const char* p, const ply_type& t, bool swap)
+		{
+			unsigned char b[8];
+			memcpy(b, p, t.size);
+			if (swap)
+				std::reverse(b, b + t.size);
+			switch (t.size)
+			{
+			case 1: return t.type == ply_type::cINT ? double(int8_t(b[0])) : double(b[0]);
+			case 2: { uint16_t v; memcpy(&v, b, 2); return t.type == ply_type::cINT ? double(int16_t(v)) : double(v); }
+			case 4:
+			{
+				if (t.type == ply_type::cFLOAT) { float f; memcpy(&f, b, 4); return f; }
+				uint32_t v; memcpy(&v, b, 4); return t.type == ply_type::cINT ? double(int32_t(v)) : double(v);
+			}
+			default: { double d; memcpy(&d, b, 8); return d; }
+			}
+		}
+
+		//! a property of an element of a ply file, lists have a count type and an item type
+		struct ply_property
+		{
+			std::string name;
+			bool isList;
+			ply_type countType, itemType;
+		};
+
+		struct ply_element
+		{
+			std::string name;
+			size_t count;
+			std::vector<ply_property> properties;
+
+			//! size of one element in bytes if it has no lists, 0 otherwise
+			size_t fixedSize() const
+			{
+				size_t size = 0;
+				for (const ply_property& p : properties)
+				{
+					if (p.isList)
+						return 0;
+					size += p.itemType.size;
+				}
+				return size;
+			}
+
+			int find(const char* property) const
+			{
+				for (size_t i = 0; i < properties.size(); ++i)
+				{
+					if (properties[i].name == property)
+						return int(i);
+				}
+				return -1;
+			}
+		};
+
+		//! result of loadBinaryPlyMesh
+		enum binary_load_result { cBINARY_LOADED, cBINARY_FAILED, cBINARY_UNSUPPORTED };
+
+		//! loads a binary ply mesh by reading the mapped vertex and face blocks in bulk, without rply's per value callbacks
+		/*!
+			Handles binary files (either endianness) whose vertices have only scalar properties, with the positions in x, y and z,
+			and whose faces have one vertex_indices (or vertex_index) list among scalar properties. Other elements have to have
+			fixed sizes and are skipped. Like face_cb only the first 3 indices of a face are used.
+			Returns cBINARY_UNSUPPORTED for ascii files and other layouts, loadPlyMesh falls back to rply then.
+		*/
+		binary_load_result loadBinaryPlyMesh(const char* filename, BasicMath::vec3 pos, BasicMath::vec3 rot, BasicMath::vec3 size)
+		{
+			mapped_file file;
+			if (!file.open(filename))
+				return cBINARY_UNSUPPORTED;
+			const char* begin = file.data();
+			const char* end = begin + file.size();
+
+			//the header is text up to and including the line end_header
+			static const char cEND_HEADER[] = "end_header";
+			const char* headerEnd = nullptr;
+			for (const char* p = begin; p + sizeof(cEND_HEADER) - 1 <= end; ++p)
+			{
+				if ((p == begin || p[-1] == '\n') && memcmp(p, cEND_HEADER, sizeof(cEND_HEADER) - 1) == 0)
+				{
+					headerEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+					break;
+				}
+			}
+			if (headerEnd == nullptr)
+				return cBINARY_UNSUPPORTED;
+
+			std::istringstream header(std::string(begin, headerEnd));
+			std::vector<ply_element> elements;
+			bool swap = false, binary = false;
+			std::string line;
+			//is the machine little endian
+			uint16_t one = 1;
+			bool littleEndian = *reinterpret_cast<const unsigned char*>(&one) == 1;
+			while (std::getline(header, line))
+			{
+				std::istringstream words(line);
+				std::string keyword;
+				words >> keyword;
+				if (keyword == "format")
+				{
+					std::string format;
+					words >> format;
+					binary = format == "binary_little_endian" || format == "binary_big_endian";
+					swap = (format == "binary_little_endian") != littleEndian;
+				}
+				else if (keyword == "element")
+				{
+					ply_element element;
+					words >> element.name >> element.count;
+					elements.push_back(element);
+				}
+				else if (keyword == "property" && !elements.empty())
+				{
+					ply_property property;
+					std::string type;
+					words >> type;
+					property.isList = type == "list";
+					if (property.isList)
+					{
+						std::string countType;
+						words >> countType >> type;
+						property.countType = plyType(countType);
+						if (property.countType.size == 0 || property.countType.type == ply_type::cFLOAT)
+							return cBINARY_UNSUPPORTED;
+					}
+					property.itemType = plyType(type);
+					if (property.itemType.size == 0)
+						return cBINARY_UNSUPPORTED;
+					words >> property.name;
+					elements.back().properties.push_back(property);
+				}
+			}
+			if (!binary)
+				return cBINARY_UNSUPPORTED;
+
+			//check the layout before creating the mesh
+			int vertexElement = -1, faceElement = -1, xProperty = -1, yProperty = -1, zProperty = -1, indicesProperty = -1;
+			for (size_t e = 0; e < elements.size(); ++e)
+			{
+				const ply_element& element = elements[e];
+				if (element.name == "vertex")
+				{
+					vertexElement = int(e);
+					xProperty = element.find("x"); yProperty = element.find("y"); zProperty = element.find("z");
+					if (element.fixedSize() == 0 || xProperty < 0 || yProperty < 0 || zProperty < 0)
+						return cBINARY_UNSUPPORTED;
+				}
+				else if (element.name == "face")
+				{
+					faceElement = int(e);
+					indicesProperty = element.find("vertex_indices");
+					if (indicesProperty < 0)
+						indicesProperty = element.find("vertex_index");
+					if (indicesProperty < 0 || !element.properties[indicesProperty].isList || element.properties[indicesProperty].itemType.type == ply_type::cFLOAT)
+						return cBINARY_UNSUPPORTED;
+					for (size_t i = 0; i < element.properties.size(); ++i)
+					{
+						if (element.properties[i].isList && int(i) != indicesProperty)
+							return cBINARY_UNSUPPORTED;
+					}
+				}
+				else if (element.fixedSize() == 0)
+				{
+					return cBINARY_UNSUPPORTED;
+				}
+			}
+			if (vertexElement < 0 || faceElement < 0)
+				return cBINARY_UNSUPPORTED;
+
+			std::cout << "PlyMeshLoader: Preparing to load binary model.\n";
+			meshDataVector.push_back(triangle_mesh_data(pos, rot, size));
+			triangle_mesh_data& meshData = meshDataVector.back();
+			const size_t nvertices = elements[vertexElement].count;
+			meshData.initialCreateVertexBuffer(nvertices);
+			meshData.initialCreateTriangleBuffer(elements[faceElement].count);
+
+			//the loop stops early if the file is truncated or has invalid indices
+			const char* p = headerEnd + 1;
+			size_t e = 0;
+			for (; e < elements.size(); ++e)
+			{
+				const ply_element& element = elements[e];
+				if (int(e) == vertexElement)
+				{
+					const size_t stride = element.fixedSize();
+					if (size_t(end - p) < stride*element.count)
+						break;
+					//byte offsets of x, y and z in a vertex
+					size_t offsets[3] = { 0, 0, 0 };
+					int axes[3] = { xProperty, yProperty, zProperty };
+					for (int k = 0; k < 3; ++k)
+					{
+						for (int i = 0; i < axes[k]; ++i)
+							offsets[k] += element.properties[i].itemType.size;
+					}
+					const ply_type& tx = element.properties[xProperty].itemType, &ty = element.properties[yProperty].itemType, &tz = element.properties[zProperty].itemType;
+					bool nativeFloats = !swap && tx.type == ply_type::cFLOAT && tx.size == 4 && ty.type == ply_type::cFLOAT && ty.size == 4 && tz.type == ply_type::cFLOAT && tz.size == 4;
+					for (size_t i = 0; i < element.count; ++i, p += stride)
+					{
+						BasicMath::vec3 position;
+						if (nativeFloats)
+						{
+							memcpy(&position.x, p + offsets[0], sizeof(float));
+							memcpy(&position.y, p + offsets[1], sizeof(float));
+							memcpy(&position.z, p + offsets[2], sizeof(float));
+						}
+						else
+						{
+							position = BasicMath::vec3(float(plyValue(p + offsets[0], tx, swap)), float(plyValue(p + offsets[1], ty, swap)), float(plyValue(p + offsets[2], tz, swap)));
+						}
+						meshData.initialAddVertexFromPosition(position);
+					}
+				}
+				else if (int(e) == faceElement)
+				{
+					//bytes of the scalar properties before and after the list
+					size_t before = 0, after = 0;
+					for (int i = 0; i < int(element.properties.size()); ++i)
+					{
+						if (i < indicesProperty)
+							before += element.properties[i].itemType.size;
+						else if (i > indicesProperty)
+							after += element.properties[i].itemType.size;
+					}
+					const ply_type& countType = element.properties[indicesProperty].countType;
+					const ply_type& indexType = element.properties[indicesProperty].itemType;
+					size_t i = 0;
+					for (; i < element.count; ++i)
+					{
+						if (size_t(end - p) < before + countType.size)
+							break;
+						p += before;
+						size_t n = size_t(plyValue(p, countType, swap));
+						p += countType.size;
+						if (size_t(end - p) < n*indexType.size + after)
+							break;
+						if (n >= 3)
+						{
+							size_t i0 = size_t(plyValue(p, indexType, swap)), i1 = size_t(plyValue(p + indexType.size, indexType, swap)), i2 = size_t(plyValue(p + 2 * indexType.size, indexType, swap));
+							if (i0 >= nvertices || i1 >= nvertices || i2 >= nvertices)
+								break;
+							meshData.initialAddTriangleAndAccumulateNormals(i0, i1, i2);
+						}
+						p += n*indexType.size + after;
+					}
+					if (i != element.count)
+						break;
+				}
+				else
+				{
+					if (size_t(end - p) < element.fixedSize()*element.count)
+						break;
+					p += element.fixedSize()*element.count;
+				}
+			}
+			if (e != elements.size())
+			{
+				std::cout << "PlyMeshLoader: Failed reading ply file.\n";
+				meshDataVector.pop_back();
+				return cBINARY_FAILED;
+			}
+
+			meshData.initialUpdateBoundingBox();
+			meshData.initialNormalizeNormals();
+			std::cout << "PlyMeshLoader: Mesh loaded successfully.\n";
+			return cBINARY_LOADED;
+		}
+
 		//loads a triangles mesh from a .ply file, and scales, rotates and translates it, in that order
 		int loadPlyMesh(const char* filename, BasicMath::vec3 pos = BasicMath::vec3::zero, BasicMath::vec3 rot = BasicMath::vec3::zero, BasicMath::vec3 size = BasicMath::vec3::one)
 		{
+			//binary files are read in bulk, rply handles the rest
+			binary_load_result binaryResult = loadBinaryPlyMesh(filename, pos, rot, size);
+			if (binaryResult != cBINARY_UNSUPPORTED)
+				return binaryResult == cBINARY_LOADED ? 1 : 0;
+
 			//open ply file
 			p_ply ply = ply_open(filename, NULL, 0, NULL);
 			//managed to open it?
@@ -0,0 +1,98 @@
+#ifndef RAYTR_CORE_ALIAS_TABLE_H
+#define RAYTR_CORE_ALIAS_TABLE_H
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Raytr_Core
+{
+	//! Draws indices with probabilities proportional to a set of weights in O(1) - Vose's alias method
+	/*!
+		Every slot keeps its own index with probability keep[slot] and gives the rest to its alias,
+		so a sample is one 32 bit random number: the high half of bits*size picks the slot and the low half decides.
+		A float would leave only a few bits for the fraction with a large table and round keep[] with it.
+		If all the weights are 0 the indices are drawn uniformly.
+	*/
+	class alias_table
+	{
+	private:
+		std::vector<float> keep;		//!< probability of keeping the slot's own index instead of its alias
+		std::vector<uint32_t> alias;
+		std::vector<float> weights;
+		double totalWeight;
+
+	public:
+		alias_table() : totalWeight(0.0) {}
+
+		//! builds the table over n weights, they have to be non negative
+		void build(const float* w, size_t n)
+		{
+			weights.assign(w, w + n);
+			totalWeight = 0.0;
+			for (size_t i = 0; i < n; ++i)
+				totalWeight += weights[i];
+			keep.assign(n, 1.0f);
+			alias.resize(n);
+			std::vector<double> scaled(n);
+			std::vector<uint32_t> small, large;
+			for (size_t i = 0; i < n; ++i)
+			{
+				alias[i] = uint32_t(i);
+				scaled[i] = totalWeight > 0.0 ? double(weights[i])*n / totalWeight : 1.0;
+				(scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+			}
+			while (!small.empty() && !large.empty())
+			{
+				uint32_t s = small.back(), l = large.back();
+				small.pop_back();
+				keep[s] = float(scaled[s]);
+				alias[s] = l;
+				scaled[l] -= 1.0 - scaled[s];
+				if (scaled[l] < 1.0)
+				{
+					large.pop_back();
+					small.push_back(l);
+				}
+			}
+			//what's left is 1 up to rounding
+		}
+
+		//! the index for 32 uniformly distributed random bits
+		size_t sample(uint32_t bits) const
+		{
+			uint64_t scaled = uint64_t(bits)*keep.size();
+			size_t slot = size_t(scaled >> 32);
+			double fraction = double(uint32_t(scaled)) * (1.0 / 4294967296.0);
+			return fraction < keep[slot] ? slot : alias[slot];
+		}
+
+		//! the probability of drawing index i
+		float probability(size_t i) const
+		{
+			return totalWeight > 0.0 ? float(weights[i] / totalWeight) : 1.0f / keep.size();
+		}
+
+		float total() const
+		{
+			return float(totalWeight);
+		}
+
+		size_t size() const
+		{
+			return keep.size();
+		}
+
+		bool empty() const
+		{
+			return keep.empty();
+		}
+
+		//! bytes used by the table
+		size_t memoryUsage() const
+		{
+			return keep.capacity()*sizeof(float) + alias.capacity()*sizeof(uint32_t) + weights.capacity()*sizeof(float);
+		}
+	};
+}
+
+#endif
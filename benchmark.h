@@ -0,0 +1,407 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+#include "PlyLoader.h"
+#include "octree.h"
+#include "bvh.h"
+#include "triangle_leaf_kernels.h"
+#include "camera.h"
+#include "high_precision_timer.h"
+#include "pcg32.h"
+#include "ray_sorting.h"
+#include "rds.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+//! micro benchmarks run from the command line instead of rendering
+namespace Benchmark
+{
+	//! rays starting in a box 3 times the size of the mesh's aabb aimed at random points inside it, the seed is fixed so runs are comparable
+	std::vector<Raytr_Core::ray> randomRays(const Raytr_Core::bounding_volume_aabb& box, size_t count, unsigned seed)
+	{
+		std::mt19937 generator(seed);
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		std::vector<Raytr_Core::ray> rays;
+		rays.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			BasicMath::vec3 o = box.center() + 3.0f*box.halfSize()*BasicMath::vec3(distribution(generator), distribution(generator), distribution(generator));
+			BasicMath::vec3 target = box.center() + box.halfSize()*BasicMath::vec3(distribution(generator), distribution(generator), distribution(generator));
+			rays.push_back(Raytr_Core::ray(o, BasicMath::normalize(target - o)));
+		}
+		return rays;
+	}
+
+	//! casts all the rays at the mesh, returns the time taken, hits are summed up in checksum to compare the implementations
+	double castRays(const Raytr_Core::triangle_mesh& mesh, const std::vector<Raytr_Core::ray>& rays, double& checksum)
+	{
+		HighPrecisionTimer timer;
+		timer.StartCounter();
+		checksum = 0.0;
+		Raytr_Core::intersection_info info;
+		for (const Raytr_Core::ray& r : rays)
+		{
+			if (mesh.intersect(r, BasicMath::cEPSILON, BasicMath::cINFINITY, info))
+				checksum += info.t;
+		}
+		return timer.GetCounter();
+	}
+
+	//! casts every ray at the mesh and at the reference, returns how many of them differ - a hit on one side only or distances further apart than tolerance (relative)
+	/*!
+		The reference is the brute force mesh, so a traversal that skips a child it should have visited or stops too early shows up here
+		even where the checksums of the timed runs happen to agree.
+	*/
+	size_t compareHits(const Raytr_Core::triangle_mesh& mesh, const Raytr_Core::triangle_mesh& reference, const std::vector<Raytr_Core::ray>& rays,
+		float tolerance, size_t& hitMismatches, size_t& distanceMismatches)
+	{
+		hitMismatches = distanceMismatches = 0;
+		Raytr_Core::intersection_info info, referenceInfo;
+		for (const Raytr_Core::ray& r : rays)
+		{
+			bool hit = mesh.intersect(r, BasicMath::cEPSILON, BasicMath::cINFINITY, info);
+			bool referenceHit = reference.intersect(r, BasicMath::cEPSILON, BasicMath::cINFINITY, referenceInfo);
+			if (hit != referenceHit)
+				++hitMismatches;
+			else if (hit && std::abs(info.t - referenceInfo.t) > tolerance*referenceInfo.t)
+				++distanceMismatches;
+		}
+		return hitMismatches + distanceMismatches;
+	}
+
+	//! compares the scalar and the simd leaf kernels on every instruction set the cpu supports
+	/*!
+		The brute force mesh runs the kernels over the whole triangle buffer, so it measures the raw triangle tests,
+		the octree and the bvh show the effect on the leaves of an actual hierarchy.
+	*/
+	bool leafKernels(const char* plyFile)
+	{
+		using namespace Raytr_Core;
+		if (!PlyLoader::loadPlyMesh(plyFile))
+		{
+			std::cout << "Benchmark: couldn't load " << plyFile << "\n";
+			return false;
+		}
+		const triangle_mesh_data& meshData = meshDataVector.back();
+		triangle_mesh bruteForce(meshData, nullptr);
+		triangle_octree_mesh octreeMesh(meshData, nullptr, 10, 40);
+		triangle_bvh_mesh bvhMesh(meshData, nullptr, 4);
+		std::vector<ray> fewRays = randomRays(meshData.getBoundingBox(), 2000, 1);
+		std::vector<ray> manyRays = randomRays(meshData.getBoundingBox(), 200000, 2);
+
+		simd_level best = triangle_leaf_kernels::detect();
+		std::cout << "Benchmark: " << meshData.triangleCount() << " triangles, best instruction set: " << triangle_leaf_kernels::levelName(best) << "\n";
+		double scalarChecksum[3] = { 0.0, 0.0, 0.0 };
+		for (int l = int(simd_level::scalar); l <= int(best); ++l)
+		{
+			triangle_leaf_kernels::level() = simd_level(l);
+			double checksum[3];
+			double bruteTime = castRays(bruteForce, fewRays, checksum[0]);
+			double octreeTime = castRays(octreeMesh, manyRays, checksum[1]);
+			double bvhTime = castRays(bvhMesh, manyRays, checksum[2]);
+			if (l == int(simd_level::scalar))
+			{
+				for (int k = 0; k < 3; ++k)
+					scalarChecksum[k] = checksum[k];
+			}
+
+			std::cout << triangle_leaf_kernels::levelName(simd_level(l)) << ":\n";
+			std::cout << "  brute force: " << fewRays.size()*meshData.triangleCount() / bruteTime*1e-6 << " Mtriangle tests/s\n";
+			std::cout << "  octree: " << manyRays.size() / octreeTime*1e-6 << " Mrays/s\n";
+			std::cout << "  bvh: " << manyRays.size() / bvhTime*1e-6 << " Mrays/s\n";
+			for (int k = 0; k < 3; ++k)
+			{
+				if (std::abs(checksum[k] - scalarChecksum[k]) > 1e-3*std::abs(scalarChecksum[k]))
+					std::cout << "  hits differ from the scalar kernel: " << checksum[k] << " vs " << scalarChecksum[k] << "\n";
+			}
+		}
+		triangle_leaf_kernels::level() = best;
+		return true;
+	}
+
+	//! times the vector and matrix code the integrator spends its time in
+	/*!
+		The backend is chosen at compile time, so build once with and once without BASICMATH_SIMD and compare the outputs.
+		The checksums should be the same (up to rounding) for both builds.
+	*/
+	bool math(const char* plyFile)
+	{
+		using namespace Raytr_Core;
+		using namespace BasicMath;
+#ifdef BASICMATH_SIMD
+		std::cout << "Benchmark: BasicMath backend: sse, sizeof(vec3) = " << sizeof(vec3) << "\n";
+#else
+		std::cout << "Benchmark: BasicMath backend: scalar, sizeof(vec3) = " << sizeof(vec3) << "\n";
+#endif
+		const size_t count = 1 << 20;
+		std::mt19937 generator(3);
+		std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+		std::vector<vec3> a(count), b(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			a[i] = normalize(vec3(distribution(generator), distribution(generator), distribution(generator)));
+			b[i] = vec3(distribution(generator), distribution(generator), distribution(generator));
+		}
+
+		HighPrecisionTimer timer;
+		vec3 sum(0);
+		//building a shading frame
+		timer.StartCounter();
+		for (size_t i = 0; i < count; ++i)
+		{
+			vec3 t = normalize(crossProduct(a[i], b[i]));
+			sum += t*dotProduct(t, b[i]) + crossProduct(t, a[i]);
+		}
+		std::cout << "  frame (cross, normalize, dot): " << timer.GetCounter()*1e9 / count << " ns/op, checksum " << sum << "\n";
+
+		//sampling a direction around the normal, as castRay does after every bounce
+		sum = vec3(0);
+		timer.StartCounter();
+		for (size_t i = 0; i < count; ++i)
+		{
+			sum += createCoordinateSystem(a[i])*b[i];
+		}
+		std::cout << "  createCoordinateSystem * vec3: " << timer.GetCounter()*1e9 / count << " ns/op, checksum " << sum << "\n";
+
+		//matrix products (the mesh transforms)
+		mat3 product(0.0f);
+		timer.StartCounter();
+		for (size_t i = 0; i + 1 < count; ++i)
+		{
+			product += mat3(a[i], b[i], a[i + 1])*mat3(b[i], a[i], b[i + 1]);
+		}
+		std::cout << "  mat3 * mat3: " << timer.GetCounter()*1e9 / count << " ns/op, checksum " << product[0] + product[1] + product[2] << "\n";
+
+		//primary rays
+		camera cam(vec3(0, 0, -5), vec3(0), vec3(0, 1, 0), 1.0f, 40.0f);
+		sum = vec3(0);
+		timer.StartCounter();
+		for (size_t i = 0; i < count; ++i)
+		{
+			sum += cam.getRay(b[i].x, b[i].y).direction;
+		}
+		std::cout << "  camera::getRay: " << timer.GetCounter()*1e9 / count << " ns/op, checksum " << sum << "\n";
+
+		//a whole traversal of the bunny's bvh
+		if (!PlyLoader::loadPlyMesh(plyFile))
+		{
+			std::cout << "Benchmark: couldn't load " << plyFile << "\n";
+			return false;
+		}
+		const triangle_mesh_data& meshData = meshDataVector.back();
+		triangle_bvh_mesh bvhMesh(meshData, nullptr, 4);
+		std::vector<ray> rays = randomRays(meshData.getBoundingBox(), 200000, 2);
+		double checksum;
+		double time = castRays(bvhMesh, rays, checksum);
+		std::cout << "  bvh traversal: " << time*1e9 / rays.size() << " ns/ray, checksum " << checksum << "\n";
+		return true;
+	}
+
+	//! named results of a benchmark run, printed, saved as json and compared to a saved run
+	class benchmark_report
+	{
+	private:
+		struct entry
+		{
+			std::string name;
+			double value;
+			bool higherIsBetter;	//!< Mrays/s vs times
+		};
+		std::vector<entry> entries;
+
+	public:
+		void add(const std::string& name, double value, bool higherIsBetter)
+		{
+			entries.push_back(entry{ name, value, higherIsBetter });
+			std::cout << "  " << name << ": " << value << "\n";
+		}
+
+		//! writes the results as a flat json object
+		bool writeJson(const char* fileName) const
+		{
+			std::ofstream out(fileName);
+			if (!out)
+				return false;
+			out << "{\n";
+			for (size_t i = 0; i < entries.size(); ++i)
+				out << "  \"" << entries[i].name << "\": " << entries[i].value << (i + 1 < entries.size() ? ",\n" : "\n");
+			out << "}\n";
+			return bool(out);
+		}
+
+		//! prints the change of every result relative to a json written by writeJson
+		bool compare(const char* baselineFile) const
+		{
+			std::ifstream in(baselineFile);
+			if (!in)
+				return false;
+			std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			std::cout << "Compared to " << baselineFile << ":\n";
+			for (const entry& e : entries)
+			{
+				size_t pos = json.find("\"" + e.name + "\"");
+				if (pos == std::string::npos || (pos = json.find(':', pos)) == std::string::npos)
+				{
+					std::cout << "  " << e.name << ": not in the baseline\n";
+					continue;
+				}
+				double baseline = std::strtod(json.c_str() + pos + 1, nullptr);
+				double change = baseline == 0.0 ? 0.0 : 100.0*(e.value - baseline) / baseline;
+				bool better = e.higherIsBetter ? change > 0.0 : change < 0.0;
+				std::cout << "  " << e.name << ": " << baseline << " -> " << e.value << " (" << (change > 0.0 ? "+" : "") << change << "%"
+					<< (std::abs(change) < 2.0 ? "" : better ? ", better" : ", worse") << ")\n";
+			}
+			return true;
+		}
+	};
+
+	//! runs f repeats times and returns the shortest time, the first runs warm up the caches
+	template<class F>
+	double bestOf(int repeats, F f)
+	{
+		double best = 0.0;
+		for (int i = 0; i < repeats; ++i)
+		{
+			HighPrecisionTimer timer;
+			timer.StartCounter();
+			f();
+			double time = timer.GetCounter();
+			if (i == 0 || time < best)
+				best = time;
+		}
+		return best;
+	}
+
+	//! adds the Mrays/s and ns/ray of a timed set of rays to the report
+	void addRayRate(benchmark_report& report, const std::string& name, size_t rays, double time)
+	{
+		report.add(name + "_mrays_per_s", rays / time*1e-6, true);
+		report.add(name + "_ns_per_ray", time*1e9 / rays, false);
+	}
+
+	//! times the octree build and the ray queries on a mesh
+	/*!
+		The camera rays go through a grid of pixels in front of the mesh, so neighbouring rays take the same paths through the tree.
+		The diffuse rays start at the points the camera rays hit, in cosine distributed directions around the normals - the incoherent
+		rays of the later bounces. They're traced once in the order they were generated and once sorted by ray_sorting. The shadow rays go from the same points to a point light above the mesh.
+		Everything is seeded, so the checksums (sums of the hit distances/counts) only change if the results do.
+		Every hierarchy is also checked ray by ray against the brute force mesh on a part of the camera and diffuse rays and on random rays.
+	*/
+	bool meshQueries(const char* plyFile, benchmark_report& report)
+	{
+		using namespace Raytr_Core;
+		using namespace BasicMath;
+		const int repeats = 3, resolution = 512;
+		if (!PlyLoader::loadPlyMesh(plyFile))
+		{
+			std::cout << "Benchmark: couldn't load " << plyFile << "\n";
+			return false;
+		}
+		const triangle_mesh_data& meshData = meshDataVector.back();
+		std::cout << "Benchmark: " << plyFile << ", " << meshData.triangleCount() << " triangles, leaf kernels: "
+			<< triangle_leaf_kernels::levelName(triangle_leaf_kernels::level()) << "\n";
+
+		std::unique_ptr<triangle_octree_mesh> octreeMesh;
+		double buildTime = bestOf(repeats, [&]() { octreeMesh.reset(new triangle_octree_mesh(meshData, nullptr, 10, 40)); });
+		report.add("octree_build_ms", buildTime*1e3, false);
+		std::unique_ptr<triangle_octree_mesh> compactOctreeMesh(new triangle_octree_mesh(meshData, nullptr, 10, 40));
+		compactOctreeMesh->compact();
+		std::unique_ptr<triangle_bvh_mesh> bvhMesh;
+		buildTime = bestOf(repeats, [&]() { bvhMesh.reset(new triangle_bvh_mesh(meshData, nullptr, 4)); });
+		report.add("bvh_build_ms", buildTime*1e3, false);
+		report.add("octree_memory_kb", octreeMesh->tree().memoryUsage() / 1024.0, false);
+		report.add("octree_compact_memory_kb", compactOctreeMesh->tree().memoryUsage() / 1024.0, false);
+		report.add("bvh_memory_kb", bvhMesh->hierarchy().memoryUsage() / 1024.0, false);
+
+		//coherent camera rays
+		const bounding_volume_aabb& box = meshData.getBoundingBox();
+		float extent = std::max(box.halfSize().x, std::max(box.halfSize().y, box.halfSize().z));
+		camera cam(box.center() + vec3(0, 0, 4 * extent), box.center(), vec3(0, 1, 0), 1.0f, 40.0f);
+		std::vector<ray> cameraRays;
+		cameraRays.reserve(resolution*resolution);
+		for (int y = 0; y < resolution; ++y)
+		{
+			for (int x = 0; x < resolution; ++x)
+				cameraRays.push_back(cam.getRay(2.0f*x / (resolution - 1) - 1.0f, 1.0f - 2.0f*y / (resolution - 1)));
+		}
+
+		//diffuse and shadow rays from the visible points
+		pcg32 rng(1, 1);
+		vec3 light = box.center() + vec3(2 * extent, 4 * extent, 2 * extent);
+		std::vector<ray> diffuseRays, shadowRays;
+		std::vector<float> shadowDistances;
+		intersection_info info;
+		for (const ray& r : cameraRays)
+		{
+			if (!octreeMesh->intersect(r, cEPSILON, cINFINITY, info))
+				continue;
+			vec3 origin = info.position + info.normal*cEPSILON;
+			vec3 direction = createCoordinateSystem(info.normal)*cosineWeightedHemisphereSample(rng.nextFloat(), rng.nextFloat());
+			diffuseRays.push_back(ray(origin, normalize(direction)));
+			shadowRays.push_back(ray(origin, normalize(light - origin)));
+			shadowDistances.push_back((light - origin).length());
+		}
+		std::cout << "  " << cameraRays.size() << " camera rays, " << diffuseRays.size() << " hit the mesh\n";
+		//the same diffuse rays sorted by direction and origin
+		std::vector<uint32_t> order(diffuseRays.size());
+		std::vector<uint64_t> keys;
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = uint32_t(i);
+		ray_sorting::sort(order, box, [&](uint32_t i) -> const ray& { return diffuseRays[i]; }, keys);
+		std::vector<ray> sortedRays;
+		sortedRays.reserve(order.size());
+		for (uint32_t i : order)
+			sortedRays.push_back(diffuseRays[i]);
+
+		//brute force is slow, so only every cCHECK_STRIDE-th camera and diffuse ray is checked
+		const size_t cCHECK_STRIDE = 64;
+		const float cCHECK_TOLERANCE = 1e-5f;
+		triangle_mesh bruteForce(meshData, nullptr);
+		std::vector<ray> checkRays = randomRays(box, 4000, 3);
+		for (size_t i = 0; i < cameraRays.size(); i += cCHECK_STRIDE)
+			checkRays.push_back(cameraRays[i]);
+		for (size_t i = 0; i < diffuseRays.size(); i += cCHECK_STRIDE / 4)
+			checkRays.push_back(diffuseRays[i]);
+
+		const std::pair<const char*, const triangle_mesh*> meshes[3] = { { "octree", octreeMesh.get() }, { "octree_compact", compactOctreeMesh.get() },
+			{ "bvh", bvhMesh.get() } };
+		for (const auto& mesh : meshes)
+		{
+			size_t hitMismatches, distanceMismatches;
+			size_t mismatches = compareHits(*mesh.second, bruteForce, checkRays, cCHECK_TOLERANCE, hitMismatches, distanceMismatches);
+			report.add(std::string(mesh.first) + "_mismatches", double(mismatches), false);
+			std::cout << "  " << mesh.first << ": " << mismatches << " of " << checkRays.size() << " rays differ from brute force ("
+				<< hitMismatches << " hit/miss, " << distanceMismatches << " distance)\n";
+
+			double checksum = 0.0;
+			double time = bestOf(repeats, [&]() { castRays(*mesh.second, cameraRays, checksum); });
+			addRayRate(report, std::string(mesh.first) + "_coherent", cameraRays.size(), time);
+			std::cout << "    checksum " << checksum << "\n";
+			time = bestOf(repeats, [&]() { castRays(*mesh.second, diffuseRays, checksum); });
+			addRayRate(report, std::string(mesh.first) + "_incoherent", diffuseRays.size(), time);
+			std::cout << "    checksum " << checksum << "\n";
+			time = bestOf(repeats, [&]() { castRays(*mesh.second, sortedRays, checksum); });
+			addRayRate(report, std::string(mesh.first) + "_incoherent_sorted", sortedRays.size(), time);
+			std::cout << "    checksum " << checksum << "\n";
+			size_t blocked = 0;
+			time = bestOf(repeats, [&]()
+			{
+				blocked = 0;
+				for (size_t i = 0; i < shadowRays.size(); ++i)
+				{
+					if (mesh.second->occluded(shadowRays[i], cEPSILON, shadowDistances[i]))
+						++blocked;
+				}
+			});
+			addRayRate(report, std::string(mesh.first) + "_occlusion", shadowRays.size(), time);
+			std::cout << "    blocked " << blocked << "\n";
+		}
+		return true;
+	}
+}
+
+#endif
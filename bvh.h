@@ -0,0 +1,620 @@
+#ifndef RAYTR_CORE_BVH_H
+#define RAYTR_CORE_BVH_H
+#include "triangle_mesh.h"
+#include "high_precision_timer.h"
+#include "render_stats.h"
+#include "ray_packet.h"
+#include "worker_pool.h"
+#include <vector>
+#include <cstdint>
+
+namespace Raytr_Core
+{
+	//! bounding volume hierarchy built with the surface area heuristic (binned)
+	/*!
+		The nodes are stored in a single flat array, the two children of an inner node are always adjacent.
+		Each primitive is referenced exactly once - leaves point into a shared array of primitive indices.
+		The hierarchy only knows the primitives' bounds, the intersection with the primitives themselves is
+		done by the caller through traverse().
+	*/
+	class bvh
+	{
+	public:
+		//! a flat bvh node - 32 bytes (64 with BASICMATH_SIMD, where vec3 is padded to 16 bytes)
+		struct node
+		{
+			BasicMath::vec3 min;		//!< box corner with min coordinates
+			uint32_t leftFirst;			//!< index of the left child for inner nodes, index of the first primitive index for leaves
+			BasicMath::vec3 max;		//!< box corner with max coordinates
+			uint32_t count;				//!< number of primitives in a leaf, 0 for inner nodes
+
+			bool isLeaf() const
+			{
+				return count != 0;
+			}
+		};
+
+	private:
+		static const int cBINS = 12;				//!< number of bins used to evaluate the sah per axis
+		static const int cMAX_DEPTH = 64;			//!< maximum depth of the tree - also the traversal stack size
+		static const int cMIN_PACKET_RAYS = 4;		//!< subtrees reached by fewer rays of a packet are traversed ray by ray
+		static const int cPARALLEL_DEPTH = 6;		//!< the subtrees below this depth are built in parallel
+		static const size_t cPARALLEL_MIN_PRIMITIVES = 16384;	//!< smaller hierarchies are built on the calling thread
+		static constexpr float cTRAVERSAL_COST = 1.0f;	//!< cost of traversing a node relative to intersecting a triangle
+
+		//! a bin used when evaluating the sah
+		struct bin
+		{
+			BasicMath::vec3 min, max;
+			uint32_t count;
+
+			bin() : min(BasicMath::vec3::infinity), max(-BasicMath::vec3::infinity), count(0) {}
+		};
+
+		std::vector<node> nodes;			//!< flat node array, nodes[0] is the root
+		std::vector<uint32_t> indices;		//!< primitive indices referenced by the leaves
+		std::vector<BasicMath::vec3> primMin, primMax; //!< primitive bounds, used only during the build
+		std::vector<BasicMath::vec3> centroids; //!< primitive centroids, used only during the build
+		size_t maxElementsCount;
+
+		//! half of the surface area of a box
+		static float halfArea(const BasicMath::vec3& min, const BasicMath::vec3& max)
+		{
+			BasicMath::vec3 e = max - min;
+			return e.x*e.y + e.y*e.z + e.z*e.x;
+		}
+
+		//! calculates the bounds of the primitives of a node
+		void updateNodeBounds(node& n) const
+		{
+			n.min = BasicMath::vec3::infinity;
+			n.max = -BasicMath::vec3::infinity;
+			for (uint32_t i = n.leftFirst; i < n.leftFirst + n.count; ++i)
+			{
+				n.min = BasicMath::min(n.min, primMin[indices[i]]);
+				n.max = BasicMath::max(n.max, primMax[indices[i]]);
+			}
+		}
+
+		//! finds the best split along all axes by binning the centroids, returns the cost of the split
+		float findBestSplit(const node& n, int& bestAxis, float& bestPos) const
+		{
+			//bounds of the centroids - the bins are spread over them
+			BasicMath::vec3 cmin(BasicMath::vec3::infinity), cmax(-BasicMath::vec3::infinity);
+			for (uint32_t i = n.leftFirst; i < n.leftFirst + n.count; ++i)
+			{
+				cmin = BasicMath::min(cmin, centroids[indices[i]]);
+				cmax = BasicMath::max(cmax, centroids[indices[i]]);
+			}
+
+			float bestCost = BasicMath::cINFINITY;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				//all centroids lie on a plane perpendicular to this axis - can't split along it
+				if (cmax[axis] == cmin[axis])
+					continue;
+
+				//fill the bins
+				bin bins[cBINS];
+				float scale = cBINS / (cmax[axis] - cmin[axis]);
+				for (uint32_t i = n.leftFirst; i < n.leftFirst + n.count; ++i)
+				{
+					int b = std::min(cBINS - 1, int((centroids[indices[i]][axis] - cmin[axis])*scale));
+					++bins[b].count;
+					bins[b].min = BasicMath::min(bins[b].min, primMin[indices[i]]);
+					bins[b].max = BasicMath::max(bins[b].max, primMax[indices[i]]);
+				}
+
+				//sweep from the left and from the right to get the areas and counts for every plane between the bins
+				float leftArea[cBINS - 1], rightArea[cBINS - 1];
+				uint32_t leftCount[cBINS - 1], rightCount[cBINS - 1];
+				bin left, right;
+				for (int i = 0; i < cBINS - 1; ++i)
+				{
+					left.count += bins[i].count;
+					left.min = BasicMath::min(left.min, bins[i].min);
+					left.max = BasicMath::max(left.max, bins[i].max);
+					leftCount[i] = left.count;
+					leftArea[i] = left.count ? halfArea(left.min, left.max) : 0.0f;
+
+					right.count += bins[cBINS - 1 - i].count;
+					right.min = BasicMath::min(right.min, bins[cBINS - 1 - i].min);
+					right.max = BasicMath::max(right.max, bins[cBINS - 1 - i].max);
+					rightCount[cBINS - 2 - i] = right.count;
+					rightArea[cBINS - 2 - i] = right.count ? halfArea(right.min, right.max) : 0.0f;
+				}
+
+				//evaluate the sah for each plane
+				float binWidth = (cmax[axis] - cmin[axis]) / cBINS;
+				for (int i = 0; i < cBINS - 1; ++i)
+				{
+					float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+					if (leftCount[i] != 0 && rightCount[i] != 0 && cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestPos = cmin[axis] + binWidth*(i + 1);
+					}
+				}
+			}
+			return bestCost;
+		}
+
+		//! recursively subdivides a node of tree
+		/*!
+			If deferred isn't null the nodes reaching cPARALLEL_DEPTH are added to it instead of being subdivided.
+			The nodes only share the primitive data, which is read only, and disjoint ranges of the index array, so
+			subtrees can be subdivided in parallel into separate node arrays.
+		*/
+		void subdivide(std::vector<node>& tree, uint32_t nodeIndex, int depth, std::vector<uint32_t>* deferred)
+		{
+			if (depth >= cMAX_DEPTH - 1)
+				return;
+			if (deferred != nullptr && depth == cPARALLEL_DEPTH)
+			{
+				deferred->push_back(nodeIndex);
+				return;
+			}
+
+			int axis = 0;
+			float splitPos = 0;
+			float splitCost = findBestSplit(tree[nodeIndex], axis, splitPos);
+			//the sah cost of the node as a leaf vs as an inner node - both relative to the node's area
+			float leafCost = tree[nodeIndex].count*halfArea(tree[nodeIndex].min, tree[nodeIndex].max);
+			splitCost += cTRAVERSAL_COST*halfArea(tree[nodeIndex].min, tree[nodeIndex].max);
+
+			//no valid split, or not worth splitting a small enough node - stop here
+			if (splitCost == BasicMath::cINFINITY || (splitCost >= leafCost && tree[nodeIndex].count <= maxElementsCount))
+				return;
+
+			//partition the indices in place
+			uint32_t first = tree[nodeIndex].leftFirst;
+			uint32_t i = first;
+			uint32_t j = first + tree[nodeIndex].count;
+			while (i < j)
+			{
+				if (centroids[indices[i]][axis] < splitPos)
+					++i;
+				else
+					std::swap(indices[i], indices[--j]);
+			}
+			uint32_t leftCount = i - first;
+			//the binning guarantees both sides are non-empty, but be safe with floating point
+			if (leftCount == 0 || leftCount == tree[nodeIndex].count)
+				return;
+
+			//create the children next to each other
+			uint32_t leftIndex = uint32_t(tree.size());
+			tree.push_back(node());
+			tree.push_back(node());
+			tree[leftIndex].leftFirst = first;
+			tree[leftIndex].count = leftCount;
+			tree[leftIndex + 1].leftFirst = i;
+			tree[leftIndex + 1].count = tree[nodeIndex].count - leftCount;
+			updateNodeBounds(tree[leftIndex]);
+			updateNodeBounds(tree[leftIndex + 1]);
+
+			//the current node becomes an inner node
+			tree[nodeIndex].leftFirst = leftIndex;
+			tree[nodeIndex].count = 0;
+
+			subdivide(tree, leftIndex, depth + 1, deferred);
+			subdivide(tree, leftIndex + 1, depth + 1, deferred);
+		}
+
+		//! subdivides the nodes deferred by subdivide() on numThreads threads and appends their subtrees to nodes
+		void subdivideDeferred(const std::vector<uint32_t>& deferred, int numThreads)
+		{
+			//each subtree gets its own node array with its root at 0
+			std::vector<std::vector<node>> subtrees(deferred.size());
+			std::vector<uint32_t> tasks(deferred.size());
+			for (size_t i = 0; i < deferred.size(); ++i)
+				tasks[i] = uint32_t(i);
+			ThreadsDistribution::worker_pool<uint32_t> pool(numThreads, tasks, tasks.size(),
+				[&](ThreadsDistribution::worker_pool<uint32_t>& workers, int worker, const uint32_t& task)
+			{
+				subtrees[task].push_back(nodes[deferred[task]]);
+				subdivide(subtrees[task], 0, cPARALLEL_DEPTH, nullptr);
+			});
+			pool.wait();
+
+			//the root of a subtree replaces its deferred node, the rest is appended - the children stay adjacent
+			for (size_t i = 0; i < deferred.size(); ++i)
+			{
+				const std::vector<node>& subtree = subtrees[i];
+				uint32_t offset = uint32_t(nodes.size()) - 1;
+				nodes[deferred[i]] = subtree[0];
+				if (!subtree[0].isLeaf())
+					nodes[deferred[i]].leftFirst += offset;
+				for (size_t j = 1; j < subtree.size(); ++j)
+				{
+					nodes.push_back(subtree[j]);
+					if (!subtree[j].isLeaf())
+						nodes.back().leftFirst += offset;
+				}
+			}
+		}
+
+		//! slab test against a node's box, returns the entry distance or cINFINITY if missed
+		static float intersectNode(const node& n, const ray& r, const BasicMath::vec3& invDir, float tmin, float tmax)
+		{
+			float tx0 = (n.min.x - r.origin.x)*invDir.x, tx1 = (n.max.x - r.origin.x)*invDir.x;
+			float ty0 = (n.min.y - r.origin.y)*invDir.y, ty1 = (n.max.y - r.origin.y)*invDir.y;
+			float tz0 = (n.min.z - r.origin.z)*invDir.z, tz1 = (n.max.z - r.origin.z)*invDir.z;
+			float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), tmin));
+			float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tmax));
+			return tNear <= tFar ? tNear : BasicMath::cINFINITY;
+		}
+
+	public:
+		bvh() : maxElementsCount(4) {}
+
+		//! builds the hierarchy over count primitives given by their bounds
+		void build(const BasicMath::vec3* mins, const BasicMath::vec3* maxs, size_t count, size_t maxElementsCount)
+		{
+			HighPrecisionTimer buildTimer;
+			this->maxElementsCount = maxElementsCount;
+
+			nodes.clear();
+			primMin.assign(mins, mins + count);
+			primMax.assign(maxs, maxs + count);
+			indices.resize(count);
+			centroids.resize(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				indices[i] = uint32_t(i);
+				centroids[i] = 0.5f*(primMin[i] + primMax[i]);
+			}
+
+			//a binary tree with n leaves has at most 2n-1 nodes
+			nodes.reserve(count == 0 ? 1 : 2 * count - 1);
+			nodes.push_back(node());
+			nodes[0].leftFirst = 0;
+			nodes[0].count = uint32_t(count);
+			updateNodeBounds(nodes[0]);
+			if (count != 0)
+			{
+				//the top of the hierarchy is built on this thread, the subtrees below cPARALLEL_DEPTH in parallel
+				int numThreads = count < cPARALLEL_MIN_PRIMITIVES ? 1 : ThreadsDistribution::hardwareThreads();
+				std::vector<uint32_t> deferred;
+				subdivide(nodes, 0, 0, numThreads > 1 ? &deferred : nullptr);
+				if (!deferred.empty())
+					subdivideDeferred(deferred, numThreads);
+			}
+
+			nodes.shrink_to_fit();
+			//the bounds and centroids are not needed for traversal
+			std::vector<BasicMath::vec3>().swap(primMin);
+			std::vector<BasicMath::vec3>().swap(primMax);
+			std::vector<BasicMath::vec3>().swap(centroids);
+			RAYTR_CORE_COUNT(bvhBuildTime, buildTimer.GetCounter());
+		}
+
+		//! builds the hierarchy over all the triangles of the mesh data
+		void build(const triangle_mesh_data& mesh_data, size_t maxElementsCount)
+		{
+			std::vector<BasicMath::vec3> mins(mesh_data.triangleCount()), maxs(mesh_data.triangleCount());
+			for (size_t i = 0; i < mesh_data.triangleCount(); ++i)
+			{
+				mins[i] = mesh_data.getTriangles()[i].boundingBox.min();
+				maxs[i] = mesh_data.getTriangles()[i].boundingBox.max();
+			}
+			build(mins.data(), maxs.data(), mins.size(), maxElementsCount);
+		}
+
+		//! replaces the hierarchy with already built nodes and leaf indices (from a mesh cache)
+		void assign(const node* nodes, size_t nodeCount, const uint32_t* indices, size_t indexCount, size_t maxElementsCount)
+		{
+			this->maxElementsCount = maxElementsCount;
+			this->nodes.assign(nodes, nodes + nodeCount);
+			this->indices.assign(indices, indices + indexCount);
+		}
+
+		//! walks the nodes hit by the ray front to back and calls leafIntersect(primitiveIndices, count, closestSoFar) for each leaf
+		/*!
+			leafIntersect returns true when it finds a hit closer than closestSoFar among the leaf's primitives and updates closestSoFar.
+			Returns true if any primitive was hit.
+		*/
+		template<class LeafIntersector>
+		bool traverse(const ray& r, float tmin, float& closestSoFar, LeafIntersector leafIntersect) const
+		{
+			if (indices.empty())
+				return false;
+			return traverseFrom(0, r, tmin, closestSoFar, leafIntersect);
+		}
+
+		//! traverse() of the subtree under the node start
+		template<class LeafIntersector>
+		bool traverseFrom(uint32_t start, const ray& r, float tmin, float& closestSoFar, LeafIntersector leafIntersect) const
+		{
+			BasicMath::vec3 invDir = 1.0f / r.direction;
+			bool hit = false;
+
+			float tRoot = intersectNode(nodes[start], r, invDir, tmin, closestSoFar);
+			if (tRoot == BasicMath::cINFINITY)
+				return false;
+
+			//the stack holds the nodes still to visit together with their entry distances
+			uint32_t stack[cMAX_DEPTH];
+			float stackT[cMAX_DEPTH];
+			int stackSize = 0;
+			uint32_t current = start;
+			//counted locally, the thread's counters are updated once per traversal
+			uint64_t visits = 0;
+			while (true)
+			{
+				const node& n = nodes[current];
+				++visits;
+				if (n.isLeaf())
+				{
+					if (leafIntersect(&indices[n.leftFirst], n.count, closestSoFar))
+						hit = true;
+				}
+				else
+				{
+					//visit the closer child first, push the further one
+					uint32_t nearChild = n.leftFirst, farChild = n.leftFirst + 1;
+					float tNear = intersectNode(nodes[nearChild], r, invDir, tmin, closestSoFar);
+					float tFar = intersectNode(nodes[farChild], r, invDir, tmin, closestSoFar);
+					if (tFar < tNear)
+					{
+						std::swap(nearChild, farChild);
+						std::swap(tNear, tFar);
+					}
+					if (tNear != BasicMath::cINFINITY)
+					{
+						if (tFar != BasicMath::cINFINITY)
+						{
+							stack[stackSize] = farChild;
+							stackT[stackSize] = tFar;
+							++stackSize;
+						}
+						current = nearChild;
+						continue;
+					}
+				}
+
+				//pop the next node which could still contain a closer hit
+				do
+				{
+					if (stackSize == 0)
+					{
+						RAYTR_CORE_COUNT(nodeVisits, visits);
+						return hit;
+					}
+					--stackSize;
+				} while (stackT[stackSize] > closestSoFar);
+				current = stack[stackSize];
+			}
+		}
+
+		//! walks the nodes hit by the rays of packet selected by mask and calls leafIntersect(primitiveIndices, count, rayMask) for each leaf
+		/*!
+			rayMask selects the rays reaching the leaf, leafIntersect shrinks packet.tmax of the rays it finds closer hits for.
+			A node is first tested against the whole packet (packet.missesAll), then against its rays. A subtree reached by fewer
+			than cMIN_PACKET_RAYS rays is traversed by each of them on its own - the packet has diverged.
+		*/
+		template<class LeafIntersector>
+		void traversePacket(ray_packet& packet, uint64_t mask, LeafIntersector leafIntersect) const
+		{
+			if (indices.empty() || mask == 0)
+				return;
+
+			uint32_t stack[cMAX_DEPTH];
+			uint64_t stackMask[cMAX_DEPTH];
+			int stackSize = 0;
+			stack[stackSize] = 0;
+			stackMask[stackSize] = mask;
+			++stackSize;
+			uint64_t visits = 0;
+			while (stackSize != 0)
+			{
+				--stackSize;
+				uint32_t current = stack[stackSize];
+				const node& n = nodes[current];
+				uint64_t active = stackMask[stackSize];
+				if (packet.missesAll(n.min, n.max, packet.maxT(active)))
+					continue;
+				active = packet.hitMask(n.min, n.max, active);
+				if (active == 0)
+					continue;
+				++visits;
+
+				if (ray_packet::rayCount(active) < cMIN_PACKET_RAYS)
+				{
+					for (uint64_t rays = active; rays != 0; rays &= rays - 1)
+					{
+						int i = ray_packet::firstRay(rays);
+						traverseFrom(current, packet.getRay(i), packet.tmin, packet.tmax[i], [&](const uint32_t* primitives, uint32_t count, float& closest)
+						{
+							float before = closest;
+							leafIntersect(primitives, count, uint64_t(1) << i);
+							return closest < before;
+						});
+					}
+				}
+				else if (n.isLeaf())
+				{
+					leafIntersect(&indices[n.leftFirst], n.count, active);
+				}
+				else
+				{
+					//visit the child the first ray enters first before the other one
+					int first = ray_packet::firstRay(active);
+					ray r = packet.getRay(first);
+					BasicMath::vec3 invDir = packet.invDir(first);
+					uint32_t nearChild = n.leftFirst, farChild = n.leftFirst + 1;
+					if (intersectNode(nodes[farChild], r, invDir, packet.tmin, BasicMath::cINFINITY) < intersectNode(nodes[nearChild], r, invDir, packet.tmin, BasicMath::cINFINITY))
+						std::swap(nearChild, farChild);
+					stack[stackSize] = farChild;
+					stackMask[stackSize] = active;
+					++stackSize;
+					stack[stackSize] = nearChild;
+					stackMask[stackSize] = active;
+					++stackSize;
+				}
+			}
+			RAYTR_CORE_COUNT(nodeVisits, visits);
+		}
+
+		//! walks the nodes hit by the ray in any order and returns true as soon as leafOccluded(primitiveIndices, count) does
+		template<class LeafOccluder>
+		bool occluded(const ray& r, float tmin, float tmax, LeafOccluder leafOccluded) const
+		{
+			if (indices.empty())
+				return false;
+
+			BasicMath::vec3 invDir = 1.0f / r.direction;
+			uint32_t stack[cMAX_DEPTH];
+			int stackSize = 0;
+			stack[stackSize++] = 0;
+			uint64_t visits = 0;
+			while (stackSize != 0)
+			{
+				const node& n = nodes[stack[--stackSize]];
+				++visits;
+				if (intersectNode(n, r, invDir, tmin, tmax) == BasicMath::cINFINITY)
+					continue;
+
+				if (n.isLeaf())
+				{
+					if (leafOccluded(&indices[n.leftFirst], n.count))
+					{
+						RAYTR_CORE_COUNT(nodeVisits, visits);
+						return true;
+					}
+				}
+				else
+				{
+					stack[stackSize++] = n.leftFirst + 1;
+					stack[stackSize++] = n.leftFirst;
+				}
+			}
+			RAYTR_CORE_COUNT(nodeVisits, visits);
+			return false;
+		}
+
+		//! number of nodes in the hierarchy
+		size_t nodeCount() const
+		{
+			return nodes.size();
+		}
+
+		//! memory used by the nodes and the index array in bytes
+		size_t memoryUsage() const
+		{
+			return nodes.size()*sizeof(node) + indices.size()*sizeof(uint32_t);
+		}
+
+		//! the flat node array
+		const std::vector<node>& nodeArray() const
+		{
+			return nodes;
+		}
+
+		//! the primitive indices referenced by the leaves
+		const std::vector<uint32_t>& indexArray() const
+		{
+			return indices;
+		}
+
+		//! the maximum number of primitives in a leaf the hierarchy was built with
+		size_t maxLeafSize() const
+		{
+			return maxElementsCount;
+		}
+
+		//! the bounds of the whole hierarchy
+		bounding_volume_aabb boundingBox() const
+		{
+			return nodes.empty() ? bounding_volume_aabb() : bounding_volume_aabb(nodes[0].min, nodes[0].max);
+		}
+	};
+
+	//! triangle mesh using a sah built bvh for faster intersections
+	class triangle_bvh_mesh : public triangle_mesh
+	{
+	private:
+		bvh root;
+
+	public:
+		triangle_bvh_mesh(const triangle_mesh_data& mesh_data, material* pMaterial, size_t maxElementsCount = 4, const bounding_volume* boundingVolume = &cDefaultboundingVolume)
+			: triangle_mesh(mesh_data, pMaterial, boundingVolume)
+		{
+			//build the hierarchy
+			root.build(mesh_data, maxElementsCount);
+		}
+
+		//! uses an already built hierarchy over the triangles of mesh_data (from a mesh cache)
+		triangle_bvh_mesh(const triangle_mesh_data& mesh_data, material* pMaterial, const bvh& hierarchy, const bounding_volume* boundingVolume = &cDefaultboundingVolume)
+			: triangle_mesh(mesh_data, pMaterial, boundingVolume), root(hierarchy)
+		{
+		}
+
+		bool virtual intersect(const ray& r, float tmin, float tmax, intersection_info& info) const
+		{
+			//check against the bounding volume
+			//if a custom one is not explicitly passed to the construct bounding_volume_none is used
+			float tminTemp = tmin, tmaxTemp = tmax;
+			if (!boundingVolume->intersect(r, tminTemp, tmaxTemp))
+				return false;
+
+			//if the ray does not intersect any of the geometry in the hierarchy - then there's no intersection
+			const triangle_soa_buffer& soa = mesh_data.getIntersectionBuffer();
+			float closestSoFar = tmax;
+			uint32_t closestIndex = 0;
+			BasicMath::vec2 closestKs;
+			if (!root.traverse(r, tmin, closestSoFar, [&](const uint32_t* primitives, uint32_t count, float& closest)
+				{
+					return triangle_leaf_kernels::intersectIndexed(soa, primitives, count, r, tmin, closest, closestIndex, closestKs);
+				}))
+				return false;
+
+			//does intersect - fill out the shading data of the closest hit and update the pObject pointer
+			mesh_data.getTriangles()[closestIndex].fillIntersectionInfo(r, closestSoFar, closestKs, info);
+			info.pObject = this;
+			return true;
+		}
+
+		virtual void intersectPacket(ray_packet& packet, uint64_t mask, intersection_info* infos) const
+		{
+			mask = packetBoundingVolumeMask(packet, mask);
+			if (mask == 0)
+				return;
+
+			const triangle_soa_buffer& soa = mesh_data.getIntersectionBuffer();
+			triangle_packet_hits hits;
+			root.traversePacket(packet, mask, [&](const uint32_t* primitives, uint32_t count, uint64_t rayMask)
+			{
+				for (; rayMask != 0; rayMask &= rayMask - 1)
+				{
+					int i = ray_packet::firstRay(rayMask);
+					if (triangle_leaf_kernels::intersectIndexed(soa, primitives, count, packet.getRay(i), packet.tmin, packet.tmax[i], hits.closestIndex[i], hits.closestKs[i]))
+						hits.mask |= uint64_t(1) << i;
+				}
+			});
+			fillPacketInfos(packet, hits, infos);
+		}
+
+		bool virtual occluded(const ray& r, float tmin, float tmax) const
+		{
+			float tminTemp = tmin, tmaxTemp = tmax;
+			if (!boundingVolume->intersect(r, tminTemp, tmaxTemp))
+				return false;
+
+			const triangle_soa_buffer& soa = mesh_data.getIntersectionBuffer();
+			return root.occluded(r, tmin, tmax, [&](const uint32_t* primitives, uint32_t count)
+			{
+				return triangle_leaf_kernels::occludedIndexed(soa, primitives, count, r, tmin, tmax);
+			});
+		}
+
+		//! the underlying hierarchy
+		const bvh& hierarchy() const
+		{
+			return root;
+		}
+	};
+}
+
+#endif
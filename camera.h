@@ -10,7 +10,7 @@ namespace Raytr_Core
 	public:
 
 		//! build a camera from origin, a target lcation and an up vector
-		camera(const BasicMath::vec3& pos = BasicMath::vec3(0), const BasicMath::vec3& target=BasicMath::vec3(0,0,1), BasicMath::vec3& up= BasicMath::vec3(0,1,0),
+		camera(const BasicMath::vec3& pos = BasicMath::vec3(0), const BasicMath::vec3& target=BasicMath::vec3(0,0,1), const BasicMath::vec3& up= BasicMath::vec3(0,1,0),
 			float ar=1, float fov=90)
 			: position(pos), aspectRatio(ar)
 		{
@@ -65,7 +65,7 @@ namespace Raytr_Core
 		}
 		virtual  BasicMath::vec3 generate() const
 		{
-			if (BasicMath::uniform_distribution(BasicMath::generator) < mix)
+			if (BasicMath::randomFloat() < mix)
 			{
 				return p[0]->generate();
 			}
@@ -83,7 +83,7 @@ namespace Raytr_Core
 		virtual pdf_info sample(const BasicMath::vec3& normal) const
 		{
 			pdf_info result;
-			if (BasicMath::uniform_distribution(BasicMath::generator) < mix)
+			if (BasicMath::randomFloat() < mix)
 			{
 				result.generatedDirection = p[0]->generate();
 				result.pdf_value = 1/mix*p[0]->value(result.generatedDirection);
@@ -113,8 +113,8 @@ namespace Raytr_Core
 		virtual BasicMath::vec3 generate() const
 		{
 			//generate 2 numbers from [0,1] with pdf(x) = 1
-			float r1 = BasicMath::uniform_distribution(BasicMath::generator);
-			float r2 = BasicMath::uniform_distribution(BasicMath::generator);
+			float r1 = BasicMath::randomFloat();
+			float r2 = BasicMath::randomFloat();
 			//generate a vector in the hemisphere around the normal = [0,1,0]
 			float sinTheta = sqrtf(1 - r2 * r2);
 			float phi = 2 * float(M_PI) * r1;
@@ -151,8 +151,8 @@ namespace Raytr_Core
 		virtual BasicMath::vec3 generate() const
 		{
 			//generate 2 numbers from [0,1] with pdf(x) = 1
-			float r1 = BasicMath::uniform_distribution(BasicMath::generator);
-			float r2 = BasicMath::uniform_distribution(BasicMath::generator);
+			float r1 = BasicMath::randomFloat();
+			float r2 = BasicMath::randomFloat();
 			//generate a vector in the hemisphere around the normal = [0,1,0]
 			float sinTheta = sqrtf(1 - r2);
 			float phi = 2 * float(M_PI) * r1;
@@ -1,36 +1,31 @@
 #ifndef HIGH_PRECISION_TIMER_H
 #define HIGH_PRECISION_TIMER_H
 
-#define NOMINMAX	 //suppres windows min max
-#include <Windows.h> //precise timing
-#include <iostream>
+#include <chrono> //precise timing
 
 //! a minimal implementation of a high precision time calss
+/*!
+	Uses the monotonic std::chrono::steady_clock (QueryPerformanceCounter on windows, clock_gettime on linux).
+*/
 class HighPrecisionTimer
 {
 private:
-	double PCFreq = 0.0;
-	__int64 CounterStart = 0;
+	std::chrono::steady_clock::time_point CounterStart;
 public:
 
+	HighPrecisionTimer() : CounterStart(std::chrono::steady_clock::now())
+	{}
+
 	void StartCounter()
 	{
-		LARGE_INTEGER li;
-		if (!QueryPerformanceFrequency(&li))
-			std::cout << "QueryPerformanceFrequency failed!\n";
-
-		PCFreq = double(li.QuadPart);
-
-		QueryPerformanceCounter(&li);
-		CounterStart = li.QuadPart;
+		CounterStart = std::chrono::steady_clock::now();
 	}
 
-	double GetCounter()
+	//! seconds since StartCounter()
+	double GetCounter() const
 	{
-		LARGE_INTEGER li;
-		QueryPerformanceCounter(&li);
-		return double(li.QuadPart - CounterStart) / PCFreq;
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - CounterStart).count();
 	}
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -2,6 +2,7 @@
 #define RAYTR_CORE_INTENSITY_ARRAY_H
 #include "vec3.h"
 #include <cstring> //memset
+#include <fstream>
 namespace Raytr_Core
 {
 	//! an array to hold color intensities with float precision for all 3 channels
@@ -41,6 +42,26 @@ namespace Raytr_Core
 		}
 
 
+		//! writes the values multiplied by scale as a little endian pfm (portable float map) image
+		bool savePfm(const char* fileName, float scale = 1.0f) const
+		{
+			std::ofstream out(fileName, std::ios::binary);
+			if (!out)
+				return false;
+			//a negative scale marks little endian data
+			out << "PF\n" << width << " " << height << "\n-1.0\n";
+			//the rows are stored bottom to top
+			for (int j = height - 1; j >= 0; --j)
+			{
+				for (int i = 0; i < width; ++i)
+				{
+					float rgb[3] = { (*this)(i, j).x*scale, (*this)(i, j).y*scale, (*this)(i, j).z*scale };
+					out.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+				}
+			}
+			return bool(out);
+		}
+
 		~intensity_array()
 		{
 			delete[] arr;
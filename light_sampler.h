@@ -0,0 +1,230 @@
+#ifndef RAYTR_CORE_LIGHT_SAMPLER_H
+#define RAYTR_CORE_LIGHT_SAMPLER_H
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "object.h"
+#include "material.h"
+#include "alias_table.h"
+#include "util.h"
+
+namespace Raytr_Core
+{
+	//! the light picked for a shading point and the probability it was picked with
+	struct light_choice
+	{
+		const object* light;
+		float probability;
+	};
+
+	//! Picks one of the scene's emitters per light sample, so the cost of a sample doesn't grow with the number of lights
+	/*!
+		The emitters are collected once, when the scene is built, and weighted by an estimate of their emitted power.
+		With a few lights (or any unbounded one) they're drawn from an alias table, in O(1) per sample.
+		With more than cBVH_MIN_LIGHTS bounded lights a light bvh is built instead and the shading point descends it,
+		choosing each child by its power over its squared distance - the near lights get the samples, and a subtree that's
+		entirely below the shading point's tangent plane is never picked since it can't contribute.
+	*/
+	class light_sampler
+	{
+	public:
+		static const size_t cBVH_MIN_LIGHTS = 8;
+
+	private:
+		//! a node of the light bvh, the left child follows its parent, leaves hold a single light
+		struct node
+		{
+			BasicMath::vec3 min, max;
+			float power;
+			uint32_t right;		//!< index of the right child
+			int32_t light;		//!< index of the leaf's light, -1 for inner nodes
+		};
+
+		std::vector<const object*> lights;
+		std::vector<float> powers;
+		alias_table powerTable;
+		std::vector<node> nodes;				//!< the light bvh, empty if the alias table is used
+		std::vector<BasicMath::vec3> mins, maxs;	//!< the bounds of the lights, only used while building
+
+		//! pi times the area times the luminance of the radiance in the middle of the emitter's texture
+		static float estimatePower(const object* light)
+		{
+			intersection_info info;
+			info.position = light->center;
+			info.uv = BasicMath::vec2(0.5f, 0.5f);
+			info.pObject = light;
+			BasicMath::vec3 radiance = light->pMaterial->emitted(ray(light->center, BasicMath::vec3(0, 1, 0)), info);
+			float luminance = 0.2126f*radiance.x + 0.7152f*radiance.y + 0.0722f*radiance.z;
+			float areaPdf = light->pdf_value_area();
+			float area = areaPdf > 0.0f ? 1.0f / areaPdf : 1.0f;
+			return std::max(luminance, 0.0f)*area*float(M_PI);
+		}
+
+		//! builds the subtree over order[first, last), returns its index
+		uint32_t buildNode(std::vector<uint32_t>& order, size_t first, size_t last)
+		{
+			uint32_t index = uint32_t(nodes.size());
+			nodes.push_back(node());
+			BasicMath::vec3 min(BasicMath::cINFINITY), max(-BasicMath::cINFINITY);
+			BasicMath::vec3 centroidMin(BasicMath::cINFINITY), centroidMax(-BasicMath::cINFINITY);
+			float power = 0.0f;
+			for (size_t i = first; i < last; ++i)
+			{
+				min = BasicMath::min(min, mins[order[i]]);
+				max = BasicMath::max(max, maxs[order[i]]);
+				BasicMath::vec3 centroid = (mins[order[i]] + maxs[order[i]])*0.5f;
+				centroidMin = BasicMath::min(centroidMin, centroid);
+				centroidMax = BasicMath::max(centroidMax, centroid);
+				power += powers[order[i]];
+			}
+			nodes[index].min = min;
+			nodes[index].max = max;
+			nodes[index].power = power;
+			nodes[index].right = 0;
+			nodes[index].light = -1;
+			if (last - first == 1)
+			{
+				nodes[index].light = int32_t(order[first]);
+				return index;
+			}
+
+			//median split along the widest axis of the centroids
+			BasicMath::vec3 extent = centroidMax - centroidMin;
+			int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+			size_t middle = first + (last - first) / 2;
+			std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + last, [&](uint32_t a, uint32_t b)
+			{
+				return mins[a][axis] + maxs[a][axis] < mins[b][axis] + maxs[b][axis];
+			});
+			buildNode(order, first, middle);
+			uint32_t right = buildNode(order, middle, last);
+			nodes[index].right = right;
+			return index;
+		}
+
+		//! how much a node's lights are expected to contribute to a point - 0 if they're all below its tangent plane
+		static float importance(const node& n, const BasicMath::vec3& position, const BasicMath::vec3& normal)
+		{
+			BasicMath::vec3 center = (n.min + n.max)*0.5f;
+			BasicMath::vec3 half = (n.max - n.min)*0.5f;
+			BasicMath::vec3 toCenter = center - position;
+			if (BasicMath::dotProduct(toCenter, normal) + BasicMath::dotProduct(half, BasicMath::fabs(normal)) <= 0.0f)
+				return 0.0f;
+			//inside the box the distance tells nothing, use its size instead
+			return n.power / std::max(toCenter.squared_length(), half.squared_length());
+		}
+
+	public:
+		//! collects the emitters among objects and builds the alias table or the light bvh
+		void build(const std::vector<object*>& objects)
+		{
+			lights.clear();
+			powers.clear();
+			nodes.clear();
+			mins.clear();
+			maxs.clear();
+			bool bounded = true;
+			bounding_volume_aabb box;
+			for (object* iter : objects)
+			{
+				if (!iter->pMaterial || !iter->pMaterial->emits)
+					continue;
+				lights.push_back(iter);
+				powers.push_back(estimatePower(iter));
+				if (iter->bounds(box))
+				{
+					mins.push_back(box.min());
+					maxs.push_back(box.max());
+				}
+				else
+				{
+					bounded = false;
+				}
+			}
+			//all black lights are picked uniformly
+			powerTable.build(powers.data(), powers.size());
+			if (bounded && lights.size() > cBVH_MIN_LIGHTS)
+			{
+				std::vector<uint32_t> order(lights.size());
+				for (size_t i = 0; i < order.size(); ++i)
+					order[i] = uint32_t(i);
+				nodes.reserve(2 * lights.size() - 1);
+				buildNode(order, 0, order.size());
+			}
+			mins.clear();
+			maxs.clear();
+		}
+
+		//! picks a light for the point at position with the given normal, returns false if no light can contribute
+		/*!
+			Uses a single random number, none if there's only one light.
+		*/
+		bool sample(const BasicMath::vec3& position, const BasicMath::vec3& normal, light_choice& choice) const
+		{
+			if (lights.empty())
+				return false;
+			if (lights.size() == 1)
+			{
+				choice.light = lights[0];
+				choice.probability = 1.0f;
+				return true;
+			}
+			if (nodes.empty())
+			{
+				size_t picked = powerTable.sample(BasicMath::randomBits());
+				choice.light = lights[picked];
+				choice.probability = powerTable.probability(picked);
+				return true;
+			}
+
+			//descend the light bvh, reusing the random number at every level
+			float u = BasicMath::randomFloat();
+			float probability = 1.0f;
+			uint32_t index = 0;
+			while (nodes[index].light < 0)
+			{
+				const node& left = nodes[index + 1];
+				const node& right = nodes[nodes[index].right];
+				float leftImportance = importance(left, position, normal);
+				float rightImportance = importance(right, position, normal);
+				float sum = leftImportance + rightImportance;
+				if (!(sum > 0.0f))
+					return false;
+				float pLeft = leftImportance / sum;
+				if (u < pLeft)
+				{
+					u = std::min(u / pLeft, 1.0f - BasicMath::cEPSILON);
+					probability *= pLeft;
+					index = index + 1;
+				}
+				else
+				{
+					u = std::min((u - pLeft) / (1.0f - pLeft), 1.0f - BasicMath::cEPSILON);
+					probability *= 1.0f - pLeft;
+					index = nodes[index].right;
+				}
+			}
+			choice.light = lights[nodes[index].light];
+			choice.probability = probability;
+			return probability > 0.0f;
+		}
+
+		size_t size() const
+		{
+			return lights.size();
+		}
+
+		bool empty() const
+		{
+			return lights.empty();
+		}
+
+		//! true if the lights are picked with the light bvh rather than the alias table
+		bool usesBvh() const
+		{
+			return !nodes.empty();
+		}
+	};
+}
+
+#endif
@@ -1,13 +1,14 @@
-//TODO:
-// add SIMD math library
-//fix sort in octree
-
 #include "tigr.h"
 
+//the window is drawn with d3d9 on windows, elsewhere tigr has no window and only --headless renders
+#ifdef _WIN32
 #pragma comment(lib,"d3d9.lib")
+#endif
 
 #include "threads_distribution.h"
+#include "worker_pool.h"
 #include "intensity_array.h"
+#include "progressive_framebuffer.h"
 #include "camera.h"
 #include "scene.h"
 #include "sphere.h"
@@ -18,11 +19,21 @@
 #include "octree.h"
 #include "triangle_mesh_data.h"
 #include "high_precision_timer.h"
+#include "render_stats.h"
+#include "ray_sorting.h"
 #include "scene_loader.h"
+#include "benchmark.h"
 
 using namespace BasicMath;
 using namespace Raytr_Core;
 
+//! shadow rays stop this much (relative to the distance) before the sampled point on the light, so the light doesn't occlude itself
+const float cSHADOW_RAY_EPSILON = 0.0001f;
+//! a light sample of a point on the light (a mesh) counts if the shadow ray hits the light this close to it, relative to the distance
+const float cLIGHT_POINT_TOLERANCE = 0.001f;
+//! the most samples per pixel a time budget can buy when options.maxSamples isn't set
+const int cMAX_BUDGET_SAMPLES = 1 << 16;
+
 
 class BackgroundColor
 {
@@ -68,23 +79,57 @@ struct RussianRoulette
 struct RenderOptions
 {
 	RenderOptions() : x(0), y(0), width(100), height(100), 
-		numThreads(1), dxCoef(1), dyCoef(1), samples(1), shadowRaysCount(1), scatteredRaysPow(0), bounces(5), backgroundColor(nullptr)
+		numThreads(1), dxCoef(1), dyCoef(1), samples(1), shadowRaysCount(1), scatteredRaysPow(0), bounces(5), backgroundColor(nullptr), headless(false), wavefront(false), sortRays(false), packetSize(0),
+		noiseThreshold(0), maxSamples(0), timeBudget(0)
 	{}
 
 	int x, y;							//!< upper left corner of the rectangle
 	int width, height;					//!< size of the rectangle
 	int numThreads;						//!< number of threads to run
 	float dxCoef, dyCoef;				//!< coefficients by which to multiply the threads dsitribution rectangles
-	int samples;						//!< numbers of initial samples per pixel
-	int shadowRaysCount;				//!< number of shadow rays per iteration
+	int samples;						//!< numbers of initial samples per pixel, all of them without adaptive sampling
+	int shadowRaysCount;				//!< number of light samples per path vertex, each one picks a single light (see light_sampler)
 	int scatteredRaysPow;				//!< a number k describing how many rays will be generated for indirect illumination: 2^(2*k)
 	int bounces;						//!< maximum number of bounces allowe
 	BackgroundColor* backgroundColor;	//!< background color
 	RussianRoulette rrOptions;			//!< russian roulette parameters
+	bool headless;						//!< no window - render() doesn't present the image or check for escape
+	bool wavefront;						//!< trace the tiles with render_tile_wavefront instead of castRay per pixel
+	bool sortRays;						//!< the wavefront integrator sorts the bounce rays before tracing them (see ray_sorting)
+	int packetSize;						//!< render_tile traces the camera rays of packetSize x packetSize pixels as a ray_packet, 0 or 1 - one by one
+	float noiseThreshold;				//!< adaptive sampling stops a pixel once its relative error is below this (progressive_framebuffer::relativeError), 0 - off
+	int maxSamples;						//!< the most samples per pixel with adaptive sampling or a time budget, up to samples - off
+	double timeBudget;					//!< seconds to render for, passes are added while they're predicted to fit - samples only counts for adaptive sampling, 0 - off
 
 };
 
-BasicMath::vec3 castRay(Raytr_Core::ray r, const Raytr_Core::scene& scn, const RenderOptions& options, vec3& directIllumination)
+//! draws a light sample for the shading point of info: a light picked by the scene's light_sampler and a direction towards it
+/*!
+	Returns false if the sample can't contribute - no light can, the direction is below the surface or the shadow ray doesn't
+	reach the sampled point of the light. Otherwise lightRay is the shadow ray, lightInfo its hit on the light and pdf the density
+	of its direction times the probability of picking the light. The occlusion by the rest of the scene isn't tested.
+*/
+bool sampleLight(const Raytr_Core::scene& scn, const intersection_info& info, light_choice& light, ray& lightRay, intersection_info& lightInfo, float& pdf, float& cosLDN)
+{
+	if (!scn.lights().sample(info.position, info.normal, light))
+		return false;
+	vec3 direction;
+	float distance;
+	pdf = light.light->sampleDirection(info.position, direction, distance)*light.probability;
+	//find out the cos between the direction and the normal at the intersection point, a sample below the surface contributes nothing
+	cosLDN = dotProduct(info.normal, direction);
+	if (cosLDN <= 0 || !(pdf > 0))
+		return false;
+	lightRay = ray(info.position + info.normal*cEPSILON, direction);
+	RAYTR_CORE_COUNT(shadowRays, 1);
+	//if the ray misses the emitter, or another part of it is in front of the sampled point, the sample contributes nothing
+	if (!light.light->intersect(lightRay, cEPSILON, cINFINITY, lightInfo))
+		return false;
+	return distance == 0.0f || std::fabs(lightInfo.t - distance) <= distance*cLIGHT_POINT_TOLERANCE;
+}
+
+//! if primaryHit isn't null it's the result of intersecting r with the scene (traced in a packet), castRay continues from it
+BasicMath::vec3 castRay(Raytr_Core::ray r, const Raytr_Core::scene& scn, const RenderOptions& options, vec3& directIllumination, const intersection_info* primaryHit = nullptr)
 {
 	intersection_info info;
 	scattering_info sinfo;
@@ -98,7 +143,18 @@ BasicMath::vec3 castRay(Raytr_Core::ray r, const Raytr_Core::scene& scn, const R
 	//////////////////////////////////////////////////////////////////////////////////////////////////////////
 	//0) Does the ray hit anything?
 	//////////////////////////////////////////////////////////////////////////////////////////////////////////
-	if (!scn.intersect(r, cEPSILON, cINFINITY, info))
+	bool hit;
+	if (primaryHit)
+	{
+		info = *primaryHit;
+		hit = info.intersect;
+	}
+	else
+	{
+		RAYTR_CORE_COUNT(cameraRays, 1);
+		hit = scn.intersect(r, cEPSILON, cINFINITY, info);
+	}
+	if (!hit)
 	{
 		//the ray does not hit the scene - return the background color
 		Le += options.backgroundColor->value(r);
@@ -120,47 +176,25 @@ BasicMath::vec3 castRay(Raytr_Core::ray r, const Raytr_Core::scene& scn, const R
 	
 	
 
-	//for each object in the scene check whether it's an emitter
-	int shadowRaysCount1 = 0;
-	for (object* iter : scn.objects)
+	//a fixed number of light samples, each one picks a single light - the cost doesn't depend on the number of lights
+	int shadowRaysCount1 = scn.lights().empty() ? 0 : options.shadowRaysCount;
+	for (int j = 0; j < shadowRaysCount1; ++j)
 	{
-
-		//if the object emits - sample it
-		if (iter->pMaterial->emits)
+		light_choice light1;
+		ray lightSampleRay1(info.position, info.normal);
+		//the sampled point on the emitter
+		intersection_info lightInfo1;
+		float shadowRayPdf1, cosLDN1;
+
+		//if the sample can't reach the emitter or anything blocks it before reaching the emitter, continue on to the next shadow ray
+		if (!sampleLight(scn, info, light1, lightSampleRay1, lightInfo1, shadowRayPdf1, cosLDN1) ||
+			scn.occluded(lightSampleRay1, cEPSILON, lightInfo1.t*(1 - cSHADOW_RAY_EPSILON)))
 		{
-			//cast n shadow rays
-			for (int j = 0; j < options.shadowRaysCount; ++j)
-			{
-				//generate a direction in the cosine lobe subtended by the sphere
-				vec3 shadowRayDir1 = iter->random(info.position);
-				//calulcate the pdf
-				float shadowRayPdf1 = iter->pdf_value(info.position, shadowRayDir1);
-				//transform the shadowray's direction to the coordinates we need
-				shadowRayDir1 = createCoordinateSystem(normalize(iter->center - info.position))*shadowRayDir1;
-				//the ray
-				ray lightSampleRay1(info.position + info.normal*cEPSILON, shadowRayDir1);
-				//find out the cos between this ray and the normal at the intersection point
-				float cosLDN1 = dotProduct(info.normal, lightSampleRay1.direction);
-				//if cos is 0 or negative continue to the next shadow ray
-				if (cosLDN1 <= 0)
-					continue;
-				//if not, check whether it intersects anything before the light
-				intersection_info tempInfo1;
-				scn.intersect(lightSampleRay1, cEPSILON, cINFINITY, tempInfo1);
-
-				//increment the counter for the shadow rays
-				++shadowRaysCount1;
-
-				//if it does intersect an object that's not the emitter before reaching it, continue on to the next shadow ray
-				if (tempInfo1.pObject != iter)
-				{
-					continue;
-				}
-				else //if it does not - calculate the direct illumination
-				{
-					Ld += cosLDN1*tempInfo1.pObject->pMaterial->emitted(lightSampleRay1, tempInfo1)*info.pObject->pMaterial->brdf(r.direction, lightSampleRay1.direction, info) / shadowRayPdf1;
-				}
-			}
+			continue;
+		}
+		else //if it does not - calculate the direct illumination
+		{
+			Ld += cosLDN1*light1.light->pMaterial->emitted(lightSampleRay1, lightInfo1)*info.pObject->pMaterial->brdf(r.direction, lightSampleRay1.direction, info) / shadowRayPdf1;
 		}
 	}
 
@@ -191,49 +225,27 @@ BasicMath::vec3 castRay(Raytr_Core::ray r, const Raytr_Core::scene& scn, const R
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
-		//for each object in the scene check whether it's an emitter
+		//a fixed number of light samples, each one picks a single light
 		vec3 directIlluminationColor(0);
-		int shadowRaysCount = 0;
-		for (object* iter : scn.objects)
+		int shadowRaysCount = scn.lights().empty() ? 0 : options.shadowRaysCount;
+		for (int j = 0; j < shadowRaysCount; ++j)
 		{
-
-			//if the object emits - sample it
-			if (iter->pMaterial->emits)
+			light_choice light;
+			ray lightSampleRay(info.position, info.normal);
+			//the sampled point on the emitter
+			intersection_info lightInfo;
+			float shadowRayPdf, cosLDN;
+
+			//if the sample can't reach the emitter or anything blocks it before reaching the emitter, continue on to the next shadow ray
+			if (!sampleLight(scn, info, light, lightSampleRay, lightInfo, shadowRayPdf, cosLDN) ||
+				scn.occluded(lightSampleRay, cEPSILON, lightInfo.t*(1 - cSHADOW_RAY_EPSILON)))
 			{
-				//cast n shadow rays
-				for (int j = 0; j < options.shadowRaysCount; ++j)
-				{
-					//generate a direction in the cosine lobe subtended by the sphere
-					vec3 shadowRayDir = iter->random(info.position);
-					//calulcate the pdf
-					float shadowRayPdf = iter->pdf_value(info.position, shadowRayDir);
-					//transform the shadowray's direction to the coordinates we need
-					shadowRayDir = createCoordinateSystem(normalize(iter->center - info.position))*shadowRayDir;
-					//the ray
-					ray lightSampleRay(info.position + info.normal*cEPSILON, shadowRayDir);
-					//find out the cos between this ray and the normal at the intersection point
-					float cosLDN = dotProduct(info.normal, lightSampleRay.direction);
-					//if cos is 0 or negative continue to the next shadow ray
-					if (cosLDN <= 0)
-						continue;
-					//if not, check whether it intersects anything before the light
-					intersection_info tempInfo;
-					scn.intersect(lightSampleRay, cEPSILON, cINFINITY, tempInfo);
-
-					//increment the counter for the shadow rays
-					++shadowRaysCount;
-
-					//if it does intersect an object that's not the emitter before reaching it, continue on to the next shadow ray
-					if (tempInfo.pObject != iter)
-					{
-						continue;
-					}
-					else //if it does not - calculate the direct illumination
-					{
-						directIlluminationColor += tempInfo.pObject->pMaterial->emitted(lightSampleRay, tempInfo)*info.pObject->pMaterial->brdf(r.direction, lightSampleRay.direction, info)*cosLDN /
-							shadowRayPdf;
-					}
-				}
+				continue;
+			}
+			else //if it does not - calculate the direct illumination
+			{
+				directIlluminationColor += light.light->pMaterial->emitted(lightSampleRay, lightInfo)*info.pObject->pMaterial->brdf(r.direction, lightSampleRay.direction, info)*cosLDN /
+					shadowRayPdf;
 			}
 		}
 
@@ -244,7 +256,7 @@ BasicMath::vec3 castRay(Raytr_Core::ray r, const Raytr_Core::scene& scn, const R
 		//Russian roulette - randomly terminate a path with a probability inversely proportional to the intensity
 		float p = max(intensity);
 		p = std::max(options.rrOptions.minP, std::min(options.rrOptions.maxP, options.rrOptions.mulFactor*p));
-		if (p < uniform_distribution(generator))
+		if (p < randomFloat())
 		{
 			return color;
 		}
@@ -256,8 +268,8 @@ BasicMath::vec3 castRay(Raytr_Core::ray r, const Raytr_Core::scene& scn, const R
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 		//generate uniformly distributed random numbers in [0,1]
-		r1 = uniform_distribution(generator);
-		r2 = uniform_distribution(generator);
+		r1 = randomFloat();
+		r2 = randomFloat();
 
 		//generate a direction with a cosine weighted distribution:
 		BasicMath::vec3 direction = cosineWeightedHemisphereSample(r1, r2);
@@ -278,6 +290,7 @@ BasicMath::vec3 castRay(Raytr_Core::ray r, const Raytr_Core::scene& scn, const R
 		//accumulate the intensity
 		intensity *= info.pObject->pMaterial->brdf(r.direction, direction, info)*cosDN / pdf_value;
 
+		RAYTR_CORE_COUNT(bounceRays, 1);
 		if (!scn.intersect(r, cEPSILON, cINFINITY, info)) //the ray does not hit the scene
 		{
 			color += options.backgroundColor->value(r)*intensity;
@@ -290,125 +303,553 @@ BasicMath::vec3 castRay(Raytr_Core::ray r, const Raytr_Core::scene& scn, const R
 	return color;
 }
 
-void copyArrayToBmp(const intensity_array& src, Tigr* dst, const ThreadsDistribution::rectangle& rect, int numSamples)
+//! the state of a path traced by the wavefront integrator - the locals castRay keeps between its steps
+struct path_state
+{
+	path_state(const ray& r, int x, int y, const BasicMath::pcg32& rng)
+		: r(r), intensity(1), color(0), Le(0), rng(rng), x(x), y(y), bounce(-1), hit(false), alive(true),
+		directSum(0), indirectSum(0), indirectIntensity(0), directCount(-1), indirectCount(0)
+	{}
+
+	ray r;							//!< the ray to extend, then the ray that reached info
+	intersection_info info;
+	vec3 intensity;
+	vec3 color;						//!< indirect illumination gathered so far
+	vec3 Le;						//!< emitted and direct illumination at the first hit
+	BasicMath::pcg32 rng;			//!< the path's own generator - the stages interleave the paths
+	int x, y;
+	int bounce;						//!< the next iteration of castRay's bounce loop, -1 until the camera ray is extended
+	bool hit;						//!< result of the last extension
+	bool alive;						//!< a terminated path is still written out after its shadow rays
+
+	//light samples of the current vertex waiting for the shadow stage
+	vec3 directSum, indirectSum;
+	vec3 indirectIntensity;			//!< intensity when the indirect light samples were taken
+	int directCount;				//!< -1 if there are no direct samples pending
+	int indirectCount;
+};
+
+//! a shadow ray waiting for the occlusion stage, its contribution goes to the path if nothing blocks it
+struct shadow_query
+{
+	shadow_query(const ray& r, float tmax, const vec3& contribution, uint32_t path, bool direct)
+		: r(r), tmax(tmax), contribution(contribution), path(path), direct(direct), blocked(false)
+	{}
+
+	ray r;
+	float tmax;
+	vec3 contribution;
+	uint32_t path;
+	bool direct;					//!< the direct illumination of the first hit or the indirect estimate of a bounce
+	bool blocked;
+};
+
+//! the queues of a worker, kept between the tiles
+struct wavefront_queues
+{
+	std::vector<path_state> paths;
+	std::vector<uint32_t> active;	//!< the paths still being traced, compacted after every bounce
+	std::vector<shadow_query> shadows;
+	std::vector<uint64_t> sortKeys;
+};
+
+//! samples the lights from the path's vertex like castRay does and queues the shadow rays, returns the number of samples drawn
+int queueLightSamples(const path_state& path, uint32_t pathIndex, bool direct, const Raytr_Core::scene& scn, const RenderOptions& options,
+	std::vector<shadow_query>& shadows)
+{
+	const intersection_info& info = path.info;
+	int shadowRaysCount = scn.lights().empty() ? 0 : options.shadowRaysCount;
+	for (int j = 0; j < shadowRaysCount; ++j)
+	{
+		light_choice light;
+		ray lightSampleRay(info.position, info.normal);
+		intersection_info lightInfo;
+		float shadowRayPdf, cosLDN;
+		//a sample missing the emitter contributes nothing, only the ones hitting it need the occlusion test
+		if (!sampleLight(scn, info, light, lightSampleRay, lightInfo, shadowRayPdf, cosLDN))
+			continue;
+		//the same expressions as in castRay, so the results are identical
+		vec3 contribution = direct ?
+			cosLDN*light.light->pMaterial->emitted(lightSampleRay, lightInfo)*info.pObject->pMaterial->brdf(path.r.direction, lightSampleRay.direction, info) / shadowRayPdf :
+			light.light->pMaterial->emitted(lightSampleRay, lightInfo)*info.pObject->pMaterial->brdf(path.r.direction, lightSampleRay.direction, info)*cosLDN / shadowRayPdf;
+		shadows.push_back(shadow_query(lightSampleRay, lightInfo.t*(1 - cSHADOW_RAY_EPSILON), contribution, pathIndex, direct));
+	}
+	return shadowRaysCount;
+}
+
+//! one iteration of castRay's bounce loop up to the next extension: light samples, russian roulette and the scattered ray
+void shadeBounce(path_state& path, uint32_t pathIndex, const Raytr_Core::scene& scn, const RenderOptions& options, std::vector<shadow_query>& shadows)
+{
+	scattering_info sinfo;
+	if (path.bounce >= options.bounces || !path.info.pObject->pMaterial->scatter(path.r, path.info, sinfo))
+	{
+		path.alive = false;
+		return;
+	}
+
+	path.indirectIntensity = path.intensity;
+	path.indirectCount = queueLightSamples(path, pathIndex, false, scn, options, shadows);
+
+	//Russian roulette
+	float p = max(path.intensity);
+	p = std::max(options.rrOptions.minP, std::min(options.rrOptions.maxP, options.rrOptions.mulFactor*p));
+	if (p < randomFloat())
+	{
+		path.alive = false;
+		return;
+	}
+	path.intensity *= 1 / p;
+
+	float r1 = randomFloat();
+	float r2 = randomFloat();
+	BasicMath::vec3 direction = cosineWeightedHemisphereSample(r1, r2);
+	float pdf_value = BasicMath::cosineWeightedHemispherePdf(direction);
+	direction = createCoordinateSystem(path.info.normal)*direction;
+	float cosDN = dotProduct(path.info.normal, direction);
+	if (cosDN <= 0)
+	{
+		path.alive = false;
+		return;
+	}
+	path.r = ray(path.info.position + path.info.normal*cEPSILON, direction);
+	path.intensity *= path.info.pObject->pMaterial->brdf(path.r.direction, direction, path.info)*cosDN / pdf_value;
+	++path.bounce;
+}
+
+//! renders one sample per pixel of the rectangle with the wavefront integrator
+/*!
+	Computes the same estimate as castRay, but instead of following one path at a time it keeps the paths of the whole tile
+	in a queue and runs each step over all of them: extend (closest hits), shade (light samples, russian roulette, the next rays),
+	shadow (any hits) and compact (the finished paths are written out). With options.sortRays the bounce rays are sorted before
+	they're extended. Every path has its own generator seeded like render_tile's,
+	so the image is identical to render_tile's.
+*/
+void render_tile_wavefront(intensity_array& directIllumination, progressive_framebuffer& framebuffer, const Raytr_Core::camera& cam, const Raytr_Core::scene& scn, const ThreadsDistribution::rectangle& rect, const RenderOptions& options, int sample)
 {
-	int i;
-	vec3 col;
+	static thread_local wavefront_queues queues;
+	std::vector<path_state>& paths = queues.paths;
+	std::vector<uint32_t>& active = queues.active;
+	std::vector<shadow_query>& shadows = queues.shadows;
+
+	//generate the camera rays
+	paths.clear();
+	active.clear();
 	for (int y = rect.pos.y; y<rect.size.y + rect.pos.y; ++y)
 	{
 		for (int x = rect.pos.x; x < rect.size.x + rect.pos.x; ++x)
 		{
-			//write into buffer
-			i = y*dst->w + x;
-			//divide by the number of samples, gamma correct and clamp values in the 0-1 range
-			col = BasicMath::clamp(pow(src(x, y) / numSamples, float(0.4545)), BasicMath::vec3::zero, BasicMath::vec3::one);
-			dst->pix[i].r = 255 * col.x;
-			dst->pix[i].g = 255 * col.y;
-			dst->pix[i].b = 255 * col.z;
+			if (framebuffer.isConverged(x, y))
+				continue;
+			uint64_t pixel = uint64_t(y)*options.width + x;
+			BasicMath::generator.seed(BasicMath::pcg32::hash(BasicMath::pcg32::hash(pixel) + sample), pixel);
+			float ndcY = 2 * float(y + BasicMath::randomFloat()) / (1 - options.height) + 1;
+			float ndcX = 2 * float(x + BasicMath::randomFloat()) / (options.width - 1) - 1;
+			active.push_back(uint32_t(paths.size()));
+			paths.push_back(path_state(cam.getRay(ndcX, ndcY), x, y, BasicMath::generator));
+		}
+	}
+
+	bounding_volume_aabb sceneBounds = scn.boundingBox();
+	for (bool firstPass = true; !active.empty(); firstPass = false)
+	{
+		//sort the bounce rays by direction and origin, the camera rays of a tile are coherent already
+		if (options.sortRays && !firstPass)
+			ray_sorting::sort(active, sceneBounds, [&](uint32_t i) -> const ray& { return paths[i].r; }, queues.sortKeys);
+
+		//extend
+		for (uint32_t i : active)
+		{
+			path_state& path = paths[i];
+			if (path.bounce < 0)
+				RAYTR_CORE_COUNT(cameraRays, 1);
+			else
+				RAYTR_CORE_COUNT(bounceRays, 1);
+			path.hit = scn.intersect(path.r, cEPSILON, cINFINITY, path.info);
+		}
+
+		//shade
+		shadows.clear();
+		for (uint32_t i : active)
+		{
+			path_state& path = paths[i];
+			//the lights and the materials draw from the thread's generator
+			BasicMath::generator = path.rng;
+			if (path.bounce < 0)
+			{
+				//the first hit's emission and direct illumination go to directIllumination
+				if (!path.hit)
+				{
+					path.Le += options.backgroundColor->value(path.r);
+					directIllumination(path.x, path.y) += path.Le;
+					path.alive = false;
+				}
+				else
+				{
+					scattering_info sinfo;
+					path.Le += path.info.pObject->pMaterial->emitted(path.r, path.info);
+					if (!path.info.pObject->pMaterial->scatter(path.r, path.info, sinfo))
+					{
+						directIllumination(path.x, path.y) += path.Le;
+						path.alive = false;
+					}
+					else
+					{
+						path.directCount = queueLightSamples(path, i, true, scn, options, shadows);
+						path.bounce = 0;
+					}
+				}
+			}
+			else if (!path.hit)
+			{
+				path.color += options.backgroundColor->value(path.r)*path.intensity;
+				path.alive = false;
+			}
+			if (path.alive)
+				shadeBounce(path, i, scn, options, shadows);
+			path.rng = BasicMath::generator;
+		}
+
+		//shadow
+		for (shadow_query& query : shadows)
+			query.blocked = scn.occluded(query.r, cEPSILON, query.tmax);
+		//in the order the samples were taken, so the sums are the same as castRay's
+		for (const shadow_query& query : shadows)
+		{
+			if (!query.blocked)
+			{
+				if (query.direct)
+					paths[query.path].directSum += query.contribution;
+				else
+					paths[query.path].indirectSum += query.contribution;
+			}
+		}
+
+		//add up the light samples and compact
+		size_t aliveCount = 0;
+		for (uint32_t i : active)
+		{
+			path_state& path = paths[i];
+			if (path.directCount >= 0)
+			{
+				if (path.directCount > 0)
+					path.directSum /= float(path.directCount);
+				path.Le += path.directSum;
+				directIllumination(path.x, path.y) += path.Le;
+				path.directCount = -1;
+			}
+			if (path.indirectCount > 0)
+				path.color += (path.indirectSum*path.indirectIntensity / float(path.indirectCount));
+			path.indirectSum = vec3(0);
+			path.indirectCount = 0;
+
+			if (path.alive)
+			{
+				active[aliveCount++] = i;
+			}
+			else
+			{
+				framebuffer.addSample(path.x, path.y, path.Le + path.color);
+			}
 		}
+		active.resize(aliveCount);
 	}
 }
 
-void render_thread(intensity_array& directIllumination, intensity_array& indirectIllumiantion, intensity_array& accumulatedIntensity, const Raytr_Core::camera& cam, const Raytr_Core::scene& scn, const ThreadsDistribution::rectangle& rect, const RenderOptions& options)
+//! renders one sample per pixel of the rectangle with the camera rays of options.packetSize x options.packetSize blocks traced as packets
+/*!
+	The jitter of every pixel is drawn first, then the whole block's camera rays are intersected at once and castRay continues
+	each path from its hit with the generator state it had after the jitter - the image is the same as render_tile's.
+*/
+void render_tile_packets(intensity_array& directIllumination, progressive_framebuffer& framebuffer, const Raytr_Core::camera& cam, const Raytr_Core::scene& scn, const ThreadsDistribution::rectangle& rect, const RenderOptions& options, int sample)
 {
+	const int size = std::min(options.packetSize, 8);
+	ray_packet packet;
+	intersection_info infos[ray_packet::cMAX_RAYS];
+	BasicMath::pcg32 generators[ray_packet::cMAX_RAYS];
+	int pixelX[ray_packet::cMAX_RAYS], pixelY[ray_packet::cMAX_RAYS];
+	for (int by = rect.pos.y; by < rect.size.y + rect.pos.y; by += size)
+	{
+		for (int bx = rect.pos.x; bx < rect.size.x + rect.pos.x; bx += size)
+		{
+			packet.reset(cEPSILON);
+			for (int y = by; y < std::min(by + size, rect.size.y + rect.pos.y); ++y)
+			{
+				for (int x = bx; x < std::min(bx + size, rect.size.x + rect.pos.x); ++x)
+				{
+					if (framebuffer.isConverged(x, y))
+						continue;
+					uint64_t pixel = uint64_t(y)*options.width + x;
+					BasicMath::generator.seed(BasicMath::pcg32::hash(BasicMath::pcg32::hash(pixel) + sample), pixel);
+					float ndcY = 2 * float(y + BasicMath::randomFloat()) / (1 - options.height) + 1;
+					float ndcX = 2 * float(x + BasicMath::randomFloat()) / (options.width - 1) - 1;
+					int i = packet.add(cam.getRay(ndcX, ndcY), cINFINITY);
+					generators[i] = BasicMath::generator;
+					pixelX[i] = x;
+					pixelY[i] = y;
+				}
+			}
+			if (packet.count == 0)
+				continue;
+			packet.finalize();
+			scn.intersectPacket(packet, infos);
+			RAYTR_CORE_COUNT(cameraRays, packet.count);
+
+			for (int i = 0; i < packet.count; ++i)
+			{
+				int x = pixelX[i], y = pixelY[i];
+				BasicMath::generator = generators[i];
+				vec3 direct(0);
+				vec3 indirect = castRay(packet.getRay(i), scn, options, direct, &infos[i]);
+				directIllumination(x, y) += direct;
+				framebuffer.addSample(x, y, direct + indirect);
+			}
+		}
+	}
+}
+
+//! renders one sample per pixel of the rectangle, except for the pixels adaptive sampling has stopped
+void render_tile(intensity_array& directIllumination, progressive_framebuffer& framebuffer, const Raytr_Core::camera& cam, const Raytr_Core::scene& scn, const ThreadsDistribution::rectangle& rect, const RenderOptions& options, int sample)
+{
+	if (options.packetSize > 1)
+	{
+		render_tile_packets(directIllumination, framebuffer, cam, scn, rect, options, sample);
+		return;
+	}
 	ThreadsDistribution::point pos;
 	float ndcX, ndcY;
 	for (int y = rect.pos.y; y<rect.size.y + rect.pos.y; ++y)
 	{
 		for (int x = rect.pos.x; x < rect.size.x + rect.pos.x; ++x)
 		{
+			//adaptive sampling has stopped the pixel
+			if (framebuffer.isConverged(x, y))
+				continue;
+			//seed the thread's generator from the pixel and the sample - the image doesn't depend on which thread renders what
+			uint64_t pixel = uint64_t(y)*options.width + x;
+			BasicMath::generator.seed(BasicMath::pcg32::hash(BasicMath::pcg32::hash(pixel) + sample), pixel);
 			//map y from [0,height-1] to [1,-1]
-			ndcY = 2 * float(y + BasicMath::uniform_distribution(BasicMath::generator)) / (1 - options.height) + 1;
+			ndcY = 2 * float(y + BasicMath::randomFloat()) / (1 - options.height) + 1;
 			//map x from [0,width-1] to [-1,1]
-			ndcX = 2 * float(x + BasicMath::uniform_distribution(BasicMath::generator)) / (options.width - 1) - 1;
-			indirectIllumiantion(x, y) += castRay(cam.getRay(ndcX, ndcY), scn, options, directIllumination(x,y));
-			accumulatedIntensity(x, y) = indirectIllumiantion(x, y) + directIllumination(x, y);
+			ndcX = 2 * float(x + BasicMath::randomFloat()) / (options.width - 1) - 1;
+			vec3 direct(0);
+			vec3 indirect = castRay(cam.getRay(ndcX, ndcY), scn, options, direct);
+			directIllumination(x, y) += direct;
+			framebuffer.addSample(x, y, direct + indirect);
 		}
 	}
 }
 
-void render(Tigr* bmp, const Raytr_Core::camera& cam, const Raytr_Core::scene& scn, const RenderOptions& options)
+//! renders the scene into bmp, if hdrOutput isn't null it receives the filtered image before the gamma correction and the clamping
+void render(Tigr* bmp, const Raytr_Core::camera& cam, const Raytr_Core::scene& scn, const RenderOptions& options, intensity_array* hdrOutput = nullptr)
 {
+	//the sums of the direct illumination, the rest of the samples is what the filter smooths at the end
 	intensity_array directIllumination(options.width, options.height);
-	intensity_array indirectIllumination(options.width, options.height);
-	intensity_array accumulatedIntensity(options.width, options.height);
 
 	int dx = options.dxCoef*float(options.width) / float(options.numThreads);
 	int dy = options.dyCoef*float(options.height) / float(options.numThreads);
-	std::vector<ThreadsDistribution::rectangles> rects = ThreadsDistribution::populateWithRectangles(
+	//cut the image into tiles - a single set, the pool balances them between the threads
+	std::vector<ThreadsDistribution::rectangle> tiles = ThreadsDistribution::populateWithRectangles(
 		ThreadsDistribution::rectangle(ThreadsDistribution::point(options.x, options.y), ThreadsDistribution::point(options.width, options.height)),
-		ThreadsDistribution::point(dx, dy), options.numThreads);
-
-	//find the biggest number of rectangles between the rectangle sets per thread
-	int maxR = 0;
-	for (int i = 0; i < options.numThreads; ++i)
+		ThreadsDistribution::point(dx, dy), 1)[0].rects;
+	//the sums of the samples, the workers only commit their tiles - converting them for the screen is up to the main thread
+	progressive_framebuffer framebuffer(options.width, options.height, tiles);
+
+	//with adaptive sampling the tiles continue after options.samples passes, only over the pixels that are still noisy,
+	//until all of them have converged or got options.maxSamples
+	//with a time budget the passes are queued in batches for as long as they're predicted to fit, up to options.maxSamples if it's set
+	const bool budget = options.timeBudget > 0;
+	const bool adaptive = options.noiseThreshold > 0 && (options.maxSamples > options.samples || budget);
+	const int lastSample = budget ? (options.maxSamples > 0 ? options.maxSamples : cMAX_BUDGET_SAMPLES) : adaptive ? options.maxSamples : options.samples;
+	//the tiles stop after this sample, unless the time budget allows another batch of passes
+	std::atomic<int> targetSample(budget ? 1 : lastSample);
+
+	//a task is a tile and the sample to render in it
+	//a tile queues its next sample itself, so each tile is in at most one queue at a time and its passes run in order,
+	//while different tiles can be several samples apart - there's no barrier between the passes
+	struct tile_task
 	{
-		if (maxR < rects[i].rects.size())
-			maxR = rects[i].rects.size();
+		int tile;
+		int sample;
+	};
+	std::vector<tile_task> tasks;
+	for (int i = 0; i < int(tiles.size()); ++i)
+		tasks.push_back(tile_task{ i, 1 });
+
+	//tiles finished per sample - the last one to finish a sample reports its time
+	//a tile that stops early counts as finished for all of its remaining samples, the samples no tile rendered aren't reported
+	//tileStopped is only written by the tile's own task, the last one to finish a batch reads it
+	std::unique_ptr<std::atomic<int>[]> tilesDone(new std::atomic<int>[lastSample + 1]);
+	std::unique_ptr<std::atomic<int>[]> tilesRendered(new std::atomic<int>[lastSample + 1]);
+	for (int s = 0; s <= lastSample; ++s)
+	{
+		tilesDone[s] = 0;
+		tilesRendered[s] = 0;
 	}
-
-	//dispatch a thread for each rectangle of its set
-	//update after the threads finish their rectangles
-	std::vector<std::thread> threads;
-	for (int s = 1; s <= options.samples; ++s)
+	HighPrecisionTimer renderTime;
+	renderTime.StartCounter();
+	double lastSampleEnd = 0.0;
+	render_counters countersBefore = render_stats::collect();
+	//the time spent on each tile in the initial passes and in all of them, only written by the tile's current task
+	std::vector<double> tileInitialTime(tiles.size(), 0.0), tileTime(tiles.size(), 0.0);
+	std::vector<uint8_t> tileStopped(tiles.size(), 0);
+	//the start and the first sample of the current batch of passes
+	double batchStart = 0.0;
+	int batchFirst = 1;
+	auto finishSample = [&](ThreadsDistribution::worker_pool<tile_task>& workers, int worker, int sample)
 	{
-		//keep track of how much time each frame takes
-		HighPrecisionTimer sampleTime;
-		sampleTime.StartCounter();
-		for (int k = 0; k < maxR; ++k)
+		if (tilesDone[sample].fetch_add(1) + 1 != int(tiles.size()))
+			return;
+		double now = renderTime.GetCounter();
+		if (tilesRendered[sample].load() > 0)
 		{
-			//do raytracing work
-			for (int i = 0; i < options.numThreads; ++i)
-			{
-				if (rects[i].rects.size() > k)
-				{
-					threads.push_back(std::thread(render_thread, std::ref(directIllumination), std::ref(indirectIllumination),
-						std::ref(accumulatedIntensity), std::ref(cam), std::ref(scn), rects[i].rects[k], options));
-				}
-			}
-			for (int i = 0; i < options.numThreads; ++i)
-			{
-				if (rects[i].rects.size() > k)
-				{
-					threads[i].join();
-				}
-			}
-			threads.clear();
+			std::cout << "Sample " << sample << " time: " << now - lastSampleEnd << "\n";
+			lastSampleEnd = now;
+		}
+		if (!budget || sample != targetSample.load() || sample == lastSample)
+			return;
+		//all the tiles are waiting at the end of the batch - predict how many more passes fit from the batch's time per pass
+		//and queue half of them, so a bad prediction is corrected before the time runs out
+		double passTime = (now - batchStart) / (sample - batchFirst + 1);
+		int fit = int(std::min((options.timeBudget - now) / std::max(passTime, 1e-6), double(lastSample - sample)));
+		int batch = fit > 1 ? fit / 2 : fit;
+		int stopped = int(std::count(tileStopped.begin(), tileStopped.end(), uint8_t(1)));
+		if (batch == 0 || stopped == int(tiles.size()))
+			return;
+		batchStart = now;
+		batchFirst = sample + 1;
+		for (int s = sample + 1; s <= sample + batch; ++s)
+			tilesDone[s] += stopped;
+		targetSample = sample + batch;
+		for (int t = 0; t < int(tiles.size()); ++t)
+		{
+			if (!tileStopped[t])
+				workers.spawn(worker, tile_task{ t, sample + 1 });
+		}
+	};
 
-			//copy  buffer to screen
-			for (int i = 0; i < options.numThreads; ++i)
-			{
-				if (rects[i].rects.size() > k)
-				{
-					threads.push_back(std::thread(copyArrayToBmp, std::ref(accumulatedIntensity), bmp, rects[i].rects[k], s));
-				}
-			}
+	ThreadsDistribution::worker_pool<tile_task> pool(options.numThreads, tasks, tasks.size(),
+		[&](ThreadsDistribution::worker_pool<tile_task>& workers, int worker, const tile_task& task)
+	{
+		const ThreadsDistribution::rectangle& rect = tiles[task.tile];
+		HighPrecisionTimer tileTimer;
+		if (options.wavefront)
+			render_tile_wavefront(directIllumination, framebuffer, cam, scn, rect, options, task.sample);
+		else
+			render_tile(directIllumination, framebuffer, cam, scn, rect, options, task.sample);
+		//after the initial samples the tile stops once none of its pixels need more
+		bool stop = adaptive && task.sample >= options.samples && framebuffer.updateConvergence(rect, options.noiseThreshold) == 0;
+		framebuffer.commitTile(task.tile);
+		double time = tileTimer.GetCounter();
+		tileTime[task.tile] += time;
+		if (task.sample <= options.samples)
+			tileInitialTime[task.tile] += time;
+
+		//the target can only change once all the tiles have finished it, so it's read before this tile counts as finished
+		int target = targetSample.load();
+		tilesRendered[task.sample].fetch_add(1);
+		tileStopped[task.tile] = stop ? 1 : 0;
+		finishSample(workers, worker, task.sample);
+		if (stop)
+		{
+			for (int s = task.sample + 1; s <= target; ++s)
+				finishSample(workers, worker, s);
+		}
+		else if (task.sample < target)
+			workers.spawn(worker, tile_task{ task.tile, task.sample + 1 });
+	});
 
-			for (int i = 0; i < options.numThreads; ++i)
+	//the main thread only presents the image and checks for escape
+	while (!options.headless && !pool.finished())
+	{
+		//check for escape->terminate early
+		if (tigrKeyHeld(bmp, TK_ESCAPE))
+		{
+			pool.cancel();
+			pool.wait();
+			return;
+		}
+		//only the tiles that got a new pass since the last refresh are converted
+		framebuffer.present(bmp);
+		tigrUpdate(bmp);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	pool.wait();
+
+	//the workers have exited, so their counters are complete
+	render_counters counters = render_stats::collect();
+	double octreeBuildTime = counters.octreeBuildTime, bvhBuildTime = counters.bvhBuildTime;
+	counters -= countersBefore;
+	//the acceleration structures are built before the render - report all of the builds
+	counters.octreeBuildTime = octreeBuildTime;
+	counters.bvhBuildTime = bvhBuildTime;
+	double renderSeconds = renderTime.GetCounter();
+	render_stats::report(counters, renderSeconds);
+	//the most samples a pixel could have got
+	const int passes = targetSample.load();
+	if (budget)
+		std::cout << "Time budget: " << passes << " passes in " << renderSeconds << "s of " << options.timeBudget << "s\n";
+	if (adaptive)
+	{
+		//a tile's initial passes sample all of its pixels, so they tell what options.maxSamples of them would have cost
+		double fixedTime = 0.0, adaptiveTime = 0.0;
+		for (size_t t = 0; t < tiles.size(); ++t)
+		{
+			fixedTime += tileInitialTime[t] * passes / std::min(options.samples, passes);
+			adaptiveTime += tileTime[t];
+		}
+		uint64_t samples = 0;
+		uint32_t minSamples = uint32_t(passes), maxSamples = 0;
+		for (int y = 0; y < options.height; ++y)
+		{
+			for (int x = 0; x < options.width; ++x)
 			{
-				if (rects[i].rects.size() > k)
-				{
-					threads[i].join();
-				}
+				uint32_t count = framebuffer.sampleCount(x, y);
+				samples += count;
+				minSamples = std::min(minSamples, count);
+				maxSamples = std::max(maxSamples, count);
 			}
+		}
+		double pixels = double(options.width)*options.height;
+		std::cout << "Adaptive sampling: " << samples / pixels << " samples per pixel (" << minSamples << " - " << maxSamples << "), "
+			<< 100.0*samples / (pixels*passes) << "% of " << passes << ", about "
+			<< (adaptiveTime > 0.0 ? renderSeconds*(fixedTime / adaptiveTime - 1.0) : 0.0) << "s saved against " << passes << " samples everywhere\n";
+	}
 
-			threads.clear();
-			//check for escape->terminate early
-			if (tigrKeyHeld(bmp, TK_ESCAPE))
-			{
-				return;
-			}
-			tigrUpdate(bmp);
+	//noise filter addition - the median filter smooths the indirect part of the pixels' averages, the direct part is added back as it is
+	//the pixels can have different sample counts, so they're averaged before the filter
+	intensity_array indirectIllumination(options.width, options.height);
+	for (int y = 0; y < options.height; ++y)
+	{
+		for (int x = 0; x < options.width; ++x)
+		{
+			uint32_t count = framebuffer.sampleCount(x, y);
+			if (count == 0)
+				continue;
+			indirectIllumination(x, y) = (framebuffer.sum(x, y) - directIllumination(x, y)) / float(count);
+			directIllumination(x, y) /= float(count);
 		}
-		std::cout << "Sample " << s << " time: " << sampleTime.GetCounter() << "\n";
 	}
-	//noise filter addition
 	intensity_array filteredIntensity(options.width, options.height);
 	median_filter filter;
 	filter.filter_image(indirectIllumination, filteredIntensity);
 	filteredIntensity += directIllumination;
-	copyArrayToBmp(accumulatedIntensity, bmp, ThreadsDistribution::rectangle(0, 0, options.width, options.height), options.samples);
-	tigrUpdate(bmp);
+	//the filtered image replaces the progressive one on the screen and in the output
+	const gamma_lut& lut = gamma_lut::instance();
+	for (int y = 0; y < options.height; ++y)
+	{
+		for (int x = 0; x < options.width; ++x)
+		{
+			const vec3& col = filteredIntensity(x, y);
+			TPixel& pixel = bmp->pix[y*bmp->w + x];
+			pixel.r = lut(col.x);
+			pixel.g = lut(col.y);
+			pixel.b = lut(col.z);
+			if (hdrOutput)
+				(*hdrOutput)(x, y) = col;
+		}
+	}
+	if (!options.headless)
+		tigrUpdate(bmp);
 }
 
 void cornell_box_scene(scene** scn, camera** cam, float aspect)
@@ -749,6 +1190,200 @@ void xyz_dragon_scene(scene** scn, camera** cam, float aspect)
 
 }
 
+//! the benchmark suite: the mesh queries of Benchmark::meshQueries and full passes of the integrators (wavefront with and without sorting) over testScene.txt with a light added
+/*!
+	Arguments after --benchmark: an optional ply file, --json <file> to save the results, --baseline <file> to compare them to a saved run.
+*/
+bool runBenchmarks(int argc, char* argv[], RenderOptions options)
+{
+	const char* plyFile = "bun_zipper_res.ply";
+	const char* jsonFile = nullptr;
+	const char* baselineFile = nullptr;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--json" && i + 1 < argc)
+			jsonFile = argv[++i];
+		else if (arg == "--baseline" && i + 1 < argc)
+			baselineFile = argv[++i];
+		else
+			plyFile = argv[i];
+	}
+
+	Benchmark::benchmark_report report;
+	if (!Benchmark::meshQueries(plyFile, report))
+		return false;
+
+	//a full pass of castRay and of the wavefront integrator, single threaded so the numbers don't depend on the machine's load
+	scene* scn;
+	if (!SceneLoader::loadScene("testScene.txt", &scn))
+		return false;
+	scn->addObject(new sphere(vec3(190, 390, 50), 30, new emitter_material(new constant_texture(vec4(10, 10, 10, 1)), nullptr)));
+	scn->buildAccelerationStructure();
+	camera cam(vec3(278, 278, -800), vec3(278, 278, 0), vec3(0, 1, 0), 1.0f, 40.0f);
+	options.width = options.height = 128;
+	options.samples = 4;
+	options.shadowRaysCount = 1;
+	const char* integrators[4] = { "castray", "castray_packets", "wavefront", "wavefront_sorted" };
+	for (int integrator = 0; integrator < 4; ++integrator)
+	{
+		const char* name = integrators[integrator];
+		options.packetSize = integrator == 1 ? 8 : 0;
+		options.wavefront = integrator > 1;
+		options.sortRays = integrator == 3;
+		intensity_array directIllumination(options.width, options.height);
+		ThreadsDistribution::rectangle image(0, 0, options.width, options.height);
+		progressive_framebuffer framebuffer(options.width, options.height, std::vector<ThreadsDistribution::rectangle>(1, image));
+		render_counters before = render_stats::collect();
+		HighPrecisionTimer timer;
+		timer.StartCounter();
+		for (int s = 1; s <= options.samples; ++s)
+		{
+			if (options.wavefront)
+				render_tile_wavefront(directIllumination, framebuffer, cam, *scn, image, options, s);
+			else
+				render_tile(directIllumination, framebuffer, cam, *scn, image, options, s);
+		}
+		double time = timer.GetCounter();
+		render_counters counters = render_stats::collect();
+		counters -= before;
+		vec3 checksum(0);
+		for (int y = 0; y < options.height; ++y)
+		{
+			for (int x = 0; x < options.width; ++x)
+				checksum += framebuffer.sum(x, y);
+		}
+		std::cout << "Benchmark: " << name << " " << options.width << "x" << options.height << ", " << options.samples << " samples, "
+			<< counters.rays() << " rays (camera " << counters.cameraRays << ", shadow " << counters.shadowRays << ", bounce " << counters.bounceRays << ")\n";
+		Benchmark::addRayRate(report, name, size_t(counters.rays()), time);
+		report.add(std::string(name) + "_ns_per_sample", time*1e9 / counters.cameraRays, false);
+		std::cout << "    checksum " << checksum << "\n";
+	}
+	delete scn;
+
+	if (jsonFile && !report.writeJson(jsonFile))
+	{
+		std::cout << "Benchmark: couldn't write " << jsonFile << "\n";
+		return false;
+	}
+	if (baselineFile && !report.compare(baselineFile))
+	{
+		std::cout << "Benchmark: couldn't read " << baselineFile << "\n";
+		return false;
+	}
+	return true;
+}
+
+//! the settings of a run that aren't render options
+struct CommandLine
+{
+	CommandLine() : sceneFile("testScene.txt"), output(nullptr), floatOutput(nullptr)
+	{}
+
+	const char* sceneFile;		//!< scene description for the SceneLoader
+	const char* output;			//!< png written when the render finishes, in a window it's saved on SPACE instead
+	const char* floatOutput;	//!< pfm written when the render finishes, nullptr for none
+};
+
+void printUsage()
+{
+	std::cout << "Usage: RaytracingProject2 [options]\n"
+		<< "  --scene <file>              scene to render (testScene.txt)\n"
+		<< "  --size <width> <height>     resolution (800 800)\n"
+		<< "  --samples <n>               samples per pixel (50), the initial samples with --noise-threshold\n"
+		<< "  --noise-threshold <t>       adaptive sampling: stop sampling a pixel once its relative error is below t (e.g. 0.02)\n"
+		<< "  --max-samples <n>           the most samples per pixel with --noise-threshold (4 x samples) or --time-budget (no limit)\n"
+		<< "  --time-budget <seconds>     keep adding passes while the next one is predicted to finish in time\n"
+		<< "  --threads <n>               render threads (8)\n"
+		<< "  --shadow-rays <n>           light samples per path vertex, whatever the number of lights (0)\n"
+		<< "  --output <file.png>         8 bit output image\n"
+		<< "  --float-output <file.pfm>   linear float output image\n"
+		<< "  --headless                  no window, render and write the outputs (output_image.png by default)\n"
+		<< "  --wavefront                 use the wavefront integrator\n"
+		<< "  --sort-rays                 use the wavefront integrator and sort the bounce rays\n"
+		<< "  --packets <n>               trace the camera rays of n x n pixels (up to 8) as packets, 0 - one by one\n"
+		<< "  --no-mesh-cache             always parse the .ply files and build the acceleration structures, don't write .cache files\n"
+		<< "  --uncompressed-octree       keep the octrees in the uncompressed node layout\n"
+		<< "  --benchmark [ply] [--json <file>] [--baseline <file>]  ray tracing benchmarks\n"
+		<< "  --benchmark-leaves [ply]    compare the triangle leaf kernels\n"
+		<< "  --benchmark-math [ply]      time the BasicMath backend\n";
+}
+
+//! reads the arguments into options and cmd, returns false on an unknown or incomplete argument
+bool parseArguments(int argc, char* argv[], RenderOptions& options, CommandLine& cmd)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		//number of values following the argument
+		int values = (arg == "--size") ? 2 : (arg == "--headless" || arg == "--wavefront" || arg == "--sort-rays" || arg == "--no-mesh-cache" ||
+			arg == "--uncompressed-octree") ? 0 : 1;
+		if (arg != "--scene" && arg != "--size" && arg != "--samples" && arg != "--threads" && arg != "--packets" &&
+			arg != "--noise-threshold" && arg != "--max-samples" && arg != "--time-budget" && arg != "--shadow-rays" && arg != "--output" && arg != "--float-output" && arg != "--headless" && arg != "--wavefront" && arg != "--sort-rays" &&
+			arg != "--no-mesh-cache" && arg != "--uncompressed-octree")
+		{
+			std::cout << "Unknown argument " << arg << "\n";
+			return false;
+		}
+		if (i + values >= argc)
+		{
+			std::cout << "Missing value for " << arg << "\n";
+			return false;
+		}
+		if (arg == "--scene")
+			cmd.sceneFile = argv[i + 1];
+		else if (arg == "--size")
+		{
+			options.width = std::atoi(argv[i + 1]);
+			options.height = std::atoi(argv[i + 2]);
+		}
+		else if (arg == "--samples")
+			options.samples = std::atoi(argv[i + 1]);
+		else if (arg == "--noise-threshold")
+			options.noiseThreshold = float(std::atof(argv[i + 1]));
+		else if (arg == "--max-samples")
+			options.maxSamples = std::atoi(argv[i + 1]);
+		else if (arg == "--time-budget")
+			options.timeBudget = std::atof(argv[i + 1]);
+		else if (arg == "--shadow-rays")
+			options.shadowRaysCount = std::atoi(argv[i + 1]);
+		else if (arg == "--threads")
+			options.numThreads = std::atoi(argv[i + 1]);
+		else if (arg == "--packets")
+			options.packetSize = std::min(std::max(std::atoi(argv[i + 1]), 0), 8);
+		else if (arg == "--output")
+			cmd.output = argv[i + 1];
+		else if (arg == "--float-output")
+			cmd.floatOutput = argv[i + 1];
+		else if (arg == "--headless")
+			options.headless = true;
+		else if (arg == "--wavefront")
+			options.wavefront = true;
+		else if (arg == "--sort-rays")
+			options.wavefront = options.sortRays = true;
+		else if (arg == "--no-mesh-cache")
+			SceneLoader::useMeshCache = false;
+		else if (arg == "--uncompressed-octree")
+			SceneLoader::compactOctrees = false;
+		i += values;
+	}
+	if (options.width < 1 || options.height < 1 || options.samples < 1 || options.numThreads < 1)
+	{
+		std::cout << "The size, samples and threads have to be positive\n";
+		return false;
+	}
+	if (options.noiseThreshold < 0 || options.timeBudget < 0 || options.maxSamples < 0 || options.shadowRaysCount < 0)
+	{
+		std::cout << "The noise threshold, time budget, max samples and shadow rays can't be negative\n";
+		return false;
+	}
+	if (options.noiseThreshold > 0 && options.maxSamples == 0 && options.timeBudget == 0)
+		options.maxSamples = 4 * options.samples;
+	if (options.headless && !cmd.output && !cmd.floatOutput)
+		cmd.output = "output_image.png";
+	return true;
+}
+
 int main(int argc, char *argv[])
 {
 
@@ -758,7 +1393,7 @@ int main(int argc, char *argv[])
 	options.width = 800;
 	options.height = 800;
 	options.numThreads = 8;
-	options.dxCoef = 8;
+	options.dxCoef = 1;
 	options.dyCoef = 1;
 	options.samples = 50;
 	options.shadowRaysCount = 0;
@@ -767,11 +1402,33 @@ int main(int argc, char *argv[])
 	options.backgroundColor = new GradientBackgroundColor(vec3(0), vec3(1));
 	options.rrOptions.mulFactor = 10;
 
+	//ray tracing benchmarks with fixed seeds, the results can be saved and compared to a previous run
+	if (argc > 1 && std::string(argv[1]) == "--benchmark")
+		return runBenchmarks(argc, argv, options) ? 0 : 1;
+	//compare the scalar and simd triangle kernels instead of rendering
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-leaves")
+		return Benchmark::leafKernels(argc > 2 ? argv[2] : "bun_zipper_res.ply") ? 0 : 1;
+	//time the BasicMath backend the program was built with (see BASICMATH_SIMD in util.h)
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-math")
+		return Benchmark::math(argc > 2 ? argv[2] : "bun_zipper_res.ply") ? 0 : 1;
+
+	CommandLine cmd;
+	if (!parseArguments(argc, argv, options, cmd))
+	{
+		printUsage();
+		return 1;
+	}
 
-
-	Tigr *screen = tigrWindow(options.width,options.height, "Raytracer", 0);
+	//without a window the image is rendered into a plain bitmap
+	Tigr *screen = options.headless ? tigrBitmap(options.width, options.height) : tigrWindow(options.width, options.height, "Raytracer", 0);
+	if (screen == NULL)
+	{
+		std::cout << "Couldn't open a window, use --headless to render without one\n";
+		return 1;
+	}
 	tigrClear(screen, tigrRGB(0,0,0));
-	tigrUpdate(screen);
+	if (!options.headless)
+		tigrUpdate(screen);
 
 
 	camera* cam;
@@ -782,21 +1439,37 @@ int main(int argc, char *argv[])
 	vec3 lookat(278, 278, 0);
 	float vfov = 40.0;
 	cam = new camera(lookfrom, lookat, vec3(0, 1, 0), float(options.width) / float(options.height), vfov);
-	if (!SceneLoader::loadScene("testScene.txt", &scn))
+	if (!SceneLoader::loadScene(cmd.sceneFile, &scn))
 	{
 		tigrFree(screen);
 		return 1;
 	}
 
+	intensity_array hdrImage(options.width, options.height);
 	HighPrecisionTimer globalTime;
 	globalTime.StartCounter();
-	render(screen, *cam, *scn, options);
+	render(screen, *cam, *scn, options, cmd.floatOutput ? &hdrImage : nullptr);
 	std::cout << "Rendering time: " << globalTime.GetCounter() << "\n";
-	while (!tigrClosed(screen))
+
+	int result = 0;
+	if (options.headless)
+	{
+		if (cmd.output && !tigrSaveImage(cmd.output, screen))
+		{
+			std::cout << "Couldn't write " << cmd.output << "\n";
+			result = 1;
+		}
+	}
+	if (cmd.floatOutput && !hdrImage.savePfm(cmd.floatOutput))
+	{
+		std::cout << "Couldn't write " << cmd.floatOutput << "\n";
+		result = 1;
+	}
+	while (!options.headless && !tigrClosed(screen))
 	{
 		if (tigrKeyDown(screen, TK_SPACE))
 		{
-			tigrSaveImage("output_image.png", screen);
+			tigrSaveImage(cmd.output ? cmd.output : "output_image.png", screen);
 			break;
 		}
 		tigrUpdate(screen);
@@ -804,5 +1477,5 @@ int main(int argc, char *argv[])
 	tigrFree(screen);
 	delete scn;
 	delete cam;
-	return 0;
-}
\ No newline at end of file
+	return result;
+}
@@ -0,0 +1,151 @@
+#ifndef RAYTR_CORE_MAPPED_FILE_H
+#define RAYTR_CORE_MAPPED_FILE_H
+#include <cstdint>
+#include <cstddef>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Raytr_Core
+{
+	//! gets the size in bytes and the last modification time of a file, returns false if it doesn't exist
+	inline bool getFileStatus(const char* filename, uint64_t& size, int64_t& modified)
+	{
+#ifdef _WIN32
+		struct _stat64 st;
+		if (_stat64(filename, &st) != 0)
+			return false;
+#else
+		struct stat st;
+		if (stat(filename, &st) != 0)
+			return false;
+#endif
+		size = uint64_t(st.st_size);
+		modified = int64_t(st.st_mtime);
+		return true;
+	}
+
+	//! a read-only view of a whole file mapped into memory
+	class mapped_file
+	{
+	private:
+		const char* bytes;
+		size_t fileSize;
+#ifdef _WIN32
+		HANDLE file, mapping;
+#endif
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+	public:
+#ifdef _WIN32
+		mapped_file() : bytes(nullptr), fileSize(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {}
+#else
+		mapped_file() : bytes(nullptr), fileSize(0) {}
+#endif
+
+		//! maps the file, returns false if it can't be opened or is empty
+		bool open(const char* filename)
+		{
+			close();
+#ifdef _WIN32
+			file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+			{
+				close();
+				return false;
+			}
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping == NULL)
+			{
+				close();
+				return false;
+			}
+			bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			if (bytes == nullptr)
+			{
+				close();
+				return false;
+			}
+			fileSize = size_t(size.QuadPart);
+#else
+			int fd = ::open(filename, O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat st;
+			if (fstat(fd, &st) != 0 || st.st_size == 0)
+			{
+				::close(fd);
+				return false;
+			}
+			void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			//the mapping stays valid after the descriptor is closed
+			::close(fd);
+			if (view == MAP_FAILED)
+				return false;
+			bytes = static_cast<const char*>(view);
+			fileSize = size_t(st.st_size);
+#endif
+			return true;
+		}
+
+		//! unmaps the file, the pointers returned by data() are no longer valid
+		void close()
+		{
+#ifdef _WIN32
+			if (bytes != nullptr)
+				UnmapViewOfFile(bytes);
+			if (mapping != NULL)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+			mapping = NULL;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (bytes != nullptr)
+				munmap(const_cast<char*>(bytes), fileSize);
+#endif
+			bytes = nullptr;
+			fileSize = 0;
+		}
+
+		const char* data() const
+		{
+			return bytes;
+		}
+
+		size_t size() const
+		{
+			return fileSize;
+		}
+
+		bool isOpen() const
+		{
+			return bytes != nullptr;
+		}
+
+		~mapped_file()
+		{
+			close();
+		}
+	};
+}
+
+#endif
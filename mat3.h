@@ -16,7 +16,7 @@ namespace BasicMath
 	public:
 		mat3() {}
 		explicit mat3(float s)
-			:v0(s),v1(s),v2(s)
+			:v{ vec3(s), vec3(s), vec3(s) }
 		{
 		}
 		mat3(float e0, float e1, float e2,
@@ -83,14 +83,7 @@ namespace BasicMath
 		//! returns a rotation matrix for rotation around the x-y-z axes
 		static mat3 rotationXYZ(vec3 angles);
 
-		union
-		{
-			vec3 v[3];
-			struct
-			{
-				vec3 v0, v1, v2;
-			};
-		};
+		vec3 v[3];
 	};
 
 	inline mat3& mat3::operator+=(const mat3 &m) {
@@ -100,6 +93,22 @@ namespace BasicMath
 		return *this;
 	}
 
+#ifdef BASICMATH_SIMD
+	//! row times matrix, the rows of the result of a matrix multiplication
+	inline vec3 rowTimesMatrix(const vec3& row, const mat3& m)
+	{
+		return vec3(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(row.x), m.v[0].m), _mm_mul_ps(_mm_set1_ps(row.y), m.v[1].m)),
+			_mm_mul_ps(_mm_set1_ps(row.z), m.v[2].m)));
+	}
+
+	inline mat3& mat3::operator*=(const mat3 &m) {
+		vec3 res0 = rowTimesMatrix(v[0], m), res1 = rowTimesMatrix(v[1], m), res2 = rowTimesMatrix(v[2], m);
+		v[0] = res0;
+		v[1] = res1;
+		v[2] = res2;
+		return *this;
+	}
+#else
 	inline mat3& mat3::operator*=(const mat3 &m) {
 		mat3 res;
 		res[0][0] = v[0][0] * m.v[0][0] + v[0][1] * m.v[1][0] + v[0][2] * m.v[2][0];
@@ -117,6 +126,7 @@ namespace BasicMath
 
 		return *this;
 	}
+#endif
 
 	inline vec3 mat3::operator*=(const vec3& vc)
 	{
@@ -232,6 +242,9 @@ namespace BasicMath
 
 	//! matrix multiplication
 	inline mat3 operator*(const mat3 &m1, const mat3 &m2) {
+#ifdef BASICMATH_SIMD
+		return mat3(rowTimesMatrix(m1.v[0], m2), rowTimesMatrix(m1.v[1], m2), rowTimesMatrix(m1.v[2], m2));
+#else
 		mat3 res;
 		res.v[0][0] = m1.v[0][0] * m2.v[0][0] + m1.v[0][1] * m2.v[1][0] + m1.v[0][2] * m2.v[2][0];
 		res.v[0][1] = m1.v[0][0] * m2.v[0][1] + m1.v[0][1] * m2.v[1][1] + m1.v[0][2] * m2.v[2][1];
@@ -243,11 +256,19 @@ namespace BasicMath
 		res.v[2][1] = m1.v[2][0] * m2.v[0][1] + m1.v[2][1] * m2.v[1][1] + m1.v[2][2] * m2.v[2][1];
 		res.v[2][2] = m1.v[2][0] * m2.v[0][2] + m1.v[2][1] * m2.v[1][2] + m1.v[2][2] * m2.v[2][2];
 		return res;
+#endif
 	}
 
 	//! matrix-vector multiplication
 	inline vec3 operator*(const mat3 &m, const vec3& v) {
+#ifdef BASICMATH_SIMD
+		//the 3 products transposed so the dot products are summed up in parallel
+		__m128 p0 = _mm_mul_ps(m.v[0].m, v.m), p1 = _mm_mul_ps(m.v[1].m, v.m), p2 = _mm_mul_ps(m.v[2].m, v.m), p3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+		return vec3(_mm_add_ps(_mm_add_ps(p0, p1), p2));
+#else
 		return vec3(dotProduct(m.v[0], v), dotProduct(m.v[1], v), dotProduct(m.v[2], v));
+#endif
 	}
 
 	//! matrix division (through division)
@@ -270,9 +291,15 @@ namespace BasicMath
 	//! returns a matrix from column vectors
 	inline mat3 matrixFromColumns(const vec3& v0, const vec3& v1, const vec3& v2)
 	{
+#ifdef BASICMATH_SIMD
+		__m128 c0 = v0.m, c1 = v1.m, c2 = v2.m, c3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+		return mat3(vec3(c0), vec3(c1), vec3(c2));
+#else
 		return mat3(v0.x, v1.x, v2.x,
 			v0.y, v1.y, v2.y,
 			v0.z, v1.z, v2.z);
+#endif
 	}
 
 	//! returns the transposed matrix
@@ -308,7 +335,7 @@ namespace BasicMath
 	mat3 createCoordinateSystem(const vec3& v)
 	{
 		vec3 w;
-		if (std::fabsf(v.x) > std::fabsf(v.y))
+		if (std::fabs(v.x) > std::fabs(v.y))
 			w = vec3(v.z, 0, -v.x) / sqrt(v.x * v.x + v.z * v.z);
 		else
 			w = vec3(0, -v.z, v.y) / sqrt(v.y * v.y + v.z * v.z);
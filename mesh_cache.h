@@ -0,0 +1,332 @@
+#ifndef RAYTR_CORE_MESH_CACHE_H
+#define RAYTR_CORE_MESH_CACHE_H
+#include "triangle_mesh_data.h"
+#include "octree.h"
+#include "bvh.h"
+#include "mapped_file.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+namespace Raytr_Core
+{
+	//! A binary cache of a mesh loaded from a .ply file and of the acceleration structures built over it
+	/*!
+		Stored next to the .ply as <file>.<transform hash>.cache, so the entries of a scene loading the same .ply with different
+		transforms have a cache each instead of overwriting each other's. It holds the transformed vertices (with the accumulated normals), the vertex
+		indices of the triangles, the bounds, and optionally a bvh and an octree. The cache is memory mapped when read and is
+		ignored when its version, the source file's size or modification time, or the mesh's transform differ.
+		Everything is copied out of the mapping, so the file can be rewritten with save() once the scene is built.
+	*/
+	class mesh_cache
+	{
+	private:
+		static const uint32_t cVERSION = 1;
+		static const uint32_t cVERTEX_FLOATS = 8;	//!< position, normal and uv of a vertex
+
+		//! the start of the file, followed by the vertices, the triangles, the bvh nodes and indices and the octree
+		struct header
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t vertexFloats;
+			uint64_t sourceSize;
+			int64_t sourceModified;
+			float transform[9];			//!< position, rotation and scaling the mesh was loaded with
+			float boundsMin[3], boundsMax[3];
+			uint32_t vertexCount, triangleCount;
+			uint32_t bvhMaxElements, bvhNodeCount, bvhIndexCount;
+			int32_t octreeDepth;
+			uint32_t octreeMaxElements, octreeSize;
+		};
+
+		//! a bvh node as stored in the file - independent of the padding of vec3
+		struct stored_node
+		{
+			float min[3];
+			uint32_t leftFirst;
+			float max[3];
+			uint32_t count;
+		};
+
+		std::string filename;
+		BasicMath::vec3 position, rotation, scaling;
+		uint64_t sourceSize;
+		int64_t sourceModified;
+		bool sourceFound;
+
+		mapped_file file;
+		header cached;					//!< the header of the mapped file, valid only if isValid
+		bool isValid;
+
+		//the sections written by save()
+		const bvh* hierarchy;
+		const octree* tree;
+		int octreeDepth;
+		size_t octreeMaxElements;
+		bool dirty;						//!< the file has to be rewritten
+
+		static void copyVec3(float* dst, const BasicMath::vec3& v)
+		{
+			dst[0] = v.x; dst[1] = v.y; dst[2] = v.z;
+		}
+
+		void fillTransform(float* transform) const
+		{
+			copyVec3(transform, position);
+			copyVec3(transform + 3, rotation);
+			copyVec3(transform + 6, scaling);
+		}
+
+		//! 64 bit fnv-1a of the transform's floats, in hex - the part of the file name telling the transforms of a .ply apart
+		/*!
+			The octree's depth and leaf size aren't part of it: they follow from the mesh, and the header still has to match them.
+		*/
+		std::string transformHash() const
+		{
+			float transform[9];
+			fillTransform(transform);
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(transform);
+			uint64_t hash = 0xcbf29ce484222325ULL;
+			for (size_t i = 0; i < sizeof(transform); ++i)
+				hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+			char text[17];
+			for (int i = 0; i < 16; ++i)
+				text[i] = "0123456789abcdef"[(hash >> (60 - 4 * i)) & 0xf];
+			text[16] = 0;
+			return text;
+		}
+
+		size_t vertexBytes(const header& h) const { return size_t(h.vertexCount)*cVERTEX_FLOATS*sizeof(float); }
+		size_t triangleBytes(const header& h) const { return size_t(h.triangleCount) * 3 * sizeof(uint32_t); }
+		size_t bvhBytes(const header& h) const { return size_t(h.bvhNodeCount)*sizeof(stored_node) + size_t(h.bvhIndexCount)*sizeof(uint32_t); }
+		size_t octreeBytes(const header& h) const { return size_t(h.octreeSize)*sizeof(uint32_t); }
+
+		//! maps the cache and checks it belongs to the current source file and transform
+		bool validate()
+		{
+			if (!sourceFound || !file.open(filename.c_str()) || file.size() < sizeof(header))
+				return false;
+			memcpy(&cached, file.data(), sizeof(header));
+			float transform[9];
+			fillTransform(transform);
+			if (memcmp(cached.magic, "RTRMESH", 8) != 0 || cached.version != cVERSION || cached.vertexFloats != cVERTEX_FLOATS ||
+				cached.sourceSize != sourceSize || cached.sourceModified != sourceModified || memcmp(cached.transform, transform, sizeof(transform)) != 0)
+				return false;
+			return file.size() == sizeof(header) + vertexBytes(cached) + triangleBytes(cached) + bvhBytes(cached) + octreeBytes(cached);
+		}
+
+		const char* vertexSection() const { return file.data() + sizeof(header); }
+		const char* triangleSection() const { return vertexSection() + vertexBytes(cached); }
+		const char* bvhSection() const { return triangleSection() + triangleBytes(cached); }
+		const char* octreeSection() const { return bvhSection() + bvhBytes(cached); }
+
+		mesh_cache(const mesh_cache&) = delete;
+		mesh_cache& operator=(const mesh_cache&) = delete;
+
+	public:
+		//! looks for the cache of the .ply file plyFilename loaded with the given transform
+		mesh_cache(const char* plyFilename, const BasicMath::vec3& position, const BasicMath::vec3& rotation, const BasicMath::vec3& scaling)
+			: position(position), rotation(rotation), scaling(scaling),
+			sourceSize(0), sourceModified(0), hierarchy(nullptr), tree(nullptr), octreeDepth(0), octreeMaxElements(0)
+		{
+			filename = std::string(plyFilename) + "." + transformHash() + ".cache";
+			memset(&cached, 0, sizeof(header));
+			sourceFound = getFileStatus(plyFilename, sourceSize, sourceModified);
+			isValid = validate();
+			if (!isValid)
+				file.close();
+			dirty = !isValid;
+		}
+
+		//! true if the cache holds the mesh of the current source file
+		bool valid() const
+		{
+			return isValid;
+		}
+
+		//! creates a new triangle_mesh_data in meshDataVector from the cache, like PlyLoader::loadPlyMesh
+		bool loadMeshData()
+		{
+			if (!isValid)
+				return false;
+			//check the triangles before anything is created
+			const uint32_t* indices = reinterpret_cast<const uint32_t*>(triangleSection());
+			for (size_t i = 0; i < size_t(cached.triangleCount) * 3; ++i)
+			{
+				if (indices[i] >= cached.vertexCount)
+				{
+					isValid = false;
+					dirty = true;
+					file.close();
+					return false;
+				}
+			}
+
+			meshDataVector.push_back(triangle_mesh_data(position, rotation, scaling));
+			triangle_mesh_data& meshData = meshDataVector.back();
+			meshData.initialCreateVertexBuffer(cached.vertexCount);
+			const float* v = reinterpret_cast<const float*>(vertexSection());
+			for (uint32_t i = 0; i < cached.vertexCount; ++i, v += cVERTEX_FLOATS)
+			{
+				meshData.initialAddTransformedVertex(vertex(BasicMath::vec3(v[0], v[1], v[2]), BasicMath::vec3(v[3], v[4], v[5]), BasicMath::vec2(v[6], v[7])));
+			}
+			meshData.initialCreateTriangleBuffer(cached.triangleCount);
+			for (uint32_t i = 0; i < cached.triangleCount; ++i, indices += 3)
+			{
+				meshData.initialAddTriangle(indices[0], indices[1], indices[2]);
+			}
+			meshData.initialSetBoundingBox(BasicMath::vec3(cached.boundsMin[0], cached.boundsMin[1], cached.boundsMin[2]),
+				BasicMath::vec3(cached.boundsMax[0], cached.boundsMax[1], cached.boundsMax[2]));
+			std::cout << "MeshCache: Loaded " << cached.triangleCount << " triangles from " << filename << "\n";
+			return true;
+		}
+
+		//! fills out result with the cached bvh if it was built with maxElementsCount, returns false if there's none or it's malformed
+		bool loadBvh(size_t maxElementsCount, bvh& result) const
+		{
+			if (!isValid || cached.bvhNodeCount == 0 || cached.bvhMaxElements != maxElementsCount)
+				return false;
+			const stored_node* stored = reinterpret_cast<const stored_node*>(bvhSection());
+			const uint32_t* indices = reinterpret_cast<const uint32_t*>(bvhSection() + size_t(cached.bvhNodeCount)*sizeof(stored_node));
+			std::vector<bvh::node> nodes(cached.bvhNodeCount);
+			for (uint32_t i = 0; i < cached.bvhNodeCount; ++i)
+			{
+				const stored_node& s = stored[i];
+				//the children of an inner node follow it, a leaf's range has to be inside the index array
+				if (s.count == 0 ? (s.leftFirst <= i || uint64_t(s.leftFirst) + 1 >= cached.bvhNodeCount) : uint64_t(s.leftFirst) + s.count > cached.bvhIndexCount)
+					return false;
+				nodes[i].min = BasicMath::vec3(s.min[0], s.min[1], s.min[2]);
+				nodes[i].max = BasicMath::vec3(s.max[0], s.max[1], s.max[2]);
+				nodes[i].leftFirst = s.leftFirst;
+				nodes[i].count = s.count;
+			}
+			for (uint32_t i = 0; i < cached.bvhIndexCount; ++i)
+			{
+				if (indices[i] >= cached.triangleCount)
+					return false;
+			}
+			result.assign(nodes.data(), nodes.size(), indices, cached.bvhIndexCount, maxElementsCount);
+			return true;
+		}
+
+		//! the cached octree in the format of octree::serialize if it was built with depth and maxElementsCount, nullptr if there's none
+		const uint32_t* octreeData(int depth, size_t maxElementsCount, size_t& size) const
+		{
+			if (!isValid || cached.octreeSize == 0 || cached.octreeDepth != depth || cached.octreeMaxElements != maxElementsCount)
+				return nullptr;
+			size = cached.octreeSize;
+			return reinterpret_cast<const uint32_t*>(octreeSection());
+		}
+
+		//! the bvh to store with the mesh, the file is rewritten by save() if the cache doesn't already hold one with the same leaf size
+		void setBvh(const bvh& hierarchy)
+		{
+			this->hierarchy = &hierarchy;
+			if (!isValid || cached.bvhNodeCount == 0 || cached.bvhMaxElements != hierarchy.maxLeafSize())
+				dirty = true;
+		}
+
+		//! the octree to store with the mesh, the file is rewritten by save() if the cache doesn't already hold one built with the same parameters
+		void setOctree(const octree& tree, int depth, size_t maxElementsCount)
+		{
+			this->tree = &tree;
+			octreeDepth = depth;
+			octreeMaxElements = maxElementsCount;
+			if (!isValid || cached.octreeSize == 0 || cached.octreeDepth != depth || cached.octreeMaxElements != maxElementsCount)
+				dirty = true;
+		}
+
+		//! writes the mesh data and the structures given to setBvh and setOctree if the cache is missing or outdated, then unmaps the file
+		/*!
+			The structures have to be alive until then. A cache which can't be written (a read-only directory) is only reported.
+		*/
+		bool save(const triangle_mesh_data& meshData)
+		{
+			file.close();
+			if (!dirty)
+				return true;
+			if (!sourceFound)
+				return false;
+
+			header h;
+			memset(&h, 0, sizeof(header));
+			memcpy(h.magic, "RTRMESH", 8);
+			h.version = cVERSION;
+			h.vertexFloats = cVERTEX_FLOATS;
+			h.sourceSize = sourceSize;
+			h.sourceModified = sourceModified;
+			fillTransform(h.transform);
+			copyVec3(h.boundsMin, meshData.getBoundingBox().min());
+			copyVec3(h.boundsMax, meshData.getBoundingBox().max());
+			h.vertexCount = uint32_t(meshData.vertexCount());
+			h.triangleCount = uint32_t(meshData.triangleCount());
+
+			std::vector<uint32_t> octreeData;
+			if (tree != nullptr)
+			{
+				tree->serialize(octreeData);
+				h.octreeDepth = octreeDepth;
+				h.octreeMaxElements = uint32_t(octreeMaxElements);
+				h.octreeSize = uint32_t(octreeData.size());
+			}
+			if (hierarchy != nullptr)
+			{
+				h.bvhMaxElements = uint32_t(hierarchy->maxLeafSize());
+				h.bvhNodeCount = uint32_t(hierarchy->nodeArray().size());
+				h.bvhIndexCount = uint32_t(hierarchy->indexArray().size());
+			}
+
+			std::ofstream out(filename, std::ios::binary);
+			if (!out)
+			{
+				std::cout << "MeshCache: Couldn't write " << filename << "\n";
+				return false;
+			}
+			out.write(reinterpret_cast<const char*>(&h), sizeof(header));
+
+			const vertex* vertices = meshData.getVertices();
+			for (size_t i = 0; i < meshData.vertexCount(); ++i)
+			{
+				float v[cVERTEX_FLOATS];
+				copyVec3(v, vertices[i].position);
+				copyVec3(v + 3, vertices[i].normal);
+				v[6] = vertices[i].uv.x;
+				v[7] = vertices[i].uv.y;
+				out.write(reinterpret_cast<const char*>(v), sizeof(v));
+			}
+			const triangle* triangles = meshData.getTriangles();
+			for (size_t i = 0; i < meshData.triangleCount(); ++i)
+			{
+				uint32_t indices[3] = { uint32_t(triangles[i].v0 - vertices), uint32_t(triangles[i].v1 - vertices), uint32_t(triangles[i].v2 - vertices) };
+				out.write(reinterpret_cast<const char*>(indices), sizeof(indices));
+			}
+			if (hierarchy != nullptr)
+			{
+				for (const bvh::node& n : hierarchy->nodeArray())
+				{
+					stored_node s;
+					copyVec3(s.min, n.min);
+					s.leftFirst = n.leftFirst;
+					copyVec3(s.max, n.max);
+					s.count = n.count;
+					out.write(reinterpret_cast<const char*>(&s), sizeof(s));
+				}
+				out.write(reinterpret_cast<const char*>(hierarchy->indexArray().data()), hierarchy->indexArray().size()*sizeof(uint32_t));
+			}
+			out.write(reinterpret_cast<const char*>(octreeData.data()), octreeData.size()*sizeof(uint32_t));
+			if (!out)
+			{
+				std::cout << "MeshCache: Couldn't write " << filename << "\n";
+				return false;
+			}
+			std::cout << "MeshCache: Wrote " << filename << "\n";
+			dirty = false;
+			return true;
+		}
+	};
+}
+
+#endif
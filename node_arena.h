@@ -0,0 +1,77 @@
+#ifndef RAYTR_CORE_NODE_ARENA_H
+#define RAYTR_CORE_NODE_ARENA_H
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace Raytr_Core
+{
+	//! a bump allocator handing out contiguous runs of T from large blocks
+	/*!
+		The elements are never moved, so pointers into the arena stay valid until release(). Nothing is freed on its own -
+		release() (or the destructor) frees all the blocks at once, the destructors of the elements are never called.
+		It's not thread safe - builders running in parallel use an arena each.
+	*/
+	template<class T>
+	class node_arena
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "node_arena never calls the destructors of its elements");
+
+	private:
+		std::vector<std::unique_ptr<T[]>> blocks;
+		size_t blockSize;		//!< elements in a new block, a larger run gets a block of its own size
+		size_t lastCapacity;	//!< elements in the last block
+		size_t lastUsed;		//!< elements handed out from the last block
+		size_t capacity;		//!< elements in all the blocks
+		size_t used;			//!< elements handed out from all the blocks
+
+		node_arena(const node_arena&) = delete;
+		node_arena& operator=(const node_arena&) = delete;
+
+	public:
+		explicit node_arena(size_t blockSize = 4096)
+			: blockSize(blockSize == 0 ? 1 : blockSize), lastCapacity(0), lastUsed(0), capacity(0), used(0) {}
+
+		node_arena(node_arena&& other) = default;
+		node_arena& operator=(node_arena&& other) = default;
+
+		//! returns count adjacent default constructed elements
+		T* allocate(size_t count)
+		{
+			if (blocks.empty() || lastUsed + count > lastCapacity)
+			{
+				//the rest of the last block is wasted - the runs are small compared to the blocks
+				lastCapacity = count > blockSize ? count : blockSize;
+				blocks.push_back(std::unique_ptr<T[]>(new T[lastCapacity]()));
+				capacity += lastCapacity;
+				lastUsed = 0;
+			}
+			T* run = blocks.back().get() + lastUsed;
+			lastUsed += count;
+			used += count;
+			return run;
+		}
+
+		//! frees all the blocks, every pointer returned by allocate() becomes invalid
+		void release()
+		{
+			std::vector<std::unique_ptr<T[]>>().swap(blocks);
+			lastCapacity = lastUsed = capacity = used = 0;
+		}
+
+		//! number of elements handed out
+		size_t size() const
+		{
+			return used;
+		}
+
+		//! memory held by the blocks in bytes
+		size_t memoryUsage() const
+		{
+			return capacity*sizeof(T) + blocks.capacity()*sizeof(std::unique_ptr<T[]>);
+		}
+	};
+}
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "vec2.h"
 #include "ray.h"
+#include "aabb.h"
+#include "ray_packet.h"
 
 namespace Raytr_Core
 {
@@ -36,12 +38,49 @@ namespace Raytr_Core
 		object() : pMaterial(nullptr), center(BasicMath::vec3::zero) {}
 
 		bool virtual intersect(const ray& r, float tmin, float tmax, intersection_info& temp) const = 0;
+		//! returns true if the ray hits the object anywhere in [tmin,tmax], computes no shading data
+		bool virtual occluded(const ray& r, float tmin, float tmax) const
+		{
+			intersection_info temp;
+			return intersect(r, tmin, tmax, temp);
+		}
+		//! intersects the rays of packet selected by mask, infos[i] and packet.tmax[i] are updated for the rays hitting the object closer than tmax[i]
+		/*!
+			The default traces the rays one by one, the meshes traverse their hierarchies with the whole packet.
+		*/
+		virtual void intersectPacket(ray_packet& packet, uint64_t mask, intersection_info* infos) const
+		{
+			for (; mask != 0; mask &= mask - 1)
+			{
+				int i = ray_packet::firstRay(mask);
+				if (intersect(packet.getRay(i), packet.tmin, packet.tmax[i], infos[i]))
+					packet.tmax[i] = infos[i].t;
+			}
+		}
 		virtual float pdf_value(const BasicMath::vec3& o, const BasicMath::vec3& v) const { return 0.0f; }
 		virtual BasicMath::vec3 random(const BasicMath::vec3& o) const { return BasicMath::vec3(0, 1, 0); }
 
 		virtual float pdf_value_area() const { return 0.0f; }
 		virtual BasicMath::vec3 random_area() const { return BasicMath::vec3(0, 1, 0); }
 
+		//! picks a direction from o towards the object for a light sample, returns its solid angle pdf - 0 if it can't contribute
+		/*!
+			distance is the distance to the sampled point, a sample only counts if the light is hit there (otherwise another part
+			of the light is in front of it). The default samples the cone of directions given by random() and pdf_value()
+			around the direction to the center and sets it to 0 - any hit on the object counts.
+		*/
+		virtual float sampleDirection(const BasicMath::vec3& o, BasicMath::vec3& direction, float& distance) const
+		{
+			direction = random(o);
+			float pdf = pdf_value(o, direction);
+			direction = BasicMath::createCoordinateSystem(BasicMath::normalize(center - o))*direction;
+			distance = 0.0f;
+			return pdf;
+		}
+
+		//! fills box with the axis aligned bounds of the object, returns false if the object is unbounded
+		virtual bool bounds(bounding_volume_aabb& box) const { return false; }
+
 		material* pMaterial;
 		BasicMath::vec3 center;
 	};
@@ -1,242 +1,938 @@
 #ifndef RAYTR_CORE_OCTREE_H
 #define RAYTR_CORE_OCTREE_H
 #include "triangle_mesh.h"
+#include "high_precision_timer.h"
+#include "render_stats.h"
+#include "worker_pool.h"
+#include "node_arena.h"
 #include <vector>
+#include <algorithm>
 
 namespace Raytr_Core
 {
 
 
 	//! octree acceleration structure
+	/*!
+		The nodes live in a node_arena: the 8 children of an inner node are adjacent and the subtrees follow each other
+		in depth-first order, the triangle indices of all the leaves share one array in the same order. The tree is built
+		in scratch arenas (one per build thread) and then laid out into blocks of the exact size, so freeing it is
+		a single release().
+		compact() converts the tree to a layout of 88 byte compact_nodes, one per inner node: the boxes of the 8 children
+		are implied by the node's cell, so only the tight bounds of the triangles in them are stored, quantized to 8 bits.
+	*/
 	class octree
 	{
+	public:
+		//! a node of the tree - its box, its children or its triangles
+		struct node
+		{
+			BasicMath::vec3 min, max;	//!< corners of the node's box
+			node* children;				//!< the 8 adjacent children of an inner node, nullptr for leaves
+			const uint32_t* data;		//!< indices of a leaf's triangles in the mesh data
+			uint32_t tCount;			//!< number of triangles overlapping the node's box
+
+			bool isLeaf() const
+			{
+				return children == nullptr;
+			}
+		};
+
+		//! an inner node of the compact layout - the quantized boxes of its 8 children and where to find them
+		/*!
+			A child's box is the bounds of its triangles clipped to its cell, stored in steps of 1/255 of the node's cell,
+			the lower bounds counted from the cell's min and the upper ones from its max. A leaf child's triangle count
+			is stored in the index array right before its indices.
+		*/
+		struct compact_node
+		{
+			uint8_t qmin[3][8];		//!< per axis the lower bounds of the children's boxes
+			uint8_t qmax[3][8];		//!< per axis the upper bounds of the children's boxes
+			uint32_t child[8];		//!< the index of an inner child's compact_node, or the position of a leaf child's count in the index array
+			uint32_t tCount;		//!< number of triangles overlapping the node's cell
+			uint8_t innerMask;		//!< bit k is set if child k is an inner node
+			uint8_t emptyMask;		//!< bit k is set if child k has no triangles
+		};
+
 	private:
-		//a structure for ordering intersections
-		struct hitIndexT
+		static const int cMIN_PACKET_RAYS = 4;		//!< nodes reached by fewer rays of a packet are traversed ray by ray
+		static const int cPARALLEL_LEVELS = 4;		//!< the subtrees under the nodes of the first levels are built as separate tasks
+		static const size_t cPARALLEL_MIN_TRIANGLES = 2048;	//!< smaller subtrees are built by the task of their parent
+		static constexpr int cQUANTIZATION_STEPS = 255;	//!< steps of the quantized boxes of the compact layout
+
+		//! the nodes and leaf indices of a tree being built
+		struct build_arena
+		{
+			node_arena<node> nodes;
+			node_arena<uint32_t> indices;
+		};
+
+		node_arena<node> nodes;			//!< the nodes in depth-first order, the root first
+		node_arena<uint32_t> indices;	//!< the triangle indices of the leaves
+		node* root;
+		node_arena<compact_node> compactArena;	//!< the nodes of the compact layout, the root first
+		const compact_node* compactNodes;		//!< nullptr unless the tree is compact
+		const uint32_t* compactIndexArray;		//!< the leaves' counts and indices of the compact layout, in indices
+
+		octree(const octree&) = delete;
+		octree& operator=(const octree&) = delete;
+
+		//! maps an octant code (bit 0 - x, bit 1 - y, bit 2 - z, set for the upper half) to the index of the child node
+		static int octantToChild(int octant)
+		{
+			static const int table[8] = { 0, 1, 3, 2, 4, 5, 7, 6 };
+			return table[octant];
+		}
+
+		//! slab test against a box, returns the entry distance or cINFINITY if missed
+		static float entryDistance(const BasicMath::vec3& min, const BasicMath::vec3& max, const ray& r, const BasicMath::vec3& invDir, float tmin, float tmax)
 		{
-			float t;
-			int index;
+			float tx0 = (min.x - r.origin.x)*invDir.x, tx1 = (max.x - r.origin.x)*invDir.x;
+			float ty0 = (min.y - r.origin.y)*invDir.y, ty1 = (max.y - r.origin.y)*invDir.y;
+			float tz0 = (min.z - r.origin.z)*invDir.z, tz1 = (max.z - r.origin.z)*invDir.z;
+			float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), tmin));
+			float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tmax));
+			return tNear <= tFar ? tNear : BasicMath::cINFINITY;
+		}
 
-			hitIndexT() : t(BasicMath::cINFINITY) {}
+		//! slab test against the node's box
+		static float entryDistance(const node& n, const ray& r, const BasicMath::vec3& invDir, float tmin, float tmax)
+		{
+			return entryDistance(n.min, n.max, r, invDir, tmin, tmax);
+		}
 
-			bool operator<(const hitIndexT& other)
+		//! the cell of child c of the cell [cellMin, cellMax] - each child covers an octant
+		static void childCell(const BasicMath::vec3& cellMin, const BasicMath::vec3& cellMax, int c, BasicMath::vec3& childMin, BasicMath::vec3& childMax)
+		{
+			BasicMath::vec3 center = 0.5f*(cellMin + cellMax);
+			//the table is its own inverse - it also maps a child to its octant
+			int octant = octantToChild(c);
+			for (int k = 0; k < 3; ++k)
 			{
-				return t < other.t;
+				bool upper = (octant >> k & 1) != 0;
+				childMin[k] = upper ? center[k] : cellMin[k];
+				childMax[k] = upper ? cellMax[k] : center[k];
 			}
-		};
+		}
 
-		static inline void sort8_sorting_network_simple_swap(hitIndexT arr[8]);
-		
+		//! recursive traversal, closestSoFar is shrunk with every hit found
+		static bool intersect(const node& n, const triangle_soa_buffer& soa, const ray& r, const BasicMath::vec3& invDir, int rayOctant, float tmin,
+			float& closestSoFar, uint32_t& closestIndex, BasicMath::vec2& closestKs)
+		{
+			RAYTR_CORE_COUNT(nodeVisits, 1);
+			bool hit = false;
+			if (!n.isLeaf()) //if it's not a leaf node - check children
+			{
+				//entry distances of the ray into the children's boxes
+				float entry[8];
+				for (int i = 0; i < 8; ++i)
+				{
+					entry[i] = n.children[i].tCount == 0 ? BasicMath::cINFINITY : entryDistance(n.children[i], r, invDir, tmin, closestSoFar);
+				}
 
-	protected:
-		octree* child[8];
-		const triangle** data;
-		size_t tCount;
+				//visit the children front to back - the octants closer to the ray's origin come first
+				//a triangle can straddle several children, so a hit in one child doesn't end the traversal -
+				//only the children starting behind the closest hit so far are skipped
+				for (int k = 0; k < 8; ++k)
+				{
+					int i = octantToChild(k ^ rayOctant);
+					if (entry[i] == BasicMath::cINFINITY || entry[i] > closestSoFar)
+						continue;
+					if (intersect(n.children[i], soa, r, invDir, rayOctant, tmin, closestSoFar, closestIndex, closestKs))
+						hit = true;
+				}
+			}
+			else//if it's a leaf node - find the intersections with the triangles
+			{
+				hit = triangle_leaf_kernels::intersectIndexed(soa, n.data, n.tCount, r, tmin, closestSoFar, closestIndex, closestKs);
+			}
+			return hit;
+		}
 
-	public:
-		const bounding_volume_aabb boundingBox;
+		//! recursive traversal with the rays of packet selected by mask, the closest hits are recorded in hits
+		/*!
+			The children are visited in the order of the first ray's octant. Once fewer than cMIN_PACKET_RAYS rays
+			reach a node the packet has diverged and each of them continues with the single ray traversal.
+		*/
+		static void intersectPacket(const node& n, const triangle_soa_buffer& soa, ray_packet& packet, uint64_t mask, triangle_packet_hits& hits)
+		{
+			if (packet.missesAll(n.min, n.max, packet.maxT(mask)))
+				return;
+			mask = packet.hitMask(n.min, n.max, mask);
+			if (mask == 0)
+				return;
 
-		explicit octree(const bounding_volume_aabb& boundingBox)
-			: boundingBox(boundingBox)
-		{
-			//initialize all child nodes to nullptr
-			child[0] = nullptr;
-			child[1] = nullptr;
-			child[2] = nullptr;
-			child[3] = nullptr;
-			child[4] = nullptr;
-			child[5] = nullptr;
-			child[6] = nullptr;
-			child[7] = nullptr;
-			//initialize the current node's data to nullptr
-			data = nullptr;
-			//initialize the triangle count for the current node to 0
-			tCount = 0;
-		}
-
-		void buildOctree(const std::vector<const triangle*>& arr, int depth, size_t maxElementsCount)
-		{
-			tCount = arr.size();
+			if (ray_packet::rayCount(mask) < cMIN_PACKET_RAYS)
+			{
+				for (; mask != 0; mask &= mask - 1)
+				{
+					int i = ray_packet::firstRay(mask);
+					ray r = packet.getRay(i);
+					int rayOctant = (r.direction.x < 0 ? 1 : 0) | (r.direction.y < 0 ? 2 : 0) | (r.direction.z < 0 ? 4 : 0);
+					if (intersect(n, soa, r, packet.invDir(i), rayOctant, packet.tmin, packet.tmax[i], hits.closestIndex[i], hits.closestKs[i]))
+						hits.mask |= uint64_t(1) << i;
+				}
+				return;
+			}
+
+			RAYTR_CORE_COUNT(nodeVisits, 1);
+			if (!n.isLeaf())
+			{
+				int first = ray_packet::firstRay(mask);
+				int rayOctant = (packet.dx[first] < 0 ? 1 : 0) | (packet.dy[first] < 0 ? 2 : 0) | (packet.dz[first] < 0 ? 4 : 0);
+				for (int k = 0; k < 8; ++k)
+				{
+					int i = octantToChild(k ^ rayOctant);
+					if (n.children[i].tCount != 0)
+						intersectPacket(n.children[i], soa, packet, mask, hits);
+				}
+			}
+			else
+			{
+				for (; mask != 0; mask &= mask - 1)
+				{
+					int i = ray_packet::firstRay(mask);
+					if (triangle_leaf_kernels::intersectIndexed(soa, n.data, n.tCount, packet.getRay(i), packet.tmin, packet.tmax[i], hits.closestIndex[i], hits.closestKs[i]))
+						hits.mask |= uint64_t(1) << i;
+				}
+			}
+		}
+
+		//! recursive any hit traversal
+		static bool occluded(const node& n, const triangle_soa_buffer& soa, const ray& r, const BasicMath::vec3& invDir, float tmin, float tmax)
+		{
+			RAYTR_CORE_COUNT(nodeVisits, 1);
+			if (!n.isLeaf())
+			{
+				for (int i = 0; i < 8; ++i)
+				{
+					if (n.children[i].tCount != 0 && entryDistance(n.children[i], r, invDir, tmin, tmax) != BasicMath::cINFINITY &&
+						occluded(n.children[i], soa, r, invDir, tmin, tmax))
+						return true;
+				}
+			}
+			else
+			{
+				return triangle_leaf_kernels::occludedIndexed(soa, n.data, n.tCount, r, tmin, tmax);
+			}
+			return false;
+		}
+
+		//! creates the 8 children of n splitting its box in half along each axis
+		static void createChildren(node_arena<node>& arena, node& n)
+		{
+			n.children = arena.allocate(8);
+			for (int c = 0; c < 8; ++c)
+				childCell(n.min, n.max, c, n.children[c].min, n.children[c].max);
+		}
+
+		//! distributes arr between the children of n in a single pass - a triangle goes to every child whose box overlaps its box
+		static void partition(const node& n, const triangle* triangles, const std::vector<uint32_t>& arr, std::vector<uint32_t>* inside)
+		{
+			//child 0 is the lower half along every axis and child 6 the upper one, the other children combine their ranges
+			const node& lower = n.children[0];
+			const node& upper = n.children[6];
+			for (size_t i = 0; i < arr.size(); ++i)
+			{
+				const bounding_volume_aabb& box = triangles[arr[i]].boundingBox;
+				//bit k is set if the triangle's box overlaps the lower/upper half along axis k - the same test as intersectsAABB
+				int low = 0, high = 0;
+				for (int k = 0; k < 3; ++k)
+				{
+					if (lower.max[k] >= box.min()[k] && lower.min[k] <= box.max()[k])
+						low |= 1 << k;
+					if (upper.max[k] >= box.min()[k] && upper.min[k] <= box.max()[k])
+						high |= 1 << k;
+				}
+				for (int octant = 0; octant < 8; ++octant)
+				{
+					if ((octant & high) == octant && (~octant & 7 & low) == (~octant & 7))
+						inside[octantToChild(octant)].push_back(arr[i]);
+				}
+			}
+		}
+
+		//! makes n a leaf with the triangles in arr, or creates its children and fills inside with their triangles
+		/*!
+			Returns true if the node was split.
+		*/
+		static bool split(build_arena& arena, node& n, const triangle* triangles, const std::vector<uint32_t>& arr, int depth, size_t maxElementsCount,
+			std::vector<uint32_t>* inside)
+		{
+			n.tCount = uint32_t(arr.size());
 			//recursion's end conditions:
 			//if the depth is 0 or if the triangleCount at the node is lower than maxElementsCount
 			//stop here - leaf node - record data
-			if (depth == 0 || tCount <= maxElementsCount)
+			if (depth == 0 || n.tCount <= maxElementsCount)
 			{
+				//if it is not 0 - add the triangles' indices to the node's data
+				if (n.tCount != 0)
+				{
+					uint32_t* data = arena.indices.allocate(n.tCount);
+					std::copy(arr.begin(), arr.end(), data);
+					n.data = data;
+				}
+				return false;
+			}
+
+			//construct the children
+			createChildren(arena.nodes, n);
+
+			//for each child build a vector of the triangles that intersect the child's aabb
+			//(testing the exact triangle against the box - triangle::intersectsAABB - is faster for intersections,
+			//but much slower at tree building)
+			partition(n, triangles, arr, inside);
+			return true;
+		}
 
-				//if it is not 0
-				if (tCount != 0)
+		//! builds the subtree of n over the triangles with the indices in arr
+		static void buildNode(build_arena& arena, node& n, const triangle* triangles, const std::vector<uint32_t>& arr, int depth, size_t maxElementsCount)
+		{
+			std::vector<uint32_t> inside[8];
+			if (!split(arena, n, triangles, arr, depth, maxElementsCount, inside))
+				return;
+			//pass each child its vector and recursively continue along the tree
+			for (int k = 0; k < 8; ++k)
+				buildNode(arena, n.children[k], triangles, inside[k], depth - 1, maxElementsCount);
+		}
+
+		//! a subtree built by one task of buildOctreeParallel, the task owns the triangle list
+		struct build_task
+		{
+			node* n;
+			std::vector<uint32_t>* triangles;
+			int depth;
+			int level;
+		};
+
+		//! builds the subtree of a task in the worker's arena, spawning tasks for the big subtrees of the first cPARALLEL_LEVELS levels
+		static void runBuildTask(ThreadsDistribution::worker_pool<build_task>& pool, int worker, const build_task& task, build_arena& arena,
+			const triangle* triangles, size_t maxElementsCount)
+		{
+			std::vector<uint32_t> inside[8];
+			if (split(arena, *task.n, triangles, *task.triangles, task.depth, maxElementsCount, inside))
+			{
+				//the parent's list isn't needed anymore
+				std::vector<uint32_t>().swap(*task.triangles);
+				for (int k = 0; k < 8; ++k)
 				{
-					//add the triangles pointers to the current node's data
-					this->data = new const triangle*[tCount];
-					for (int i = 0; i < tCount; ++i)
-					{
-						data[i] = arr[i];
-					}
+					if (task.level + 1 < cPARALLEL_LEVELS && inside[k].size() >= cPARALLEL_MIN_TRIANGLES)
+						pool.spawn(worker, build_task{ task.n->children + k, new std::vector<uint32_t>(std::move(inside[k])), task.depth - 1, task.level + 1 });
+					else
+						buildNode(arena, task.n->children[k], triangles, inside[k], task.depth - 1, maxElementsCount);
 				}
-				//end recursion
+			}
+			delete task.triangles;
+		}
+
+		//! counts the nodes and the leaf indices of the subtree of n
+		static void countSubtree(const node& n, size_t& nodeCount, size_t& indexCount)
+		{
+			if (n.isLeaf())
+			{
+				indexCount += n.tCount;
 				return;
 			}
+			nodeCount += 8;
+			for (int k = 0; k < 8; ++k)
+				countSubtree(n.children[k], nodeCount, indexCount);
+		}
 
-			//construct the children
-			child[0] = new octree(bounding_volume_aabb(boundingBox.min(), 0.5*(boundingBox.min() + boundingBox.max())));
+		//! copies the subtree of src to dst, the children of dst go to nextNode followed by their subtrees in order
+		static void copySubtree(const node& src, node& dst, node*& nextNode, uint32_t*& nextIndex)
+		{
+			dst.min = src.min;
+			dst.max = src.max;
+			dst.tCount = src.tCount;
+			if (!src.isLeaf())
+			{
+				dst.children = nextNode;
+				nextNode += 8;
+				for (int k = 0; k < 8; ++k)
+					copySubtree(src.children[k], dst.children[k], nextNode, nextIndex);
+			}
+			else if (src.tCount != 0)
+			{
+				std::copy(src.data, src.data + src.tCount, nextIndex);
+				dst.data = nextIndex;
+				nextIndex += src.tCount;
+			}
+		}
 
-			child[1] = new octree(bounding_volume_aabb(BasicMath::vec3(0.5*(boundingBox.min().x+boundingBox.max().x), boundingBox.min().y, boundingBox.min().z),
-				BasicMath::vec3(boundingBox.max().x, 0.5*(boundingBox.min().y+boundingBox.max().y), 0.5*(boundingBox.min().z + boundingBox.max().z))));
+		//! replaces the tree with the one rooted at buildRoot in depth-first order, the build arenas can be released afterwards
+		void layout(const node& buildRoot)
+		{
+			size_t nodeCount = 1, indexCount = 0;
+			countSubtree(buildRoot, nodeCount, indexCount);
+			release();
+			//a single block each
+			nodes = node_arena<node>(nodeCount);
+			indices = node_arena<uint32_t>(indexCount);
+			root = nodes.allocate(nodeCount);
+			node* nextNode = root + 1;
+			uint32_t* nextIndex = indexCount != 0 ? indices.allocate(indexCount) : nullptr;
+			copySubtree(buildRoot, *root, nextNode, nextIndex);
+		}
 
-			child[2] = new octree(bounding_volume_aabb(BasicMath::vec3(0.5*(boundingBox.min().x + boundingBox.max().x), 0.5*(boundingBox.min().y + boundingBox.max().y), boundingBox.min().z),
-				BasicMath::vec3(boundingBox.max().x, boundingBox.max().y, 0.5*(boundingBox.min().z + boundingBox.max().z))));
+		//! rebuilds the subtree of n from the output of serialize(), returns the position after it or nullptr if the data is malformed
+		/*!
+			depth is how many more levels the subtree may have, like in buildNode() - deeper data is malformed too,
+			so a corrupt file can't recurse any deeper than the build would.
+		*/
+		static const uint32_t* deserialize(build_arena& arena, node& n, const uint32_t* p, const uint32_t* end, size_t triangleCount, int depth)
+		{
+			if (end - p < 2)
+				return nullptr;
+			n.tCount = p[0];
+			bool inner = p[1] != 0;
+			p += 2;
+			if (inner)
+			{
+				if (depth <= 0)
+					return nullptr;
+				createChildren(arena.nodes, n);
+				for (int k = 0; k < 8 && p != nullptr; ++k)
+					p = deserialize(arena, n.children[k], p, end, triangleCount, depth - 1);
+				return p;
+			}
+			if (n.tCount == 0)
+				return p;
+			if (size_t(end - p) < n.tCount)
+				return nullptr;
+			uint32_t* data = arena.indices.allocate(n.tCount);
+			for (size_t i = 0; i < n.tCount; ++i)
+			{
+				if (p[i] >= triangleCount)
+					return nullptr;
+				data[i] = p[i];
+			}
+			n.data = data;
+			return p + n.tCount;
+		}
 
-			child[3] = new octree(bounding_volume_aabb(BasicMath::vec3(boundingBox.min().x, 0.5*(boundingBox.min().y + boundingBox.max().y), boundingBox.min().z),
-				BasicMath::vec3(0.5*(boundingBox.min().x + boundingBox.max().x), boundingBox.max().y, 0.5*(boundingBox.min().z + boundingBox.max().z))));
+		//! appends the subtree of n to out, see serialize()
+		static void serialize(const node& n, std::vector<uint32_t>& out)
+		{
+			out.push_back(n.tCount);
+			out.push_back(n.isLeaf() ? 0 : 1);
+			if (!n.isLeaf())
+			{
+				for (int k = 0; k < 8; ++k)
+					serialize(n.children[k], out);
+			}
+			else if (n.tCount != 0)
+			{
+				out.insert(out.end(), n.data, n.data + n.tCount);
+			}
+		}
+
+		//! the size of a quantization step of the compact layout along each axis of the cell [cellMin, cellMax]
+		static BasicMath::vec3 quantizationStep(const BasicMath::vec3& cellMin, const BasicMath::vec3& cellMax)
+		{
+			return (cellMax - cellMin)*(1.0f / cQUANTIZATION_STEPS);
+		}
 
-			child[4] = new octree(bounding_volume_aabb(BasicMath::vec3(boundingBox.min().x, boundingBox.min().y, 0.5*(boundingBox.min().z + boundingBox.max().z)),
-				BasicMath::vec3(0.5*(boundingBox.min().x + boundingBox.max().x), 0.5*(boundingBox.min().y + boundingBox.max().y), boundingBox.max().z)));
+		//! the lower bound stored as q
+		static float dequantizeMin(float cellMin, float step, int q)
+		{
+			return cellMin + q*step;
+		}
+
+		//! the upper bound stored as q
+		static float dequantizeMax(float cellMax, float step, int q)
+		{
+			return cellMax - (cQUANTIZATION_STEPS - q)*step;
+		}
 
-			child[5] = new octree(bounding_volume_aabb(BasicMath::vec3(0.5*(boundingBox.min().x + boundingBox.max().x), boundingBox.min().y, 0.5*(boundingBox.min().z + boundingBox.max().z)),
-				BasicMath::vec3(boundingBox.max().x, 0.5*(boundingBox.min().y + boundingBox.max().y), boundingBox.max().z)));
+		//! the largest q whose lower bound is at most value, one step further out to be safe from a differently rounded dequantization
+		static uint8_t quantizeMin(float value, float cellMin, float step)
+		{
+			int q = step > 0 ? std::min(std::max(int((value - cellMin) / step), 0), cQUANTIZATION_STEPS) : 0;
+			while (q > 0 && dequantizeMin(cellMin, step, q) > value)
+				--q;
+			return uint8_t(q > 0 ? q - 1 : 0);
+		}
 
-			child[6] = new  octree(bounding_volume_aabb(0.5*(boundingBox.min() + boundingBox.max()), boundingBox.max()));
+		//! the smallest q whose upper bound is at least value, one step further out like quantizeMin
+		static uint8_t quantizeMax(float value, float cellMax, float step)
+		{
+			int q = step > 0 ? std::min(std::max(cQUANTIZATION_STEPS - int((cellMax - value) / step), 0), cQUANTIZATION_STEPS) : cQUANTIZATION_STEPS;
+			while (q < cQUANTIZATION_STEPS && dequantizeMax(cellMax, step, q) < value)
+				++q;
+			return uint8_t(q < cQUANTIZATION_STEPS ? q + 1 : cQUANTIZATION_STEPS);
+		}
 
-			child[7] = new octree(bounding_volume_aabb(BasicMath::vec3(boundingBox.min().x, 0.5*(boundingBox.min().y + boundingBox.max().y), 0.5*(boundingBox.min().z + boundingBox.max().z)),
-				BasicMath::vec3(0.5*(boundingBox.min().x + boundingBox.max().x), boundingBox.max().y, boundingBox.max().z)));
+		//! the box of child i of n, whose cell is [cellMin, cellMax] - dequantizeMin/Max on all the axes at once
+		static void childBox(const compact_node& n, int i, const BasicMath::vec3& cellMin, const BasicMath::vec3& cellMax, const BasicMath::vec3& step,
+			BasicMath::vec3& min, BasicMath::vec3& max)
+		{
+			min = cellMin + BasicMath::vec3(n.qmin[0][i], n.qmin[1][i], n.qmin[2][i])*step;
+			max = cellMax - BasicMath::vec3(float(cQUANTIZATION_STEPS - n.qmax[0][i]), float(cQUANTIZATION_STEPS - n.qmax[1][i]),
+				float(cQUANTIZATION_STEPS - n.qmax[2][i]))*step;
+		}
 
-			
-			//for each child build a vector of the triangles that intersect the child's aabb
+		//! counts the inner nodes and the index array entries (a count and the indices per non-empty leaf) of the subtree of n
+		static void countCompact(const node& n, size_t& innerCount, size_t& indexCount)
+		{
+			if (n.isLeaf())
+			{
+				if (n.tCount != 0)
+					indexCount += 1 + n.tCount;
+				return;
+			}
+			++innerCount;
+			for (int k = 0; k < 8; ++k)
+				countCompact(n.children[k], innerCount, indexCount);
+		}
+
+		//! fills nodes[index] from the inner node n, the inner children of a node are adjacent and follow in depth-first order
+		/*!
+			Returns the bounds of the triangles in n's cell in boundsMin and boundsMax.
+		*/
+		static void compactSubtree(const triangle* triangles, const node& n, compact_node* nodes, uint32_t index, uint32_t* indexArray,
+			uint32_t& nextNode, uint32_t& nextIndex, BasicMath::vec3& boundsMin, BasicMath::vec3& boundsMax)
+		{
+			compact_node& c = nodes[index];
+			c.tCount = n.tCount;
+			c.innerMask = c.emptyMask = 0;
+			uint32_t innerChild = nextNode;
 			for (int k = 0; k < 8; ++k)
 			{
-				std::vector<const triangle*> inside;
-				//for each triangle decide whether to add it in the child's vector
-				for (size_t i = 0; i < arr.size(); ++i)
+				if (!n.children[k].isLeaf())
+					++nextNode;
+			}
+
+			BasicMath::vec3 step = quantizationStep(n.min, n.max);
+			boundsMin = BasicMath::vec3::infinity;
+			boundsMax = -BasicMath::vec3::infinity;
+			for (int k = 0; k < 8; ++k)
+			{
+				const node& child = n.children[k];
+				BasicMath::vec3 tightMin(BasicMath::vec3::infinity), tightMax(-BasicMath::vec3::infinity);
+				if (!child.isLeaf())
 				{
-					//if the triangle aabb intersects the bounding child's aabb
-					
-					//is faster for intersections, but otherwise is much slower at tree bulding
-					/*if (arr[i]->intersectsAABB(child[k]->boundingBox))
-						inside.push_back(arr[i]);*/
-					if (child[k]->boundingBox.intersectsAABB(arr[i]->boundingBox))
-						inside.push_back(arr[i]);
-					
+					c.innerMask |= 1 << k;
+					c.child[k] = innerChild;
+					compactSubtree(triangles, child, nodes, innerChild++, indexArray, nextNode, nextIndex, tightMin, tightMax);
 				}
-				//after having built the child's vector - pass it to the child and recursvely continue along the the tree
-				
-				/*
-				//this does not work because, unless it's a pathological case
-				//where the aabb is perfectly the same as multiple triangles' aabbs
-				//(more precisely > maxElementsCount)
-				//eventually it will be subdivided as finely as to exclude some of the triangles
-				//Sure, an optimization is possible, but that would be through
-				//either correct triangle-aabb intersection
-				//or through another structure that would be useful if the tCount doesn't change
-				//over some interval of depth
-				if(inside.size()==tCount)
-					child[k]->buildOctree(inside, depth - 1, tCount);
-				else*/
-					child[k]->buildOctree(inside, depth - 1, maxElementsCount);
-			}
-		}
-
-		bool intersect(const ray& r, float tmin, float tmax, intersection_info& info) const
-		{
-			float closestSoFar = tmax;
-			if(child[0]!=nullptr) //if it's not a leaf node - check children
-			{
-				//for each child node - check whether the ray intersects its bounding box
-				int intersectionCount = 0;
-				hitIndexT intersectionInfo[8];
-				for (int i = 0; i < 8; ++i)
+				else if (child.tCount == 0)
 				{
-					float tminTemp = tmin, tmaxTemp = closestSoFar;
-					//if there's an intersection:
-					if (boundingBox.intersect(r, tminTemp, tmaxTemp))
+					c.emptyMask |= 1 << k;
+					c.child[k] = 0;
+					for (int a = 0; a < 3; ++a)
+						c.qmin[a][k] = c.qmax[a][k] = 0;
+					continue;
+				}
+				else
+				{
+					c.child[k] = nextIndex;
+					indexArray[nextIndex++] = child.tCount;
+					for (uint32_t i = 0; i < child.tCount; ++i)
 					{
-						//record intersections with node, and the distance along the ray (t) for these itnersections
-						intersectionInfo[intersectionCount].index = i;
-						intersectionInfo[intersectionCount].t = tminTemp;
-						++intersectionCount;
+						const bounding_volume_aabb& box = triangles[child.data[i]].boundingBox;
+						tightMin = BasicMath::min(tightMin, box.min());
+						tightMax = BasicMath::max(tightMax, box.max());
+						indexArray[nextIndex++] = child.data[i];
 					}
-					
 				}
-				//order the intersections by closest to furthest
-				//this fucks up things big time - need better
-				std::sort(intersectionInfo, intersectionInfo + intersectionCount);
-				//sort8_sorting_network_simple_swap(intersectionInfo);
-				//for each intersected aabb check whether the ray intersects any geometry inside
-				//if it does, return since that's the closest
-				for (int i = 0; i < intersectionCount; ++i)
+				//the triangles may stick out of the child's cell, the parts outside are found through the other cells
+				tightMin = BasicMath::max(tightMin, child.min);
+				tightMax = BasicMath::min(tightMax, child.max);
+				for (int a = 0; a < 3; ++a)
+				{
+					c.qmin[a][k] = quantizeMin(tightMin[a], n.min[a], step[a]);
+					c.qmax[a][k] = quantizeMax(tightMax[a], n.max[a], step[a]);
+				}
+				boundsMin = BasicMath::min(boundsMin, tightMin);
+				boundsMax = BasicMath::max(boundsMax, tightMax);
+			}
+		}
+
+		//! appends the subtree of the compact node index to out in the format of serialize()
+		void serializeCompact(uint32_t index, std::vector<uint32_t>& out) const
+		{
+			const compact_node& n = compactNodes[index];
+			out.push_back(n.tCount);
+			out.push_back(1);
+			for (int k = 0; k < 8; ++k)
+			{
+				if (n.innerMask >> k & 1)
+				{
+					serializeCompact(n.child[k], out);
+				}
+				else if (n.emptyMask >> k & 1)
+				{
+					out.push_back(0);
+					out.push_back(0);
+				}
+				else
 				{
-					if (child[intersectionInfo[i].index]->intersect(r, tmin, closestSoFar, info))
+					const uint32_t* leaf = compactIndexArray + n.child[k];
+					out.push_back(leaf[0]);
+					out.push_back(0);
+					out.insert(out.end(), leaf + 1, leaf + 1 + leaf[0]);
+				}
+			}
+		}
+
+		//! intersect() for the compact node index with the cell [cellMin, cellMax]
+		bool intersectCompact(uint32_t index, const BasicMath::vec3& cellMin, const BasicMath::vec3& cellMax, const triangle_soa_buffer& soa,
+			const ray& r, const BasicMath::vec3& invDir, int rayOctant, float tmin, float& closestSoFar, uint32_t& closestIndex, BasicMath::vec2& closestKs) const
+		{
+			RAYTR_CORE_COUNT(nodeVisits, 1);
+			const compact_node& n = compactNodes[index];
+			BasicMath::vec3 step = quantizationStep(cellMin, cellMax);
+			float entry[8];
+			for (int i = 0; i < 8; ++i)
+			{
+				entry[i] = BasicMath::cINFINITY;
+				if (n.emptyMask >> i & 1)
+					continue;
+				BasicMath::vec3 min, max;
+				childBox(n, i, cellMin, cellMax, step, min, max);
+				entry[i] = entryDistance(min, max, r, invDir, tmin, closestSoFar);
+			}
+
+			bool hit = false;
+			for (int k = 0; k < 8; ++k)
+			{
+				int i = octantToChild(k ^ rayOctant);
+				if (entry[i] == BasicMath::cINFINITY || entry[i] > closestSoFar)
+					continue;
+				if (n.innerMask >> i & 1)
+				{
+					BasicMath::vec3 childMin, childMax;
+					childCell(cellMin, cellMax, i, childMin, childMax);
+					if (intersectCompact(n.child[i], childMin, childMax, soa, r, invDir, rayOctant, tmin, closestSoFar, closestIndex, closestKs))
+						hit = true;
+				}
+				else
+				{
+					const uint32_t* leaf = compactIndexArray + n.child[i];
+					if (triangle_leaf_kernels::intersectIndexed(soa, leaf + 1, leaf[0], r, tmin, closestSoFar, closestIndex, closestKs))
+						hit = true;
+				}
+			}
+			return hit;
+		}
+
+		//! intersectPacket() for the compact node index with the cell [cellMin, cellMax], the rays in mask already hit the cell
+		void intersectPacketCompact(uint32_t index, const BasicMath::vec3& cellMin, const BasicMath::vec3& cellMax, const triangle_soa_buffer& soa,
+			ray_packet& packet, uint64_t mask, triangle_packet_hits& hits) const
+		{
+			RAYTR_CORE_COUNT(nodeVisits, 1);
+			const compact_node& n = compactNodes[index];
+			BasicMath::vec3 step = quantizationStep(cellMin, cellMax);
+			int first = ray_packet::firstRay(mask);
+			int rayOctant = (packet.dx[first] < 0 ? 1 : 0) | (packet.dy[first] < 0 ? 2 : 0) | (packet.dz[first] < 0 ? 4 : 0);
+			for (int k = 0; k < 8; ++k)
+			{
+				int i = octantToChild(k ^ rayOctant);
+				if (n.emptyMask >> i & 1)
+					continue;
+				BasicMath::vec3 min, max;
+				childBox(n, i, cellMin, cellMax, step, min, max);
+				if (packet.missesAll(min, max, packet.maxT(mask)))
+					continue;
+				uint64_t childMask = packet.hitMask(min, max, mask);
+				if (childMask == 0)
+					continue;
+
+				bool inner = (n.innerMask >> i & 1) != 0;
+				BasicMath::vec3 childMin, childMax;
+				if (inner)
+					childCell(cellMin, cellMax, i, childMin, childMax);
+				const uint32_t* leaf = compactIndexArray + n.child[i];
+				//the packet has diverged or reached a leaf - continue ray by ray
+				if (!inner || ray_packet::rayCount(childMask) < cMIN_PACKET_RAYS)
+				{
+					for (; childMask != 0; childMask &= childMask - 1)
 					{
-						//need to update info.pObject in the metod calling this one
-						return true;
+						int j = ray_packet::firstRay(childMask);
+						ray r = packet.getRay(j);
+						bool hit;
+						if (inner)
+						{
+							int octant = (r.direction.x < 0 ? 1 : 0) | (r.direction.y < 0 ? 2 : 0) | (r.direction.z < 0 ? 4 : 0);
+							hit = intersectCompact(n.child[i], childMin, childMax, soa, r, packet.invDir(j), octant, packet.tmin, packet.tmax[j],
+								hits.closestIndex[j], hits.closestKs[j]);
+						}
+						else
+						{
+							hit = triangle_leaf_kernels::intersectIndexed(soa, leaf + 1, leaf[0], r, packet.tmin, packet.tmax[j], hits.closestIndex[j], hits.closestKs[j]);
+						}
+						if (hit)
+							hits.mask |= uint64_t(1) << j;
 					}
 				}
+				else
+				{
+					intersectPacketCompact(n.child[i], childMin, childMax, soa, packet, childMask, hits);
+				}
 			}
-			else//if it's a leaf node - find the intersections with the triangles
+		}
+
+		//! occluded() for the compact node index with the cell [cellMin, cellMax]
+		bool occludedCompact(uint32_t index, const BasicMath::vec3& cellMin, const BasicMath::vec3& cellMax, const triangle_soa_buffer& soa,
+			const ray& r, const BasicMath::vec3& invDir, float tmin, float tmax) const
+		{
+			RAYTR_CORE_COUNT(nodeVisits, 1);
+			const compact_node& n = compactNodes[index];
+			BasicMath::vec3 step = quantizationStep(cellMin, cellMax);
+			for (int i = 0; i < 8; ++i)
 			{
-				for (size_t i = 0; i < tCount; ++i)
+				if (n.emptyMask >> i & 1)
+					continue;
+				BasicMath::vec3 min, max;
+				childBox(n, i, cellMin, cellMax, step, min, max);
+				if (entryDistance(min, max, r, invDir, tmin, tmax) == BasicMath::cINFINITY)
+					continue;
+				if (n.innerMask >> i & 1)
 				{
-					if (data[i]->intersect(r, tmin, closestSoFar, info))
-						closestSoFar = info.t;
+					BasicMath::vec3 childMin, childMax;
+					childCell(cellMin, cellMax, i, childMin, childMax);
+					if (occludedCompact(n.child[i], childMin, childMax, soa, r, invDir, tmin, tmax))
+						return true;
+				}
+				else
+				{
+					const uint32_t* leaf = compactIndexArray + n.child[i];
+					if (triangle_leaf_kernels::occludedIndexed(soa, leaf + 1, leaf[0], r, tmin, tmax))
+						return true;
 				}
 			}
+			return false;
+		}
 
-			//hit anything from the current node's geometry?
-			if (closestSoFar != tmax)
-				//need to update info.pObject in the metod calling this one
-				return true;
+		//! the root of a new tree in arena with the box of the tree
+		node* createRoot(build_arena& arena) const
+		{
+			node* n = arena.nodes.allocate(1);
+			n->min = boundingBox.min();
+			n->max = boundingBox.max();
+			return n;
+		}
 
-			return false;
+	public:
+		const bounding_volume_aabb boundingBox;
+
+		explicit octree(const bounding_volume_aabb& boundingBox)
+			: root(nullptr), compactNodes(nullptr), compactIndexArray(nullptr), boundingBox(boundingBox)
+		{
 		}
 
-		~octree()
+		//! builds the tree over the triangles with the indices in arr
+		void buildOctree(const triangle* triangles, const std::vector<uint32_t>& arr, int depth, size_t maxElementsCount)
 		{
-			if(data!=nullptr)
-				delete[] data;
+			build_arena arena;
+			node* buildRoot = createRoot(arena);
+			buildNode(arena, *buildRoot, triangles, arr, depth, maxElementsCount);
+			layout(*buildRoot);
 		}
-	};
 
-	inline void octree::sort8_sorting_network_simple_swap(hitIndexT* arr)
-	{
-#define min(x, y) (x<y?x:y)
-#define max(x, y) (x<y?y:x) 
-#define SWAP(x,y) { const hitIndexT a = min(arr[x], arr[y]);const hitIndexT b = max(arr[x], arr[y]);arr[x] = a; arr[y] = b; }
-		SWAP(0, 1); SWAP(2, 3); SWAP(4, 5); SWAP(6, 7);
-		SWAP(0, 2); SWAP(1, 3); SWAP(4, 6); SWAP(5, 7);
-		SWAP(1, 2); SWAP(5, 6); SWAP(0, 4); SWAP(3, 7);
-		SWAP(1, 5); SWAP(2, 6);
-		SWAP(1, 4); SWAP(3, 6);
-		SWAP(2, 4); SWAP(3, 5);
-		SWAP(3, 4);
-#undef SWAP
-#undef min
-#undef max
+		//! buildOctree() on numThreads threads - the subtrees of the first levels are built as tasks on a worker_pool
+		/*!
+			Every worker allocates the nodes it creates from its own arena. Builds the same tree as buildOctree().
+		*/
+		void buildOctreeParallel(const triangle* triangles, const std::vector<uint32_t>& arr, int depth, size_t maxElementsCount, int numThreads)
+		{
+			if (numThreads <= 1 || arr.size() < cPARALLEL_MIN_TRIANGLES)
+			{
+				buildOctree(triangles, arr, depth, maxElementsCount);
+				return;
+			}
+			//at most 8^level tasks per level are ever queued
+			size_t maxQueued = 1;
+			for (int level = 0; level < cPARALLEL_LEVELS; ++level)
+				maxQueued = maxQueued * 8 + 1;
+			std::vector<build_arena> arenas(numThreads);
+			node* buildRoot = createRoot(arenas[0]);
+			std::vector<build_task> tasks(1, build_task{ buildRoot, new std::vector<uint32_t>(arr), depth, 0 });
+			{
+				ThreadsDistribution::worker_pool<build_task> pool(numThreads, tasks, maxQueued,
+					[&](ThreadsDistribution::worker_pool<build_task>& workers, int worker, const build_task& task)
+				{
+					runBuildTask(workers, worker, task, arenas[worker], triangles, maxElementsCount);
+				});
+				pool.wait();
+			}
+			layout(*buildRoot);
+		}
+
+		//! appends the tree to out in pre-order: per node its triangle count and a flag set for inner nodes, then a leaf's indices or the 8 children
+		/*!
+			The boxes aren't stored - the children's boxes follow from the root's one.
+		*/
+		void serialize(std::vector<uint32_t>& out) const
+		{
+			if (compactNodes != nullptr)
+				serializeCompact(0, out);
+			else if (root != nullptr)
+				serialize(*root, out);
+		}
+
+		//! rebuilds the tree from the output of serialize(), returns the position after it or nullptr if the data is malformed
+		/*!
+			triangleCount is the number of triangles in the mesh, larger indices are rejected, and so is a tree deeper than maxDepth
+			(the depth it was built with). On failure the tree is left empty.
+		*/
+		const uint32_t* deserialize(const uint32_t* p, const uint32_t* end, size_t triangleCount, int maxDepth)
+		{
+			build_arena arena;
+			node* buildRoot = createRoot(arena);
+			p = deserialize(arena, *buildRoot, p, end, triangleCount, maxDepth);
+			if (p == nullptr)
+				release();
+			else
+				layout(*buildRoot);
+			return p;
+		}
+
+		//! frees the nodes and the triangle indices at once, the tree becomes empty
+		void release()
+		{
+			nodes.release();
+			indices.release();
+			compactArena.release();
+			root = nullptr;
+			compactNodes = nullptr;
+			compactIndexArray = nullptr;
+		}
+
+		//! converts the tree to the compact layout and frees the nodes, triangles are the ones the tree was built over
+		/*!
+			A tree whose root is a leaf stays as it is.
+		*/
+		void compact(const triangle* triangles)
+		{
+			if (root == nullptr || root->isLeaf())
+				return;
+			size_t innerCount = 0, indexCount = 0;
+			countCompact(*root, innerCount, indexCount);
+			node_arena<compact_node> compactBlock(innerCount);
+			node_arena<uint32_t> indexBlock(indexCount);
+			compact_node* compacted = compactBlock.allocate(innerCount);
+			uint32_t* indexArray = indexBlock.allocate(indexCount);
+			uint32_t nextNode = 1, nextIndex = 0;
+			BasicMath::vec3 boundsMin, boundsMax;
+			compactSubtree(triangles, *root, compacted, 0, indexArray, nextNode, nextIndex, boundsMin, boundsMax);
+
+			release();
+			compactArena = std::move(compactBlock);
+			indices = std::move(indexBlock);
+			compactNodes = compacted;
+			compactIndexArray = indexArray;
+		}
+
+		//! true if the tree uses the compact layout
+		bool isCompact() const
+		{
+			return compactNodes != nullptr;
+		}
+
+		//! the root node, nullptr if the tree is empty
+		const node* rootNode() const
+		{
+			return root;
+		}
+
+		//! number of nodes stored - only the inner ones for the compact layout
+		size_t nodeCount() const
+		{
+			return nodes.size() + compactArena.size();
+		}
+
+		//! memory used by the nodes and the index array in bytes
+		size_t memoryUsage() const
+		{
+			return nodes.memoryUsage() + compactArena.memoryUsage() + indices.memoryUsage();
+		}
+
+		//! returns the closest intersection with the triangles of mesh_data in the tree
+		bool intersect(const triangle_mesh_data& mesh_data, const ray& r, float tmin, float tmax, intersection_info& info) const
+		{
+			if (root == nullptr && compactNodes == nullptr)
+				return false;
+			BasicMath::vec3 invDir = 1.0f / r.direction;
+			//octant of the ray's direction - bit set where the direction is negative
+			int rayOctant = (r.direction.x < 0 ? 1 : 0) | (r.direction.y < 0 ? 2 : 0) | (r.direction.z < 0 ? 4 : 0);
+			float closestSoFar = tmax;
+			uint32_t closestIndex = 0;
+			BasicMath::vec2 closestKs;
+			bool hit = compactNodes != nullptr ?
+				intersectCompact(0, boundingBox.min(), boundingBox.max(), mesh_data.getIntersectionBuffer(), r, invDir, rayOctant, tmin, closestSoFar, closestIndex, closestKs) :
+				intersect(*root, mesh_data.getIntersectionBuffer(), r, invDir, rayOctant, tmin, closestSoFar, closestIndex, closestKs);
+			if (!hit)
+				return false;
+			//only the closest hit needs the shading data
+			//need to update info.pObject in the metod calling this one
+			mesh_data.getTriangles()[closestIndex].fillIntersectionInfo(r, closestSoFar, closestKs, info);
+			return true;
 		}
 
+		//! intersect() for the rays of packet selected by mask, packet.tmax is shrunk to the hits found
+		void intersectPacket(const triangle_mesh_data& mesh_data, ray_packet& packet, uint64_t mask, triangle_packet_hits& hits) const
+		{
+			if (compactNodes != nullptr)
+			{
+				mask = packet.hitMask(boundingBox.min(), boundingBox.max(), mask);
+				if (mask != 0)
+					intersectPacketCompact(0, boundingBox.min(), boundingBox.max(), mesh_data.getIntersectionBuffer(), packet, mask, hits);
+			}
+			else if (root != nullptr)
+			{
+				intersectPacket(*root, mesh_data.getIntersectionBuffer(), packet, mask, hits);
+			}
+		}
+
+		//! returns true if any triangle in the tree blocks the ray in [tmin,tmax], stops at the first one found
+		bool occluded(const triangle_mesh_data& mesh_data, const ray& r, float tmin, float tmax) const
+		{
+			if (compactNodes != nullptr)
+				return occludedCompact(0, boundingBox.min(), boundingBox.max(), mesh_data.getIntersectionBuffer(), r, 1.0f / r.direction, tmin, tmax);
+			return root != nullptr && occluded(*root, mesh_data.getIntersectionBuffer(), r, 1.0f / r.direction, tmin, tmax);
+		}
+	};
+
 	//! triangle mesh using an octree structure for faster intersections
 	class triangle_octree_mesh : public triangle_mesh
 	{
 	private:
 		octree root;
 
-		//!helper function to build the tree
-		void build(int depth, int maxElementsCount)
+		//!helper function to build the tree, on numThreads threads
+		void build(int depth, int maxElementsCount, int numThreads)
 		{
+			HighPrecisionTimer buildTimer;
 			//create the vector for the input of the octree building
-			std::vector<const triangle*> inside(mesh_data.triangleCount());
+			std::vector<uint32_t> inside(mesh_data.triangleCount());
 
 			for (size_t i = 0; i < mesh_data.triangleCount(); ++i)
 			{
-				inside[i] = &mesh_data.getTriangles()[i];
+				inside[i] = (uint32_t)i;
 			}
-			root.buildOctree(inside, depth, maxElementsCount);
+			root.buildOctreeParallel(mesh_data.getTriangles(), inside, depth, maxElementsCount, numThreads);
+			RAYTR_CORE_COUNT(octreeBuildTime, buildTimer.GetCounter());
 		}
 
 	public:
-		triangle_octree_mesh(const triangle_mesh_data& mesh_data, material* pMaterial, int depth, size_t maxElementsCount, const bounding_volume* boundingVolume=&cDefaultboundingVolume)
+		//! numThreads is how many threads the tree is built on, less than all of them if several meshes are built at once
+		triangle_octree_mesh(const triangle_mesh_data& mesh_data, material* pMaterial, int depth, size_t maxElementsCount,
+			int numThreads = ThreadsDistribution::hardwareThreads(), const bounding_volume* boundingVolume=&cDefaultboundingVolume)
 			: triangle_mesh(mesh_data, pMaterial, boundingVolume), root(mesh_data.getBoundingBox())
 		{
 			//build the tree
-			build(depth, maxElementsCount);
+			build(depth, maxElementsCount, numThreads);
+		}
+
+		//! rebuilds the tree from the output of octree::serialize (from a mesh cache), builds it with depth and maxElementsCount if the data is malformed
+		triangle_octree_mesh(const triangle_mesh_data& mesh_data, material* pMaterial, int depth, size_t maxElementsCount,
+			const uint32_t* serializedTree, size_t serializedSize, int numThreads = ThreadsDistribution::hardwareThreads(),
+			const bounding_volume* boundingVolume = &cDefaultboundingVolume)
+			: triangle_mesh(mesh_data, pMaterial, boundingVolume), root(mesh_data.getBoundingBox())
+		{
+			if (root.deserialize(serializedTree, serializedTree + serializedSize, mesh_data.triangleCount(), depth) != serializedTree + serializedSize)
+				build(depth, maxElementsCount, numThreads);
 		}
 
 		bool virtual intersect(const ray& r, float tmin, float tmax, intersection_info& info) const
@@ -253,7 +949,7 @@ namespace Raytr_Core
 				return false;
 
 			//if the ray does not intersect any of the geometry in the aabb - then there's no intersection
-			if (!root.intersect(r, tmin, tmax, info))
+			if (!root.intersect(mesh_data, r, tmin, tmax, info))
 				return false;
 
 			//does intersect - update the pObject pointer
@@ -261,6 +957,42 @@ namespace Raytr_Core
 			return true;
 		}
 
+		virtual void intersectPacket(ray_packet& packet, uint64_t mask, intersection_info* infos) const
+		{
+			mask = packetBoundingVolumeMask(packet, mask);
+			if (mask == 0)
+				return;
+
+			triangle_packet_hits hits;
+			root.intersectPacket(mesh_data, packet, mask, hits);
+			fillPacketInfos(packet, hits, infos);
+		}
+
+		bool virtual occluded(const ray& r, float tmin, float tmax) const
+		{
+			float tminTemp = tmin, tmaxTemp = tmax;
+			if (!boundingVolume->intersect(r, tminTemp, tmaxTemp))
+				return false;
+
+			tminTemp = tmin, tmaxTemp = tmax;
+			if (!root.boundingBox.intersect(r, tminTemp, tmaxTemp))
+				return false;
+
+			return root.occluded(mesh_data, r, tmin, tmax);
+		}
+
+		//! the underlying tree
+		const octree& tree() const
+		{
+			return root;
+		}
+
+		//! switches the tree to the compact layout
+		void compact()
+		{
+			root.compact(mesh_data.getTriangles());
+		}
+
 	};
 }
 
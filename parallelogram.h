@@ -34,7 +34,72 @@ namespace Raytr_Core
 
 		bool intersect(const ray& r, float tmin, float tmax, intersection_info& info) const
 		{
-			float t;
+			float t, u, v;
+			if (!hit(r, tmin, tmax, t, u, v))
+				return false;
+
+			//fill out the intersect_info structure
+			info.intersect = true;
+			info.t = t;
+			info.position = r(t);
+			info.normal = normal;
+			//calculate uv
+			info.uv = BasicMath::vec2(u, v);
+
+			info.pObject = this;
+
+			return true;
+		}
+
+		bool occluded(const ray& r, float tmin, float tmax) const
+		{
+			float t, u, v;
+			return hit(r, tmin, tmax, t, u, v);
+		}
+
+		//! solid angle subtended by parallelogram - don't feel like integrating this shit
+		virtual float pdf_value(const BasicMath::vec3& o, const BasicMath::vec3& v) const
+		{
+			return 0;
+		}
+
+		//! generate a uniformly random distributed vector towards the parallelogram - don't feel like integrating this shit
+		virtual BasicMath::vec3 random(const BasicMath::vec3& o) const
+		{
+			return BasicMath::vec3(0);
+		}
+
+		virtual float pdf_value_area() const
+		{
+			//not like this needs a G term too
+			return 1 / area;
+		}
+		virtual BasicMath::vec3 random_area() const
+		{
+			return center + e1*BasicMath::randomFloat()
+				+ e2*BasicMath::randomFloat();
+		}
+
+		virtual bool bounds(bounding_volume_aabb& box) const
+		{
+			box = bounding_volume_aabb();
+			box.addPoint(center);
+			box.addPoint(center + e1);
+			box.addPoint(center + e2);
+			box.addPoint(center + e1 + e2);
+			box.updateCenterAndHalfSize();
+			return true;
+		}
+
+		BasicMath::vec3 e1, e2;
+		BasicMath::vec3 normal;
+		float area;
+		int coordsToUse;//1-xy,2-xz,3-yz
+
+	private:
+		//! finds the ray parameter t and the parallelogram coordinates u,v of the hit, returns false if there's none
+		bool hit(const ray& r, float tmin, float tmax, float& t, float& u, float& v) const
+		{
 			// analytic solution
 			BasicMath::vec3 oc = center - r.origin;
 			float denominator = dotProduct(normal, r.direction);
@@ -51,7 +116,6 @@ namespace Raytr_Core
 			}
 
 			BasicMath::vec3 pos = r(t) - center;
-			float u,v;
 			switch (coordsToUse)
 			{
 				float det;
@@ -75,47 +139,8 @@ namespace Raytr_Core
 			if (u < 0 || u > 1 || 0 > v || v > 1)
 				return false;
 
-
-			//fill out the intersect_info structure
-			info.intersect = true;
-			info.t = t;
-			info.position = r(t);
-			info.normal = normal;
-			//calculate uv
-			info.uv = BasicMath::vec2(u, v);
-
-			info.pObject = this;
-
 			return true;
 		}
-
-		//! solid angle subtended by parallelogram - don't feel like integrating this shit
-		virtual float pdf_value(const BasicMath::vec3& o, const BasicMath::vec3& v) const
-		{
-			return 0;
-		}
-
-		//! generate a uniformly random distributed vector towards the parallelogram - don't feel like integrating this shit
-		virtual BasicMath::vec3 random(const BasicMath::vec3& o) const
-		{
-			return BasicMath::vec3(0);
-		}
-
-		virtual float pdf_value_area() const
-		{
-			//not like this needs a G term too
-			return 1 / area;
-		}
-		virtual BasicMath::vec3 random_area() const
-		{
-			return center + e1*BasicMath::uniform_distribution(BasicMath::generator)
-				+ e2*BasicMath::uniform_distribution(BasicMath::generator);
-		}
-
-		BasicMath::vec3 e1, e2;
-		BasicMath::vec3 normal;
-		float area;
-		int coordsToUse;//1-xy,2-xz,3-yz
 	};
 
 
@@ -0,0 +1,72 @@
+#ifndef BASICMATH_PCG32_H
+#define BASICMATH_PCG32_H
+#include <cstdint>
+
+namespace BasicMath
+{
+	//! A small random number generator (PCG-XSH-RR, 64 bit state, 32 bit output)
+	/*!
+		16 bytes of state, so every thread can have its own copy and reseed it cheaply for every pixel/sample.
+		Satisfies the standard UniformRandomBitGenerator requirements, so it works with the <random> distributions too.
+	*/
+	class pcg32
+	{
+	private:
+		uint64_t state;
+		uint64_t inc;		//!< selects the stream, always odd
+
+	public:
+		typedef uint32_t result_type;
+
+		pcg32()
+		{
+			seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL);
+		}
+
+		pcg32(uint64_t initState, uint64_t initSequence)
+		{
+			seed(initState, initSequence);
+		}
+
+		//! restarts the generator at initState of the stream initSequence
+		void seed(uint64_t initState, uint64_t initSequence)
+		{
+			state = 0;
+			inc = (initSequence << 1) | 1;
+			(*this)();
+			state += initState;
+			(*this)();
+		}
+
+		//! a well mixed 64 bit value from x (the splitmix64 finalizer), to turn consecutive pixel/sample indices into unrelated seeds
+		static uint64_t hash(uint64_t x)
+		{
+			x += 0x9e3779b97f4a7c15ULL;
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+			return x ^ (x >> 31);
+		}
+
+		//! returns the next 32 random bits
+		uint32_t operator()()
+		{
+			uint64_t old = state;
+			state = old * 6364136223846793005ULL + inc;
+			uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+			uint32_t rot = uint32_t(old >> 59);
+			return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+		}
+
+		//! returns a uniformly distributed float in [0,1)
+		float nextFloat()
+		{
+			//the top 24 bits fit exactly in a float's mantissa
+			return float((*this)() >> 8) * (1.0f / 16777216.0f);
+		}
+
+		static constexpr uint32_t min() { return 0; }
+		static constexpr uint32_t max() { return 0xffffffffu; }
+	};
+}
+
+#endif
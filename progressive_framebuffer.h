@@ -0,0 +1,263 @@
+#ifndef RAYTR_CORE_PROGRESSIVE_FRAMEBUFFER_H
+#define RAYTR_CORE_PROGRESSIVE_FRAMEBUFFER_H
+#include "vec3.h"
+#include "threads_distribution.h"
+#include "tigr.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace Raytr_Core
+{
+	//! converts linear intensities to gamma corrected 8 bit values with tables instead of pow
+	/*!
+		Gives exactly 255*pow(clamp(v), 0.4545) truncated, like the conversion it replaces: the tables are filled with that
+		formula when they're first used. A bucket holds the byte of the smallest float with the same top 16 bits,
+		the few thresholds between that and v are then checked one by one.
+	*/
+	class gamma_lut
+	{
+	private:
+		static const int cBUCKET_SHIFT = 16;
+		static const uint32_t cBUCKETS = (0x3F800000u >> cBUCKET_SHIFT) + 1;	//!< buckets up to 1.0f
+
+		uint8_t buckets[cBUCKETS];
+		float thresholds[256];		//!< the smallest value converted to each byte
+
+		static uint8_t convert(float v)
+		{
+			float col = std::min(std::max(std::pow(v, float(0.4545)), 0.0f), 1.0f);
+			return uint8_t(255 * col);
+		}
+
+		static float fromBits(uint32_t bits)
+		{
+			float v;
+			std::memcpy(&v, &bits, sizeof(v));
+			return v;
+		}
+
+		gamma_lut()
+		{
+			//binary search over the bit patterns of the floats in [0,1] - they're ordered like the values
+			thresholds[0] = 0.0f;
+			for (int b = 1; b < 256; ++b)
+			{
+				uint32_t low = 0, high = 0x3F800000u;
+				while (low < high)
+				{
+					uint32_t mid = low + (high - low) / 2;
+					if (convert(fromBits(mid)) >= b)
+						high = mid;
+					else
+						low = mid + 1;
+				}
+				thresholds[b] = fromBits(low);
+			}
+			for (uint32_t i = 0; i < cBUCKETS; ++i)
+				buckets[i] = convert(fromBits(i << cBUCKET_SHIFT));
+		}
+
+	public:
+		//! the table shared by everything, built on the first call
+		static const gamma_lut& instance()
+		{
+			static const gamma_lut lut;
+			return lut;
+		}
+
+		uint8_t operator()(float v) const
+		{
+			//also catches nan
+			if (!(v > 0.0f))
+				return 0;
+			if (v >= 1.0f)
+				return 255;
+			uint32_t bits;
+			std::memcpy(&bits, &v, sizeof(bits));
+			int b = buckets[bits >> cBUCKET_SHIFT];
+			while (b < 255 && v >= thresholds[b + 1])
+				++b;
+			return uint8_t(b);
+		}
+	};
+
+	//! the per-pixel running sums and sample counts of a progressive render, shown tile by tile
+	/*!
+		Every pixel is written only by the thread rendering its tile, which calls commitTile() after each pass over it.
+		present() runs on the display thread at its own pace and tone maps only the tiles committed since it last ran,
+		so showing the image doesn't cost a pass over it per sample. The values are stored in relaxed atomics, so a tile can
+		be read while its next pass is being written without locks - a pixel caught in the middle of an update is at most
+		one sample off until the tile is presented again.
+		For adaptive sampling the buffer also keeps the squared luminance of the samples, the tile's thread uses it to stop
+		sampling the pixels whose mean is known well enough (see updateConvergence()).
+	*/
+	class progressive_framebuffer
+	{
+	private:
+		int width, height;
+		std::unique_ptr<std::atomic<float>[]> sums;		//!< 3 per pixel
+		std::unique_ptr<std::atomic<uint32_t>[]> counts;	//!< samples per pixel
+		std::vector<ThreadsDistribution::rectangle> tiles;
+		std::unique_ptr<std::atomic<uint32_t>[]> tileVersions;	//!< passes committed per tile
+		std::vector<uint32_t> presentedVersions;			//!< the tile versions present() last converted, only used by the display thread
+		std::vector<float> luminanceSquares;				//!< the sums of the squared luminance of the samples, only used by the tiles' threads
+		std::vector<uint8_t> converged;						//!< the pixels that don't need more samples, only used by the tiles' threads
+
+		//! the luminance of a linear rgb color
+		static float luminance(const BasicMath::vec3& col)
+		{
+			return 0.2126f*col.x + 0.7152f*col.y + 0.0722f*col.z;
+		}
+
+		progressive_framebuffer(const progressive_framebuffer&) = delete;
+		progressive_framebuffer& operator=(const progressive_framebuffer&) = delete;
+
+		//! tone maps the pixels of rect into bmp
+		void toneMap(Tigr* bmp, const ThreadsDistribution::rectangle& rect) const
+		{
+			const gamma_lut& lut = gamma_lut::instance();
+			for (int y = rect.pos.y; y < rect.size.y + rect.pos.y; ++y)
+			{
+				for (int x = rect.pos.x; x < rect.size.x + rect.pos.x; ++x)
+				{
+					BasicMath::vec3 col = average(x, y);
+					TPixel& pixel = bmp->pix[y*bmp->w + x];
+					pixel.r = lut(col.x);
+					pixel.g = lut(col.y);
+					pixel.b = lut(col.z);
+				}
+			}
+		}
+
+	public:
+		//! a framebuffer of width x height pixels shown in the given tiles, all the sums and counts start at 0
+		progressive_framebuffer(int width, int height, const std::vector<ThreadsDistribution::rectangle>& tiles)
+			: width(width), height(height), sums(new std::atomic<float>[3 * size_t(width)*height]), counts(new std::atomic<uint32_t>[size_t(width)*height]),
+			tiles(tiles), tileVersions(new std::atomic<uint32_t>[tiles.size()]), presentedVersions(tiles.size(), 0),
+			luminanceSquares(size_t(width)*height, 0.0f), converged(size_t(width)*height, 0)
+		{
+			for (size_t i = 0; i < 3 * size_t(width)*height; ++i)
+				sums[i].store(0.0f, std::memory_order_relaxed);
+			for (size_t i = 0; i < size_t(width)*height; ++i)
+				counts[i].store(0, std::memory_order_relaxed);
+			for (size_t i = 0; i < tiles.size(); ++i)
+				tileVersions[i].store(0, std::memory_order_relaxed);
+		}
+
+		//! adds one more sample to a pixel, only the thread rendering the pixel's tile may call it
+		void addSample(int x, int y, const BasicMath::vec3& sample)
+		{
+			size_t i = size_t(y)*width + x;
+			float sampleLuminance = luminance(sample);
+			luminanceSquares[i] += sampleLuminance*sampleLuminance;
+			//only this thread writes the pixel, so the sums don't need an atomic add
+			sums[3 * i].store(sums[3 * i].load(std::memory_order_relaxed) + sample.x, std::memory_order_relaxed);
+			sums[3 * i + 1].store(sums[3 * i + 1].load(std::memory_order_relaxed) + sample.y, std::memory_order_relaxed);
+			sums[3 * i + 2].store(sums[3 * i + 2].load(std::memory_order_relaxed) + sample.z, std::memory_order_relaxed);
+			counts[i].store(counts[i].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+
+		//! marks a pass over a tile as done, present() converts it the next time
+		void commitTile(int tile)
+		{
+			tileVersions[tile].fetch_add(1, std::memory_order_release);
+		}
+
+		//! the running sum of a pixel
+		BasicMath::vec3 sum(int x, int y) const
+		{
+			size_t i = size_t(y)*width + x;
+			return BasicMath::vec3(sums[3 * i].load(std::memory_order_relaxed), sums[3 * i + 1].load(std::memory_order_relaxed),
+				sums[3 * i + 2].load(std::memory_order_relaxed));
+		}
+
+		uint32_t sampleCount(int x, int y) const
+		{
+			return counts[size_t(y)*width + x].load(std::memory_order_relaxed);
+		}
+
+		//! the mean of the samples of a pixel, 0 before the first one
+		BasicMath::vec3 average(int x, int y) const
+		{
+			uint32_t count = sampleCount(x, y);
+			return count == 0 ? BasicMath::vec3(0) : sum(x, y) / float(count);
+		}
+
+		//! the estimated standard error of a pixel's mean luminance relative to the mean, infinite before the second sample
+		/*!
+			The mean is clamped to the displayable range, so the error of a bright pixel is measured against white,
+			and a pixel darker than cDARK_LUMINANCE is measured against that - its noise wouldn't be visible.
+		*/
+		float relativeError(int x, int y) const
+		{
+			static const float cDARK_LUMINANCE = 0.01f;
+			uint32_t count = sampleCount(x, y);
+			if (count < 2)
+				return std::numeric_limits<float>::infinity();
+			float n = float(count);
+			float mean = luminance(sum(x, y)) / n;
+			float variance = std::max(luminanceSquares[size_t(y)*width + x] / n - mean*mean, 0.0f)*n / (n - 1);
+			return std::sqrt(variance / n) / std::min(std::max(mean, cDARK_LUMINANCE), 1.0f);
+		}
+
+		//! true once updateConvergence() stopped sampling the pixel, the render_tile functions skip it
+		bool isConverged(int x, int y) const
+		{
+			return converged[size_t(y)*width + x] != 0;
+		}
+
+		//! stops sampling the pixels of rect whose relativeError() is below threshold, returns how many still need samples
+		/*!
+			Only the thread rendering the tile may call it, between its passes.
+		*/
+		int updateConvergence(const ThreadsDistribution::rectangle& rect, float threshold)
+		{
+			int active = 0;
+			for (int y = rect.pos.y; y < rect.size.y + rect.pos.y; ++y)
+			{
+				for (int x = rect.pos.x; x < rect.size.x + rect.pos.x; ++x)
+				{
+					uint8_t& done = converged[size_t(y)*width + x];
+					if (!done && relativeError(x, y) < threshold)
+						done = 1;
+					active += done ? 0 : 1;
+				}
+			}
+			return active;
+		}
+
+		//! tone maps the tiles committed since the last call into bmp, returns how many there were
+		int present(Tigr* bmp)
+		{
+			int presented = 0;
+			for (size_t t = 0; t < tiles.size(); ++t)
+			{
+				uint32_t version = tileVersions[t].load(std::memory_order_acquire);
+				if (version == presentedVersions[t])
+					continue;
+				presentedVersions[t] = version;
+				toneMap(bmp, tiles[t]);
+				++presented;
+			}
+			return presented;
+		}
+
+		int getWidth() const
+		{
+			return width;
+		}
+
+		int getHeight() const
+		{
+			return height;
+		}
+	};
+}
+
+#endif
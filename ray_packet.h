@@ -0,0 +1,203 @@
+#ifndef RAYTR_CORE_RAY_PACKET_H
+#define RAYTR_CORE_RAY_PACKET_H
+#include "ray.h"
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RAYTR_CORE_PACKET_SSE
+#include <emmintrin.h>
+#endif
+
+namespace Raytr_Core
+{
+	//! Up to 64 coherent rays traced together, stored as arrays so the box tests run on 4 rays at a time
+	/*!
+		Made for the camera rays of a block of pixels. A set of rays is selected by a 64 bit mask (bit i - ray i).
+		Besides the per ray tests the packet keeps the ranges of its origins and inverse directions, which give a cheap
+		conservative test (interval arithmetic) rejecting a box none of the rays can hit, before any of the rays are tested.
+		tmax[i] is the closest hit of ray i so far, the traversals shrink it.
+	*/
+	class ray_packet
+	{
+	public:
+		static const int cMAX_RAYS = 64;
+
+		alignas(16) float ox[cMAX_RAYS], oy[cMAX_RAYS], oz[cMAX_RAYS];
+		alignas(16) float dx[cMAX_RAYS], dy[cMAX_RAYS], dz[cMAX_RAYS];
+		alignas(16) float idx[cMAX_RAYS], idy[cMAX_RAYS], idz[cMAX_RAYS];	//!< inverse directions
+		alignas(16) float tmax[cMAX_RAYS];
+		float tmin;
+		int count;
+
+	private:
+		BasicMath::vec3 originMin, originMax, invDirMin, invDirMax;
+		bool coherent;		//!< the directions have the same signs and finite inverses, so the interval test is valid
+
+		//! [lo,hi] = [a0,a1]*[b0,b1]
+		static void intervalProduct(float a0, float a1, float b0, float b1, float& lo, float& hi)
+		{
+			float p0 = a0*b0, p1 = a0*b1, p2 = a1*b0, p3 = a1*b1;
+			lo = std::min(std::min(p0, p1), std::min(p2, p3));
+			hi = std::max(std::max(p0, p1), std::max(p2, p3));
+		}
+
+	public:
+		ray_packet() : tmin(0.0f), count(0), coherent(false) {}
+
+		//! empties the packet, the rays added next are tested from tmin
+		void reset(float tmin)
+		{
+			this->tmin = tmin;
+			count = 0;
+		}
+
+		//! adds a ray with the interval [tmin, tmax], returns its index
+		int add(const ray& r, float tmax)
+		{
+			int i = count++;
+			ox[i] = r.origin.x; oy[i] = r.origin.y; oz[i] = r.origin.z;
+			dx[i] = r.direction.x; dy[i] = r.direction.y; dz[i] = r.direction.z;
+			//the same inverse the single ray traversals use
+			BasicMath::vec3 invDir = 1.0f / r.direction;
+			idx[i] = invDir.x; idy[i] = invDir.y; idz[i] = invDir.z;
+			this->tmax[i] = tmax;
+			return i;
+		}
+
+		//! computes the ranges for the interval test and pads the arrays to a multiple of 4 with rays that hit nothing, call after adding the rays
+		void finalize()
+		{
+			originMin = originMax = BasicMath::vec3(ox[0], oy[0], oz[0]);
+			invDirMin = invDirMax = BasicMath::vec3(idx[0], idy[0], idz[0]);
+			coherent = count > 0;
+			for (int i = 0; i < count; ++i)
+			{
+				BasicMath::vec3 o(ox[i], oy[i], oz[i]), id(idx[i], idy[i], idz[i]);
+				originMin = BasicMath::min(originMin, o);
+				originMax = BasicMath::max(originMax, o);
+				invDirMin = BasicMath::min(invDirMin, id);
+				invDirMax = BasicMath::max(invDirMax, id);
+				if (!std::isfinite(id.x) || !std::isfinite(id.y) || !std::isfinite(id.z))
+					coherent = false;
+			}
+			//the signs of each component have to agree
+			for (int k = 0; k < 3; ++k)
+			{
+				if (invDirMin[k] < 0.0f && invDirMax[k] > 0.0f)
+					coherent = false;
+			}
+			for (int i = count; i % 4 != 0; ++i)
+			{
+				ox[i] = oy[i] = oz[i] = dx[i] = dy[i] = dz[i] = idx[i] = idy[i] = idz[i] = 0.0f;
+				tmax[i] = -BasicMath::cINFINITY;
+			}
+		}
+
+		//! mask with a bit for every ray
+		uint64_t allRays() const
+		{
+			return count == cMAX_RAYS ? ~uint64_t(0) : (uint64_t(1) << count) - 1;
+		}
+
+		ray getRay(int i) const
+		{
+			return ray(BasicMath::vec3(ox[i], oy[i], oz[i]), BasicMath::vec3(dx[i], dy[i], dz[i]));
+		}
+
+		BasicMath::vec3 invDir(int i) const
+		{
+			return BasicMath::vec3(idx[i], idy[i], idz[i]);
+		}
+
+		//! true if no ray of the packet can enter the box before the largest tmax, conservative - false doesn't mean a hit
+		bool missesAll(const BasicMath::vec3& boxMin, const BasicMath::vec3& boxMax, float maxT) const
+		{
+			if (!coherent)
+				return false;
+			float tNear = tmin, tFar = maxT;
+			for (int k = 0; k < 3; ++k)
+			{
+				//the entry plane is the min one for positive directions
+				bool positive = invDirMin[k] >= 0.0f;
+				float entryPlane = positive ? boxMin[k] : boxMax[k], exitPlane = positive ? boxMax[k] : boxMin[k];
+				float lo, hi;
+				intervalProduct(entryPlane - originMax[k], entryPlane - originMin[k], invDirMin[k], invDirMax[k], lo, hi);
+				tNear = std::max(tNear, lo);
+				intervalProduct(exitPlane - originMax[k], exitPlane - originMin[k], invDirMin[k], invDirMax[k], lo, hi);
+				tFar = std::min(tFar, hi);
+			}
+			return tNear > tFar;
+		}
+
+		//! the rays of mask entering the box before their tmax
+		uint64_t hitMask(const BasicMath::vec3& boxMin, const BasicMath::vec3& boxMax, uint64_t mask) const
+		{
+			uint64_t result = 0;
+#ifdef RAYTR_CORE_PACKET_SSE
+			__m128 minX = _mm_set1_ps(boxMin.x), minY = _mm_set1_ps(boxMin.y), minZ = _mm_set1_ps(boxMin.z);
+			__m128 maxX = _mm_set1_ps(boxMax.x), maxY = _mm_set1_ps(boxMax.y), maxZ = _mm_set1_ps(boxMax.z);
+			__m128 t0 = _mm_set1_ps(tmin);
+			for (int i = 0; i < count; i += 4)
+			{
+				if (((mask >> i) & 0xF) == 0)
+					continue;
+				__m128 tx0 = _mm_mul_ps(_mm_sub_ps(minX, _mm_load_ps(ox + i)), _mm_load_ps(idx + i));
+				__m128 tx1 = _mm_mul_ps(_mm_sub_ps(maxX, _mm_load_ps(ox + i)), _mm_load_ps(idx + i));
+				__m128 ty0 = _mm_mul_ps(_mm_sub_ps(minY, _mm_load_ps(oy + i)), _mm_load_ps(idy + i));
+				__m128 ty1 = _mm_mul_ps(_mm_sub_ps(maxY, _mm_load_ps(oy + i)), _mm_load_ps(idy + i));
+				__m128 tz0 = _mm_mul_ps(_mm_sub_ps(minZ, _mm_load_ps(oz + i)), _mm_load_ps(idz + i));
+				__m128 tz1 = _mm_mul_ps(_mm_sub_ps(maxZ, _mm_load_ps(oz + i)), _mm_load_ps(idz + i));
+				__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), t0));
+				__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_load_ps(tmax + i)));
+				result |= uint64_t(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar))) << i;
+			}
+#else
+			for (int i = 0; i < count; ++i)
+			{
+				if (!((mask >> i) & 1))
+					continue;
+				float tx0 = (boxMin.x - ox[i])*idx[i], tx1 = (boxMax.x - ox[i])*idx[i];
+				float ty0 = (boxMin.y - oy[i])*idy[i], ty1 = (boxMax.y - oy[i])*idy[i];
+				float tz0 = (boxMin.z - oz[i])*idz[i], tz1 = (boxMax.z - oz[i])*idz[i];
+				float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), tmin));
+				float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tmax[i]));
+				if (tNear <= tFar)
+					result |= uint64_t(1) << i;
+			}
+#endif
+			return result & mask;
+		}
+
+		//! the largest tmax of the rays in mask
+		float maxT(uint64_t mask) const
+		{
+			float result = -BasicMath::cINFINITY;
+			for (int i = 0; i < count; ++i)
+			{
+				if ((mask >> i) & 1)
+					result = std::max(result, tmax[i]);
+			}
+			return result;
+		}
+
+		//! index of the lowest ray in a non empty mask
+		static int firstRay(uint64_t mask)
+		{
+			int i = 0;
+			while (!((mask >> i) & 1))
+				++i;
+			return i;
+		}
+
+		static int rayCount(uint64_t mask)
+		{
+			int n = 0;
+			for (; mask; mask &= mask - 1)
+				++n;
+			return n;
+		}
+	};
+}
+
+#endif
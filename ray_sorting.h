@@ -0,0 +1,63 @@
+#ifndef RAYTR_CORE_RAY_SORTING_H
+#define RAYTR_CORE_RAY_SORTING_H
+#include "ray.h"
+#include "aabb.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Raytr_Core
+{
+	//! Reorders rays so that the rays traced one after another start close to each other and point the same way
+	/*!
+		The key of a ray is the octant of its direction followed by the morton code of its origin in a box (9 bits per axis),
+		so rays going the same way from neighbouring points are traced together and visit the same nodes while they're in the cache.
+	*/
+	class ray_sorting
+	{
+	private:
+		//! spreads the lower 9 bits of v so there are 2 zero bits between each two of them
+		static uint32_t expandBits(uint32_t v)
+		{
+			v &= 0x1ff;
+			v = (v | (v << 16)) & 0x030000ff;
+			v = (v | (v << 8)) & 0x0300f00f;
+			v = (v | (v << 4)) & 0x030c30c3;
+			v = (v | (v << 2)) & 0x09249249;
+			return v;
+		}
+
+		//! the cell of x in [lo,hi] split into 512 cells, clamped
+		static uint32_t cell(float x, float lo, float hi)
+		{
+			float f = hi > lo ? (x - lo) / (hi - lo) : 0.0f;
+			return uint32_t(std::min(std::max(f*512.0f, 0.0f), 511.0f));
+		}
+
+	public:
+		//! 3 bits of direction octant and 27 bits of the morton code of the origin in bounds (points outside are clamped to it)
+		static uint32_t key(const ray& r, const bounding_volume_aabb& bounds)
+		{
+			uint32_t octant = (r.direction.x < 0.0f ? 1 : 0) | (r.direction.y < 0.0f ? 2 : 0) | (r.direction.z < 0.0f ? 4 : 0);
+			uint32_t morton = (expandBits(cell(r.origin.x, bounds.min().x, bounds.max().x)) << 2) |
+				(expandBits(cell(r.origin.y, bounds.min().y, bounds.max().y)) << 1) |
+				expandBits(cell(r.origin.z, bounds.min().z, bounds.max().z));
+			return (octant << 27) | morton;
+		}
+
+		//! sorts indices by the keys of the rays rayOf(index), scratch is reused between the calls to avoid allocations
+		template<class RayOf>
+		static void sort(std::vector<uint32_t>& indices, const bounding_volume_aabb& bounds, RayOf rayOf, std::vector<uint64_t>& scratch)
+		{
+			scratch.resize(indices.size());
+			//the key and the index packed together, so the sort moves single integers
+			for (size_t i = 0; i < indices.size(); ++i)
+				scratch[i] = (uint64_t(key(rayOf(indices[i]), bounds)) << 32) | indices[i];
+			std::sort(scratch.begin(), scratch.end());
+			for (size_t i = 0; i < indices.size(); ++i)
+				indices[i] = uint32_t(scratch[i]);
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef RAYTR_CORE_RENDER_STATS_H
+#define RAYTR_CORE_RENDER_STATS_H
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace Raytr_Core
+{
+	//! counters of the work done by the tracing code
+	struct render_counters
+	{
+		uint64_t cameraRays;		//!< primary rays
+		uint64_t shadowRays;		//!< rays towards the light sources
+		uint64_t bounceRays;		//!< scattered rays
+		uint64_t nodeVisits;		//!< octree and bvh nodes visited
+		uint64_t triangleTests;		//!< triangles in the leaves visited (the occlusion tests can stop before the end of a leaf)
+		double octreeBuildTime;		//!< seconds spent building octrees
+		double bvhBuildTime;		//!< seconds spent building bvhs
+
+		render_counters() : cameraRays(0), shadowRays(0), bounceRays(0), nodeVisits(0), triangleTests(0),
+			octreeBuildTime(0.0), bvhBuildTime(0.0)
+		{}
+
+		uint64_t rays() const
+		{
+			return cameraRays + shadowRays + bounceRays;
+		}
+
+		render_counters& operator+=(const render_counters& other)
+		{
+			cameraRays += other.cameraRays;
+			shadowRays += other.shadowRays;
+			bounceRays += other.bounceRays;
+			nodeVisits += other.nodeVisits;
+			triangleTests += other.triangleTests;
+			octreeBuildTime += other.octreeBuildTime;
+			bvhBuildTime += other.bvhBuildTime;
+			return *this;
+		}
+
+		render_counters& operator-=(const render_counters& other)
+		{
+			cameraRays -= other.cameraRays;
+			shadowRays -= other.shadowRays;
+			bounceRays -= other.bounceRays;
+			nodeVisits -= other.nodeVisits;
+			triangleTests -= other.triangleTests;
+			octreeBuildTime -= other.octreeBuildTime;
+			bvhBuildTime -= other.bvhBuildTime;
+			return *this;
+		}
+	};
+
+	//! Per thread render_counters, merged on demand
+	/*!
+		Every thread increments its own counters without any synchronization (see RAYTR_CORE_COUNT).
+		A thread's counters are registered on its first count and added to a common total when the thread exits,
+		so collect() is exact for the threads that are done - it should be called after the render threads are joined.
+		Define RAYTR_CORE_NO_STATS to compile the counting out.
+	*/
+	class render_stats
+	{
+	private:
+		struct registry
+		{
+			std::mutex lock;
+			std::vector<const render_counters*> live;	//!< counters of the running threads
+			render_counters retired;					//!< sum of the counters of the threads that exited
+		};
+
+		static registry& instance()
+		{
+			static registry r;
+			return r;
+		}
+
+		//! the counters of a thread, plain data so the accesses don't need the guards of a thread_local with a constructor
+		struct thread_counters
+		{
+			render_counters counters;
+			bool registered;
+		};
+
+		static thread_counters& threadCounters()
+		{
+			static thread_local thread_counters t;
+			return t;
+		}
+
+		//! registers the thread's counters, they're added to the retired total when the thread exits
+		static void registerThread()
+		{
+			struct exit_hook
+			{
+				exit_hook()
+				{
+					registry& r = instance();
+					std::lock_guard<std::mutex> guard(r.lock);
+					r.live.push_back(&threadCounters().counters);
+				}
+
+				~exit_hook()
+				{
+					registry& r = instance();
+					std::lock_guard<std::mutex> guard(r.lock);
+					r.retired += threadCounters().counters;
+					r.live.erase(std::find(r.live.begin(), r.live.end(), &threadCounters().counters));
+				}
+			};
+			static thread_local exit_hook hook;
+			threadCounters().registered = true;
+		}
+
+	public:
+		//! the counters of the calling thread
+		static render_counters& local()
+		{
+			thread_counters& t = threadCounters();
+			if (!t.registered)
+				registerThread();
+			return t.counters;
+		}
+
+		//! the sum of the counters of all the threads so far
+		static render_counters collect()
+		{
+			registry& r = instance();
+			std::lock_guard<std::mutex> guard(r.lock);
+			render_counters total = r.retired;
+			for (const render_counters* c : r.live)
+				total += *c;
+			return total;
+		}
+
+		//! prints rays/s and the work done per ray, counters should hold the difference over the timed period
+		static void report(const render_counters& counters, double seconds)
+		{
+			uint64_t rays = counters.rays();
+			double perRay = rays == 0 ? 0.0 : 1.0 / double(rays);
+			std::cout << "Rays: " << rays << " (camera " << counters.cameraRays << ", shadow " << counters.shadowRays
+				<< ", bounce " << counters.bounceRays << ") in " << seconds << "s, " << (seconds > 0.0 ? rays / seconds*1e-6 : 0.0) << " Mrays/s\n";
+			std::cout << "Per ray: " << counters.nodeVisits*perRay << " node visits, " << counters.triangleTests*perRay << " triangle tests\n";
+			std::cout << "Build times: octree " << counters.octreeBuildTime << "s, bvh " << counters.bvhBuildTime << "s\n";
+		}
+	};
+}
+
+//! adds n to the calling thread's counter (a render_counters member)
+#ifdef RAYTR_CORE_NO_STATS
+#define RAYTR_CORE_COUNT(counter, n) ((void)0)
+#else
+#define RAYTR_CORE_COUNT(counter, n) (Raytr_Core::render_stats::local().counter += (n))
+#endif
+
+#endif
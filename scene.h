@@ -2,26 +2,108 @@
 #define RAYTR_CORE_SCENE_H
 #include <vector>
 #include "object.h"
+#include "bvh.h"
+#include "light_sampler.h"
 
 namespace Raytr_Core
 {
 
 	//! A scene class
+	/*!
+		After all the objects are added buildAccelerationStructure() builds a bvh over the bounded objects,
+		the unbounded ones (planes) are still tested one by one.
+		Until it is called the scene intersects all of its objects linearly.
+		It also collects the emitters into the light_sampler the light samples pick their light from.
+	*/
 	class scene
 	{
+	private:
+		bvh topLevel;						//!< bvh over the bounds of boundedObjects
+		std::vector<object*> boundedObjects;	//!< objects referenced by the leaves of topLevel
+		std::vector<object*> unboundedObjects;	//!< objects without finite bounds
+		light_sampler lightSampler;				//!< the emitters among the objects
+		bool accelerated;
+
 	public:
+		scene() : accelerated(false) {}
+
 		scene& addObject(object* op)
 		{
 			objects.push_back(op);
+			//the structure no longer contains all of the objects
+			accelerated = false;
 			return *this;
 		}
 
+		//! builds the top level bvh over the objects' bounds and the light sampler over the emitters
+		void buildAccelerationStructure()
+		{
+			lightSampler.build(objects);
+			boundedObjects.clear();
+			unboundedObjects.clear();
+			std::vector<BasicMath::vec3> mins, maxs;
+			bounding_volume_aabb box;
+			for (object* iter : objects)
+			{
+				if (iter->bounds(box))
+				{
+					//pad the box so flat objects (parallelograms) don't end up with a zero thickness slab
+					BasicMath::vec3 pad = (box.max() - box.min())*1e-4f + BasicMath::vec3::epsilon;
+					mins.push_back(box.min() - pad);
+					maxs.push_back(box.max() + pad);
+					boundedObjects.push_back(iter);
+				}
+				else
+				{
+					unboundedObjects.push_back(iter);
+				}
+			}
+			topLevel.build(mins.data(), maxs.data(), mins.size(), 1);
+			accelerated = true;
+		}
+
+		//! picks the lights for the light samples, valid after buildAccelerationStructure()
+		const light_sampler& lights() const
+		{
+			return lightSampler;
+		}
+
+		//! the bounds of the objects with finite bounds, valid after buildAccelerationStructure()
+		bounding_volume_aabb boundingBox() const
+		{
+			return topLevel.boundingBox();
+		}
 
 		bool intersect(const ray& r, float tmin, float tmax, intersection_info& info) const
 		{
 			info.intersect = false;
 			float closest_so_far = tmax;
-			for (object* iter : objects)
+			if (!accelerated)
+			{
+				for (object* iter : objects)
+				{
+					if (iter->intersect(r, tmin, closest_so_far, info))
+					{
+						closest_so_far = info.t;
+					}
+				}
+				return info.intersect;
+			}
+
+			topLevel.traverse(r, tmin, closest_so_far, [&](const uint32_t* leaf, uint32_t count, float& closest)
+			{
+				bool hit = false;
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					if (boundedObjects[leaf[i]]->intersect(r, tmin, closest, info))
+					{
+						closest = info.t;
+						hit = true;
+					}
+				}
+				return hit;
+			});
+			for (object* iter : unboundedObjects)
 			{
 				if (iter->intersect(r, tmin, closest_so_far, info))
 				{
@@ -31,6 +113,58 @@ namespace Raytr_Core
 			return info.intersect;
 		}
 
+		//! intersect() for all the rays of the packet, infos[i] is the closest hit of ray i
+		void intersectPacket(ray_packet& packet, intersection_info* infos) const
+		{
+			for (int i = 0; i < packet.count; ++i)
+				infos[i].intersect = false;
+			if (!accelerated)
+			{
+				for (object* iter : objects)
+					iter->intersectPacket(packet, packet.allRays(), infos);
+				return;
+			}
+
+			topLevel.traversePacket(packet, packet.allRays(), [&](const uint32_t* leaf, uint32_t count, uint64_t rayMask)
+			{
+				for (uint32_t i = 0; i < count; ++i)
+					boundedObjects[leaf[i]]->intersectPacket(packet, rayMask, infos);
+			});
+			for (object* iter : unboundedObjects)
+				iter->intersectPacket(packet, packet.allRays(), infos);
+		}
+
+		//! returns true if anything blocks the ray in [tmin,tmax], stops at the first blocker found
+		bool occluded(const ray& r, float tmin, float tmax) const
+		{
+			if (!accelerated)
+			{
+				for (object* iter : objects)
+				{
+					if (iter->occluded(r, tmin, tmax))
+						return true;
+				}
+				return false;
+			}
+
+			if (topLevel.occluded(r, tmin, tmax, [&](const uint32_t* leaf, uint32_t count)
+				{
+					for (uint32_t i = 0; i < count; ++i)
+					{
+						if (boundedObjects[leaf[i]]->occluded(r, tmin, tmax))
+							return true;
+					}
+					return false;
+				}))
+				return true;
+			for (object* iter : unboundedObjects)
+			{
+				if (iter->occluded(r, tmin, tmax))
+					return true;
+			}
+			return false;
+		}
+
 		~scene()
 		{
 			for (size_t k = 0; k < objects.size(); ++k)
@@ -5,12 +5,21 @@
 #include "scene.h"
 #include "sphere.h"
 #include "octree.h"
+#include "bvh.h"
+#include "mesh_cache.h"
 #include "high_precision_timer.h"
 namespace SceneLoader
 {
 	std::map<std::string, Raytr_Core::texture*> textureMap;
 	std::map<std::string, Raytr_Core::triangle_mesh_data*> meshDataMap;
 	std::map<std::string, Raytr_Core::material*> materialMap;
+	std::map<std::string, Raytr_Core::mesh_cache*> meshCacheMap;
+
+	//! read the meshes and their acceleration structures from the .cache files next to the .ply files and write them after loading
+	bool useMeshCache = true;
+
+	//! convert the octrees to the compact layout (quantized child boxes) after building them
+	bool compactOctrees = true;
 
 	//! loads the textures from disk
 	bool loadTextures()
@@ -40,7 +49,18 @@ namespace SceneLoader
 		{
 			//try to load the mesh from disk
 			std::cout << iter.second.filename.c_str() << "\n";
-			if (!Raytr_Core::PlyLoader::loadPlyMesh(iter.second.filename.substr(1, iter.second.filename.size() - 2).c_str(), iter.second.position, iter.second.rotation, iter.second.scaling))
+			std::string filename = iter.second.filename.substr(1, iter.second.filename.size() - 2);
+			Raytr_Core::mesh_cache* cache = nullptr;
+			if (useMeshCache)
+			{
+				cache = new Raytr_Core::mesh_cache(filename.c_str(), iter.second.position, iter.second.rotation, iter.second.scaling);
+				meshCacheMap[iter.first] = cache;
+			}
+			if (cache != nullptr && cache->loadMeshData())
+			{
+				meshDataMap[iter.first] = &Raytr_Core::meshDataVector.back();
+			}
+			else if (!Raytr_Core::PlyLoader::loadPlyMesh(filename.c_str(), iter.second.position, iter.second.rotation, iter.second.scaling))
 			{
 				std::cout << "SceneLoader:: Couldn't load ply mesh: " << iter.second.filename << "\n";
 				return false;
@@ -71,6 +91,15 @@ namespace SceneLoader
 		}
 	}
 
+	//!creates the emitter materials, the meshes using them are sampled as lights
+	void createEmitterMaterials()
+	{
+		for (auto iter : SceneParser::emitterLiteralMap)
+		{
+			materialMap[iter.first] = new Raytr_Core::emitter_material(textureMap[iter.second], nullptr);
+		}
+	}
+
 	//! creates lights
 	void createLights(Raytr_Core::scene& scn)
 	{
@@ -89,19 +118,99 @@ namespace SceneLoader
 		}
 	}
 
-	//! creates octree meshes
+	//! creates octree meshes, the octrees of the different meshes are built concurrently
 	void createOctreeMeshes(Raytr_Core::scene& scn)
 	{
 		size_t maxElements = 40;
-		for (auto iter : SceneParser::octree_meshes)
+		size_t count = SceneParser::octree_meshes.size();
+		if (count == 0)
+			return;
+		//everything shared is looked up beforehand - the tasks only write their own slots
+		std::vector<Raytr_Core::triangle_mesh_data*> meshData(count);
+		std::vector<Raytr_Core::material*> materials(count);
+		std::vector<Raytr_Core::mesh_cache*> caches(count);
+		std::vector<size_t> depths(count);
+		std::vector<Raytr_Core::triangle_octree_mesh*> meshes(count);
+		std::vector<char> cached(count);
+		std::vector<double> buildTimes(count);
+		std::vector<uint32_t> tasks(count);
+		for (size_t i = 0; i < count; ++i)
 		{
-			size_t depth = meshDataMap[iter.meshData]->triangleCount() / (maxElements*log(8));
-			std::cout << "Building octree of " << iter.meshData << " with depth: " << depth << "\n";
+			const SceneParser::meshInfo& info = SceneParser::octree_meshes[i];
+			meshData[i] = meshDataMap[info.meshData];
+			materials[i] = materialMap[info.material];
+			caches[i] = meshCacheMap.count(info.meshData) ? meshCacheMap[info.meshData] : nullptr;
+			depths[i] = meshData[i]->triangleCount() / (maxElements*log(8));
+			tasks[i] = uint32_t(i);
+			std::cout << "Building octree of " << info.meshData << " with depth: " << depths[i] << "\n";
+		}
+
+		//the hardware threads are split between the workers, each builds its octrees on its share of them
+		//so the nested pools never run more than hardwareThreads() threads together
+		int hardwareThreads = ThreadsDistribution::hardwareThreads();
+		int numThreads = int(std::min(count, size_t(hardwareThreads)));
+		ThreadsDistribution::worker_pool<uint32_t> pool(numThreads, tasks, tasks.size(),
+			[&](ThreadsDistribution::worker_pool<uint32_t>& workers, int worker, const uint32_t& i)
+		{
+			int meshThreads = hardwareThreads / numThreads + (worker < hardwareThreads % numThreads ? 1 : 0);
 			HighPrecisionTimer octreeBuildTimer;
 			octreeBuildTimer.StartCounter();
-			scn.addObject(new Raytr_Core::triangle_octree_mesh(*meshDataMap[iter.meshData], materialMap[iter.material], depth, maxElements));
-			std::cout << "Octree built in " << octreeBuildTimer.GetCounter() << "\n";
+			size_t cachedSize = 0;
+			const uint32_t* cachedTree = caches[i] ? caches[i]->octreeData(int(depths[i]), maxElements, cachedSize) : nullptr;
+			meshes[i] = cachedTree ?
+				new Raytr_Core::triangle_octree_mesh(*meshData[i], materials[i], depths[i], maxElements, cachedTree, cachedSize, meshThreads) :
+				new Raytr_Core::triangle_octree_mesh(*meshData[i], materials[i], depths[i], maxElements, meshThreads);
+			cached[i] = cachedTree != nullptr;
+			if (compactOctrees)
+				meshes[i]->compact();
+			buildTimes[i] = octreeBuildTimer.GetCounter();
+		});
+		pool.wait();
+
+		//add the meshes in the order of the scene file
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (caches[i])
+				caches[i]->setOctree(meshes[i]->tree(), int(depths[i]), maxElements);
+			scn.addObject(meshes[i]);
+			std::cout << "Octree of " << SceneParser::octree_meshes[i].meshData
+				<< (cached[i] ? " loaded from the cache in " : " built in ") << buildTimes[i] << " with " << meshes[i]->tree().nodeCount() << " nodes ("
+				<< meshes[i]->tree().memoryUsage() / 1024 << " KB)\n";
+		}
+	}
+
+	//! creates bvh meshes
+	void createBvhMeshes(Raytr_Core::scene& scn)
+	{
+		size_t maxElements = 4;
+		for (auto iter : SceneParser::bvh_meshes)
+		{
+			std::cout << "Building bvh of " << iter.meshData << "\n";
+			HighPrecisionTimer bvhBuildTimer;
+			bvhBuildTimer.StartCounter();
+			Raytr_Core::mesh_cache* cache = meshCacheMap.count(iter.meshData) ? meshCacheMap[iter.meshData] : nullptr;
+			Raytr_Core::bvh cachedHierarchy;
+			bool cached = cache && cache->loadBvh(maxElements, cachedHierarchy);
+			Raytr_Core::triangle_bvh_mesh* mesh = cached ?
+				new Raytr_Core::triangle_bvh_mesh(*meshDataMap[iter.meshData], materialMap[iter.material], cachedHierarchy) :
+				new Raytr_Core::triangle_bvh_mesh(*meshDataMap[iter.meshData], materialMap[iter.material], maxElements);
+			if (cache)
+				cache->setBvh(mesh->hierarchy());
+			std::cout << (cached ? "Bvh loaded from the cache in " : "Bvh built in ") << bvhBuildTimer.GetCounter() << " with " << mesh->hierarchy().nodeCount() << " nodes ("
+				<< mesh->hierarchy().memoryUsage() / 1024 << " KB)\n";
+			scn.addObject(mesh);
+		}
+	}
+
+	//! writes the caches of the meshes loaded from .ply files or with outdated acceleration structures and releases them
+	void saveMeshCaches()
+	{
+		for (auto iter : meshCacheMap)
+		{
+			iter.second->save(*meshDataMap[iter.first]);
+			delete iter.second;
 		}
+		meshCacheMap.clear();
 	}
 
 	bool loadScene(const char* filename, Raytr_Core::scene** scn)
@@ -123,9 +232,14 @@ namespace SceneLoader
 		}
 		createConstantTextures();
 		createLambertianMaterials();
+		createEmitterMaterials();
 		createLights(**scn);
 		createMeshes(**scn);
 		createOctreeMeshes(**scn);
+		createBvhMeshes(**scn);
+		saveMeshCaches();
+		//build the top level acceleration structure over all the objects
+		(*scn)->buildAccelerationStructure();
 		return true;
 	}
 }
@@ -25,6 +25,8 @@ namespace SceneParser
 	std::vector<meshInfo> meshes;
 	//a vector to store the mesh descriptor and  material descriptor literals associated with an octree mesh
 	std::vector<meshInfo> octree_meshes;
+	//a vector to store the mesh descriptor and  material descriptor literals associated with a bvh mesh
+	std::vector<meshInfo> bvh_meshes;
 
 	struct lightInfo
 	{
@@ -82,6 +84,9 @@ namespace SceneParser
 	//map between a lambertian literal - texture literal
 	std::map<std::string, std::string> lambertianLiteralMap;
 
+	//map between an emitter literal - texture literal
+	std::map<std::string, std::string> emitterLiteralMap;
+
 	//! creates a vector with all the words from the string (words are continuous blocks of symbols divided by ' ' and '\t')
 	std::vector<std::string> getAllWords(const std::string& str)
 	{
@@ -143,7 +148,7 @@ namespace SceneParser
 	//checks whether a word is a literal (is not a keyword)
 	bool wordIsLiteral(const std::string& str)
 	{
-		return (str != "Mesh" && str != "OctreeMesh" && str != "Light" && str != "Lambertian" && str != "Camera" && str != "Default");
+		return (str != "Mesh" && str != "OctreeMesh" && str != "BvhMesh" && str != "Light" && str != "Lambertian" && str != "Emitter" && str != "Camera" && str != "Default");
 	}
 
 	//! parses a line from a scene file
@@ -217,6 +222,31 @@ namespace SceneParser
 				}
 			}
 		}
+		else if (words[0] == "BvhMesh")
+		{
+			//if a bvh mesh needs to be created, it requires a triangle mesh descriptor, and a material descriptor as arguments:
+			//BvhMesh meshDescriptorLiteral materialDescriptorLiteral
+
+			//if the arguments are not 2 - syntax error
+			if (words.size() != 3)
+			{
+				std::cout << "Syntax error at line: " << lineNumber << ".BvhMesh command accepts 2 arguments.\n";
+				return false;
+			}
+			else
+			{
+				//if any of the arguments are acutally keywords - syntax error
+				if (!wordIsLiteral(words[1]) || !wordIsLiteral(words[2]))
+				{
+					std::cout << "Syntax error at line: " << lineNumber << ".BvhMesh command has a keyword as an argument.\n";
+					return false;
+				}
+				else
+				{
+					bvh_meshes.push_back(meshInfo(words[1], words[2]));
+				}
+			}
+		}
 		else if (words[0] == "Light")
 		{
 			//if the arguments are not 5 - syntax error
@@ -319,6 +349,19 @@ namespace SceneParser
 					
 				}
 			}
+			else if (words[1] == "Emitter")
+			{
+				//if the arguments are not 1 - syntax error
+				if (words.size() != 3)
+				{
+					std::cout << "Syntax error at line: " << lineNumber << ".When trying to initialize a literal with an emitter material the format is: literal Emitter texture_literal\n";
+					return false;
+				}
+				else
+				{
+					emitterLiteralMap[words[0]] = words[2];
+				}
+			}
 			//is it a constant texture declaration
 			else if (words.size() == 4)
 			{
@@ -352,6 +395,16 @@ namespace SceneParser
 				return false;
 			}
 		}
+
+		//check emitter materials - texture dependency
+		for (auto iter : SceneParser::emitterLiteralMap)
+		{
+			if (literals.find(iter.second) == literals.end())
+			{
+				std::cout << "SceneParser:: Couldn't find texture: " << iter.second << " used as an argument in Emitter: " << iter.first << "\n";
+				return false;
+			}
+		}
 		
 		//check lights - texture dependency
 		for (auto iter : SceneParser::lights)
@@ -400,6 +453,24 @@ namespace SceneParser
 			}
 		}
 
+		//check bvh meshes - meshdata and material dependency
+		for (auto iter : SceneParser::bvh_meshes)
+		{
+			//does the mesh data exist
+			if (literals.find(iter.meshData) == literals.end())
+			{
+				std::cout << "SceneParser:: Couldn't find mesh data: " << iter.meshData << " used in BvhMesh.\n";
+				return false;
+			}
+
+			//does the material exist
+			if (literals.find(iter.material) == literals.end())
+			{
+				std::cout << "SceneParser:: Couldn't find material: " << iter.material << " used in BvhMesh.\n";
+				return false;
+			}
+		}
+
 		return true;
 	}
 
@@ -49,6 +49,24 @@ namespace Raytr_Core
 			return true;
 		}
 
+		bool occluded(const ray& r, float tmin, float tmax) const
+		{
+			BasicMath::vec3 co = r.origin - center;
+			float a = dotProduct(r.direction, r.direction);
+			float b = dotProduct(r.direction, co);
+			float c = dotProduct(co, co) - radius2;
+			float discriminant = b*b - a*c;
+
+			if (discriminant < 0) return false;
+
+			float root = sqrtf(discriminant);
+			float solution = (-b - root) / a;
+			if (solution <= tmax && solution >= tmin)
+				return true;
+			solution = (-b + root) / a;
+			return solution <= tmax && solution >= tmin;
+		}
+
 		//! solid angle subtended by sphere
 		virtual float pdf_value(const BasicMath::vec3& o, const BasicMath::vec3& v) const
 		{ 
@@ -61,8 +79,8 @@ namespace Raytr_Core
 		{ 
 			BasicMath::vec3 direction = center - o;
 			float distance_squared = direction.squared_length();
-			float r1 = BasicMath::uniform_distribution(BasicMath::generator);
-			float r2 = BasicMath::uniform_distribution(BasicMath::generator);
+			float r1 = BasicMath::randomFloat();
+			float r2 = BasicMath::randomFloat();
 			float cosThetaMax = sqrtf(std::max(0.f,1 - radius2 / distance_squared));
 			return BasicMath::uniformCosineLobeSample(r1, r2, cosThetaMax);
 		}
@@ -75,8 +93,14 @@ namespace Raytr_Core
 		virtual BasicMath::vec3 random_area() const
 		{
 			return center+radius*BasicMath::uniformSphereSample(
-				BasicMath::uniform_distribution(BasicMath::generator), 
-				BasicMath::uniform_distribution(BasicMath::generator));
+				BasicMath::randomFloat(), 
+				BasicMath::randomFloat());
+		}
+
+		virtual bool bounds(bounding_volume_aabb& box) const
+		{
+			box = bounding_volume_aabb(center - BasicMath::vec3(radius), center + BasicMath::vec3(radius));
+			return true;
 		}
 
 		float radius; //<! sphere radius
@@ -100,7 +100,7 @@ namespace ThreadsDistribution
 			//fix y
 			if (currentPos.y + rectSize.y >= area.pos.y + area.size.y)
 			{
-				result[currentThread].rects.back().size.y -= currentPos.y + rectSize.y - area.pos.x - area.size.x;
+				result[currentThread].rects.back().size.y -= currentPos.y + rectSize.y - area.pos.y - area.size.y;
 			}
 
 			//if the new rectangle is out of bounds
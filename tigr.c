@@ -3628,6 +3628,82 @@ float tigrTime()
 
 //////// End of inlined file: tigr_osx.c ////////
 
+//////// Start of headless platform (not part of tigr) ////////
+// Without a window system (linux render nodes) only the bitmaps, the images and the fonts work:
+// tigrWindow fails and a bitmap behaves like a window that's already closed.
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+Tigr *tigrWindow(int w, int h, const char *title, int flags)
+{
+	return NULL;
+}
+
+void tigrFree(Tigr *bmp)
+{
+	if (bmp) {
+		free(bmp->pix);
+		free(bmp);
+	}
+}
+
+int tigrClosed(Tigr *bmp)
+{
+	return 1;
+}
+
+void tigrUpdate(Tigr *bmp)
+{
+}
+
+void tigrMouse(Tigr *bmp, int *x, int *y, int *buttons)
+{
+	*x = *y = *buttons = 0;
+}
+
+int tigrKeyDown(Tigr *bmp, int key)
+{
+	return 0;
+}
+
+int tigrKeyHeld(Tigr *bmp, int key)
+{
+	return 0;
+}
+
+int tigrReadChar(Tigr *bmp)
+{
+	return 0;
+}
+
+float tigrTime()
+{
+	static struct timespec last;
+	static int started = 0;
+	struct timespec now;
+	float elapsed;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = started ? (float)(now.tv_sec - last.tv_sec) + (float)(now.tv_nsec - last.tv_nsec) * 1e-9f : 0.0f;
+	last = now;
+	started = 1;
+	return elapsed;
+}
+
+void tigrError(Tigr *bmp, const char *message, ...)
+{
+	va_list args;
+	va_start(args, message);
+	vfprintf(stderr, message, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+#endif
+//////// End of headless platform ////////
+
 //////// Start of inlined file: tigr_gl.c ////////
 
 //#include "tigr_internal.h"
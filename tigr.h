@@ -23,9 +23,10 @@ extern "C" {
 #endif
 
 // Graphics configuration.
+// Anything else has no window support, see the headless platform at the end of tigr.c.
 #ifdef _WIN32
 #define TIGR_GAPI_D3D9
-#else
+#elif defined(__APPLE__)
 #define TIGR_GAPI_GL
 #endif
 
@@ -29,6 +29,22 @@ namespace Raytr_Core
 			nnormal = normal / (2*area);
 		}
 
+		//! fills out the intersect_info structure for a hit at t with barycentric coordinates ks
+		void fillIntersectionInfo(const ray& r, float t, const BasicMath::vec2& ks, intersection_info& info) const
+		{
+			info.intersect = true;
+			info.t = t;
+			info.position = r(t);
+			//interpolate normals
+			//info.normal = normalize((1 - ks.x - ks.y) * v0->normal + ks.x * v1->normal + ks.y * v2->normal);
+			//if the interpolated normal is too close to zero, take the original normal
+			//if (BasicMath::isnan(info.normal))
+			info.normal = nnormal;
+			//calculate uv
+			info.uv = (1 - ks.x - ks.y) * v0->uv + ks.x * v1->uv + ks.y * v2->uv;
+			//remember to fill out pObject in the parent
+		}
+
 		bool intersect(const ray& r, float tmin, float tmax, intersection_info& info) const
 		{
 
@@ -53,18 +69,7 @@ namespace Raytr_Core
 				t *= inv_denom;
 				ks *= inv_denom;
 
-				//fill out the intersect_info structure
-				info.intersect = true;
-				info.t = t;
-				info.position = r(t);
-				//interpolate normals
-				//info.normal = normalize((1 - ks.x - ks.y) * v0->normal + ks.x * v1->normal + ks.y * v2->normal);
-				//if the interpolated normal is too close to zero, take the original normal
-				//if (BasicMath::isnan(info.normal))
-				info.normal = nnormal;
-				//calculate uv
-				info.uv = (1 - ks.x - ks.y) * v0->uv + ks.x * v1->uv + ks.y * v2->uv;
-				//remember to fill out pObject in the parent
+				fillIntersectionInfo(r, t, ks, info);
 				return true;
 			}
 			//else if (denominator > BasicMath::cEPSILON)
@@ -106,6 +111,27 @@ namespace Raytr_Core
 				return false;
 		}
 
+		//! same test as intersect, but only reports whether there's a hit
+		bool occluded(const ray& r, float tmin, float tmax) const
+		{
+			float denominator = dotProduct(normal, r.direction);
+			//backface culling + 0 case
+			if (denominator >= -BasicMath::cEPSILON)
+				return false;
+
+			BasicMath::vec3 oc = v0->position - r.origin;
+			float t = dotProduct(normal, oc);
+			if (t > tmin*denominator || t < tmax*denominator)
+				return false;
+
+			BasicMath::vec3 ocD = crossProduct(oc, r.direction);
+			float k0 = dotProduct(e2, ocD);
+			if (k0 > 0 || k0 < denominator)
+				return false;
+			float k1 = -dotProduct(e1, ocD);
+			return !(k1 > 0 || k0 + k1 < denominator);
+		}
+
 		bool intersectsAABB(const bounding_volume_aabb& aabb) const
 		{
 			return triBoxOverlap(aabb.center(), aabb.halfSize(), v0->position, v1->position, v2->position, nnormal,
@@ -132,8 +158,8 @@ namespace Raytr_Core
 		}
 		virtual BasicMath::vec3 random_area() const
 		{
-			float r1 = sqrtf(BasicMath::uniform_distribution(BasicMath::generator));
-			float r2 = BasicMath::uniform_distribution(BasicMath::generator);
+			float r1 = sqrtf(BasicMath::randomFloat());
+			float r2 = BasicMath::randomFloat();
 			float gamma = r1*r2;
 			float alpha = r1 - gamma;
 			float beta = 1 - r1;
@@ -0,0 +1,496 @@
+#ifndef RAYTR_CORE_TRIANGLE_LEAF_KERNELS_H
+#define RAYTR_CORE_TRIANGLE_LEAF_KERNELS_H
+#include "triangle_soa.h"
+#include "render_stats.h"
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RAYTR_CORE_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+//msvc emits avx2 instructions from intrinsics without any extra flags
+#define RAYTR_CORE_AVX2_TARGET
+#else
+#include <cpuid.h>
+//gcc/clang need the avx2 functions marked, the rest of the code stays sse only
+#define RAYTR_CORE_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace Raytr_Core
+{
+	//! instruction sets the leaf kernels can run on
+	enum class simd_level
+	{
+		scalar = 0,
+		sse = 1,	//!< 4 triangles at a time
+		avx2 = 2	//!< 8 triangles at a time, indexed leaves use the avx2 gathers
+	};
+
+	//! Kernels testing one ray against all the triangles of a leaf (a contiguous range or a list of indices in a triangle_soa_buffer)
+	/*!
+		They do the same test as triangle_soa_buffer::intersect (including the backface culling) on several triangles at once.
+		The widest instruction set supported by the cpu is picked on the first use, level() can lower it (for benchmarking).
+		intersect() shrinks closestSoFar and records the index and barycentrics of the closest hit, the shading data is up to the caller.
+	*/
+	class triangle_leaf_kernels
+	{
+	private:
+#ifdef RAYTR_CORE_X86
+		static void cpuid(int regs[4], int leaf)
+		{
+#if defined(_MSC_VER)
+			__cpuidex(regs, leaf, 0);
+#else
+			__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+		}
+
+		//! the register state the os saves on context switches
+		static uint64_t xgetbv()
+		{
+#if defined(_MSC_VER)
+			return _xgetbv(0);
+#else
+			uint32_t eax, edx;
+			__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			return (uint64_t(edx) << 32) | eax;
+#endif
+		}
+
+		//! the ray and the current interval broadcast to all the lanes
+		struct ray4
+		{
+			__m128 ox, oy, oz, dx, dy, dz, tmin, tmax;
+
+			ray4(const ray& r, float tmin, float tmax)
+				: ox(_mm_set1_ps(r.origin.x)), oy(_mm_set1_ps(r.origin.y)), oz(_mm_set1_ps(r.origin.z)),
+				dx(_mm_set1_ps(r.direction.x)), dy(_mm_set1_ps(r.direction.y)), dz(_mm_set1_ps(r.direction.z)),
+				tmin(_mm_set1_ps(tmin)), tmax(_mm_set1_ps(tmax))
+			{}
+		};
+
+		//! loads 4 consecutive elements of an array starting at first
+		struct contiguous4
+		{
+			size_t first;
+			__m128 operator()(const float* a) const { return _mm_loadu_ps(a + first); }
+		};
+
+		//! loads the elements with the indices in lane[0..3]
+		struct gathered4
+		{
+			const uint32_t* lane;
+			__m128 operator()(const float* a) const { return _mm_setr_ps(a[lane[0]], a[lane[1]], a[lane[2]], a[lane[3]]); }
+		};
+
+		//! tests 4 triangles, returns a bit mask of the lanes hit, t, u and v are valid only for those
+		/*!
+			The arrays are loaded as the test goes on, so a batch rejected by the backface or the distance test
+			never touches the edges - the same early outs the scalar test has.
+		*/
+		template<class Load>
+		static int intersect4(const triangle_soa_buffer& soa, Load load, const ray4& r, __m128 active, __m128& t, __m128& u, __m128& v)
+		{
+			__m128 nx = load(soa.nx), ny = load(soa.ny), nz = load(soa.nz);
+			__m128 denominator = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, r.dx), _mm_mul_ps(ny, r.dy)), _mm_mul_ps(nz, r.dz));
+			//backface culling + 0 case
+			__m128 reject = _mm_or_ps(_mm_cmpge_ps(denominator, _mm_set1_ps(-BasicMath::cEPSILON)), _mm_cmpeq_ps(active, _mm_setzero_ps()));
+			if (_mm_movemask_ps(reject) == 0xF)
+				return 0;
+
+			__m128 ocx = _mm_sub_ps(load(soa.v0x), r.ox), ocy = _mm_sub_ps(load(soa.v0y), r.oy), ocz = _mm_sub_ps(load(soa.v0z), r.oz);
+			t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, ocx), _mm_mul_ps(ny, ocy)), _mm_mul_ps(nz, ocz));
+			reject = _mm_or_ps(reject, _mm_cmpgt_ps(t, _mm_mul_ps(r.tmin, denominator)));
+			reject = _mm_or_ps(reject, _mm_cmplt_ps(t, _mm_mul_ps(r.tmax, denominator)));
+			if (_mm_movemask_ps(reject) == 0xF)
+				return 0;
+
+			//oc x direction
+			__m128 cx = _mm_sub_ps(_mm_mul_ps(ocy, r.dz), _mm_mul_ps(ocz, r.dy));
+			__m128 cy = _mm_sub_ps(_mm_mul_ps(ocz, r.dx), _mm_mul_ps(ocx, r.dz));
+			__m128 cz = _mm_sub_ps(_mm_mul_ps(ocx, r.dy), _mm_mul_ps(ocy, r.dx));
+			u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(load(soa.e2x), cx), _mm_mul_ps(load(soa.e2y), cy)), _mm_mul_ps(load(soa.e2z), cz));
+			reject = _mm_or_ps(reject, _mm_cmpgt_ps(u, _mm_setzero_ps()));
+			reject = _mm_or_ps(reject, _mm_cmplt_ps(u, denominator));
+			v = _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(_mm_add_ps(_mm_mul_ps(load(soa.e1x), cx), _mm_mul_ps(load(soa.e1y), cy)), _mm_mul_ps(load(soa.e1z), cz)));
+			reject = _mm_or_ps(reject, _mm_cmpgt_ps(v, _mm_setzero_ps()));
+			reject = _mm_or_ps(reject, _mm_cmplt_ps(_mm_add_ps(u, v), denominator));
+
+			int mask = _mm_movemask_ps(reject) ^ 0xF;
+			if (mask != 0)
+			{
+				__m128 invDenominator = _mm_div_ps(_mm_set1_ps(1.0f), denominator);
+				t = _mm_mul_ps(t, invDenominator);
+				u = _mm_mul_ps(u, invDenominator);
+				v = _mm_mul_ps(v, invDenominator);
+			}
+			return mask;
+		}
+
+		//! lanes [0,remaining) set
+		static __m128 activeLanes4(size_t remaining)
+		{
+			return _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(int(remaining)), _mm_setr_epi32(0, 1, 2, 3)));
+		}
+
+		//! fills the lanes of a batch starting at position i, the lanes past count repeat the last triangle
+		template<class IndexOf>
+		static void laneIndices(uint32_t* lane, size_t width, size_t i, size_t count, IndexOf indexOf)
+		{
+			for (size_t k = 0; k < width; ++k)
+				lane[k] = indexOf(i + k < count ? i + k : count - 1);
+		}
+
+		//! picks the closest of the lanes hit, returns true if it's closer than closestSoFar
+		template<class IndexOf>
+		static bool closestLane(int mask, size_t width, const float* ts, const float* us, const float* vs, size_t i, IndexOf indexOf,
+			float& closestSoFar, uint32_t& closestIndex, BasicMath::vec2& closestKs)
+		{
+			bool hit = false;
+			for (size_t k = 0; k < width; ++k)
+			{
+				if ((mask & (1 << k)) && ts[k] < closestSoFar)
+				{
+					closestSoFar = ts[k];
+					closestIndex = indexOf(i + k);
+					closestKs = BasicMath::vec2(us[k], vs[k]);
+					hit = true;
+				}
+			}
+			return hit;
+		}
+
+		template<bool Contiguous, class IndexOf>
+		static bool intersectSSE(const triangle_soa_buffer& soa, size_t count, IndexOf indexOf, const ray& r, float tmin,
+			float& closestSoFar, uint32_t& closestIndex, BasicMath::vec2& closestKs)
+		{
+			bool hit = false;
+			alignas(16) float ts[4], us[4], vs[4];
+			for (size_t i = 0; i < count; i += 4)
+			{
+				ray4 r4(r, tmin, closestSoFar);
+				__m128 t, u, v;
+				int mask;
+				if (Contiguous && i + 4 <= count)
+				{
+					mask = intersect4(soa, contiguous4{ size_t(indexOf(i)) }, r4, _mm_castsi128_ps(_mm_set1_epi32(-1)), t, u, v);
+				}
+				else
+				{
+					uint32_t lane[4];
+					laneIndices(lane, 4, i, count, indexOf);
+					mask = intersect4(soa, gathered4{ lane }, r4, activeLanes4(count - i), t, u, v);
+				}
+				if (mask == 0)
+					continue;
+				_mm_store_ps(ts, t); _mm_store_ps(us, u); _mm_store_ps(vs, v);
+				if (closestLane(mask, 4, ts, us, vs, i, indexOf, closestSoFar, closestIndex, closestKs))
+					hit = true;
+			}
+			return hit;
+		}
+
+		template<bool Contiguous, class IndexOf>
+		static bool occludedSSE(const triangle_soa_buffer& soa, size_t count, IndexOf indexOf, const ray& r, float tmin, float tmax)
+		{
+			ray4 r4(r, tmin, tmax);
+			for (size_t i = 0; i < count; i += 4)
+			{
+				__m128 t, u, v;
+				int mask;
+				if (Contiguous && i + 4 <= count)
+				{
+					mask = intersect4(soa, contiguous4{ size_t(indexOf(i)) }, r4, _mm_castsi128_ps(_mm_set1_epi32(-1)), t, u, v);
+				}
+				else
+				{
+					uint32_t lane[4];
+					laneIndices(lane, 4, i, count, indexOf);
+					mask = intersect4(soa, gathered4{ lane }, r4, activeLanes4(count - i), t, u, v);
+				}
+				if (mask != 0)
+					return true;
+			}
+			return false;
+		}
+
+		//! the avx2 versions of the above
+		struct ray8
+		{
+			__m256 ox, oy, oz, dx, dy, dz, tmin, tmax;
+
+			RAYTR_CORE_AVX2_TARGET ray8(const ray& r, float tmin, float tmax)
+				: ox(_mm256_set1_ps(r.origin.x)), oy(_mm256_set1_ps(r.origin.y)), oz(_mm256_set1_ps(r.origin.z)),
+				dx(_mm256_set1_ps(r.direction.x)), dy(_mm256_set1_ps(r.direction.y)), dz(_mm256_set1_ps(r.direction.z)),
+				tmin(_mm256_set1_ps(tmin)), tmax(_mm256_set1_ps(tmax))
+			{}
+		};
+
+		struct contiguous8
+		{
+			size_t first;
+			RAYTR_CORE_AVX2_TARGET __m256 operator()(const float* a) const { return _mm256_loadu_ps(a + first); }
+		};
+
+		struct gathered8
+		{
+			__m256i lane;
+			RAYTR_CORE_AVX2_TARGET __m256 operator()(const float* a) const { return _mm256_i32gather_ps(a, lane, 4); }
+		};
+
+		template<class Load>
+		static RAYTR_CORE_AVX2_TARGET int intersect8(const triangle_soa_buffer& soa, Load load, const ray8& r, __m256 active, __m256& t, __m256& u, __m256& v)
+		{
+			__m256 nx = load(soa.nx), ny = load(soa.ny), nz = load(soa.nz);
+			__m256 denominator = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, r.dx), _mm256_mul_ps(ny, r.dy)), _mm256_mul_ps(nz, r.dz));
+			//backface culling + 0 case
+			__m256 reject = _mm256_or_ps(_mm256_cmp_ps(denominator, _mm256_set1_ps(-BasicMath::cEPSILON), _CMP_GE_OQ),
+				_mm256_cmp_ps(active, _mm256_setzero_ps(), _CMP_EQ_OQ));
+			if (_mm256_movemask_ps(reject) == 0xFF)
+				return 0;
+
+			__m256 ocx = _mm256_sub_ps(load(soa.v0x), r.ox), ocy = _mm256_sub_ps(load(soa.v0y), r.oy), ocz = _mm256_sub_ps(load(soa.v0z), r.oz);
+			t = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, ocx), _mm256_mul_ps(ny, ocy)), _mm256_mul_ps(nz, ocz));
+			reject = _mm256_or_ps(reject, _mm256_cmp_ps(t, _mm256_mul_ps(r.tmin, denominator), _CMP_GT_OQ));
+			reject = _mm256_or_ps(reject, _mm256_cmp_ps(t, _mm256_mul_ps(r.tmax, denominator), _CMP_LT_OQ));
+			if (_mm256_movemask_ps(reject) == 0xFF)
+				return 0;
+
+			//oc x direction
+			__m256 cx = _mm256_sub_ps(_mm256_mul_ps(ocy, r.dz), _mm256_mul_ps(ocz, r.dy));
+			__m256 cy = _mm256_sub_ps(_mm256_mul_ps(ocz, r.dx), _mm256_mul_ps(ocx, r.dz));
+			__m256 cz = _mm256_sub_ps(_mm256_mul_ps(ocx, r.dy), _mm256_mul_ps(ocy, r.dx));
+			u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(load(soa.e2x), cx), _mm256_mul_ps(load(soa.e2y), cy)), _mm256_mul_ps(load(soa.e2z), cz));
+			reject = _mm256_or_ps(reject, _mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GT_OQ));
+			reject = _mm256_or_ps(reject, _mm256_cmp_ps(u, denominator, _CMP_LT_OQ));
+			v = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(load(soa.e1x), cx), _mm256_mul_ps(load(soa.e1y), cy)), _mm256_mul_ps(load(soa.e1z), cz)));
+			reject = _mm256_or_ps(reject, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GT_OQ));
+			reject = _mm256_or_ps(reject, _mm256_cmp_ps(_mm256_add_ps(u, v), denominator, _CMP_LT_OQ));
+
+			int mask = _mm256_movemask_ps(reject) ^ 0xFF;
+			if (mask != 0)
+			{
+				__m256 invDenominator = _mm256_div_ps(_mm256_set1_ps(1.0f), denominator);
+				t = _mm256_mul_ps(t, invDenominator);
+				u = _mm256_mul_ps(u, invDenominator);
+				v = _mm256_mul_ps(v, invDenominator);
+			}
+			return mask;
+		}
+
+		//! lanes [0,remaining) set
+		static RAYTR_CORE_AVX2_TARGET __m256 activeLanes8(size_t remaining)
+		{
+			return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(int(remaining)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+		}
+
+		template<bool Contiguous, class IndexOf>
+		static RAYTR_CORE_AVX2_TARGET bool intersectAVX2(const triangle_soa_buffer& soa, size_t count, IndexOf indexOf, const ray& r, float tmin,
+			float& closestSoFar, uint32_t& closestIndex, BasicMath::vec2& closestKs)
+		{
+			bool hit = false;
+			alignas(32) float ts[8], us[8], vs[8];
+			for (size_t i = 0; i < count; i += 8)
+			{
+				ray8 r8(r, tmin, closestSoFar);
+				__m256 t, u, v;
+				int mask;
+				if (Contiguous && i + 8 <= count)
+				{
+					mask = intersect8(soa, contiguous8{ size_t(indexOf(i)) }, r8, _mm256_castsi256_ps(_mm256_set1_epi32(-1)), t, u, v);
+				}
+				else
+				{
+					alignas(32) uint32_t lane[8];
+					laneIndices(lane, 8, i, count, indexOf);
+					mask = intersect8(soa, gathered8{ _mm256_load_si256((const __m256i*)lane) }, r8, activeLanes8(count - i), t, u, v);
+				}
+				if (mask == 0)
+					continue;
+				_mm256_store_ps(ts, t); _mm256_store_ps(us, u); _mm256_store_ps(vs, v);
+				if (closestLane(mask, 8, ts, us, vs, i, indexOf, closestSoFar, closestIndex, closestKs))
+					hit = true;
+			}
+			return hit;
+		}
+
+		template<bool Contiguous, class IndexOf>
+		static RAYTR_CORE_AVX2_TARGET bool occludedAVX2(const triangle_soa_buffer& soa, size_t count, IndexOf indexOf, const ray& r, float tmin, float tmax)
+		{
+			ray8 r8(r, tmin, tmax);
+			for (size_t i = 0; i < count; i += 8)
+			{
+				__m256 t, u, v;
+				int mask;
+				if (Contiguous && i + 8 <= count)
+				{
+					mask = intersect8(soa, contiguous8{ size_t(indexOf(i)) }, r8, _mm256_castsi256_ps(_mm256_set1_epi32(-1)), t, u, v);
+				}
+				else
+				{
+					alignas(32) uint32_t lane[8];
+					laneIndices(lane, 8, i, count, indexOf);
+					mask = intersect8(soa, gathered8{ _mm256_load_si256((const __m256i*)lane) }, r8, activeLanes8(count - i), t, u, v);
+				}
+				if (mask != 0)
+					return true;
+			}
+			return false;
+		}
+#endif
+
+		template<class IndexOf>
+		static bool intersectScalar(const triangle_soa_buffer& soa, size_t count, IndexOf indexOf, const ray& r, float tmin,
+			float& closestSoFar, uint32_t& closestIndex, BasicMath::vec2& closestKs)
+		{
+			bool hit = false;
+			float t;
+			BasicMath::vec2 ks;
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (soa.intersect(indexOf(i), r, tmin, closestSoFar, t, ks))
+				{
+					closestSoFar = t;
+					closestIndex = indexOf(i);
+					closestKs = ks;
+					hit = true;
+				}
+			}
+			return hit;
+		}
+
+		template<class IndexOf>
+		static bool occludedScalar(const triangle_soa_buffer& soa, size_t count, IndexOf indexOf, const ray& r, float tmin, float tmax)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (soa.occluded(indexOf(i), r, tmin, tmax))
+					return true;
+			}
+			return false;
+		}
+
+		template<bool Contiguous, class IndexOf>
+		static bool dispatchIntersect(const triangle_soa_buffer& soa, size_t count, IndexOf indexOf, const ray& r, float tmin,
+			float& closestSoFar, uint32_t& closestIndex, BasicMath::vec2& closestKs)
+		{
+			switch (level())
+			{
+#ifdef RAYTR_CORE_X86
+			case simd_level::avx2:
+				return intersectAVX2<Contiguous>(soa, count, indexOf, r, tmin, closestSoFar, closestIndex, closestKs);
+			case simd_level::sse:
+				return intersectSSE<Contiguous>(soa, count, indexOf, r, tmin, closestSoFar, closestIndex, closestKs);
+#endif
+			default:
+				return intersectScalar(soa, count, indexOf, r, tmin, closestSoFar, closestIndex, closestKs);
+			}
+		}
+
+		template<bool Contiguous, class IndexOf>
+		static bool dispatchOccluded(const triangle_soa_buffer& soa, size_t count, IndexOf indexOf, const ray& r, float tmin, float tmax)
+		{
+			switch (level())
+			{
+#ifdef RAYTR_CORE_X86
+			case simd_level::avx2:
+				return occludedAVX2<Contiguous>(soa, count, indexOf, r, tmin, tmax);
+			case simd_level::sse:
+				return occludedSSE<Contiguous>(soa, count, indexOf, r, tmin, tmax);
+#endif
+			default:
+				return occludedScalar(soa, count, indexOf, r, tmin, tmax);
+			}
+		}
+
+		//! maps a position in a contiguous range to a triangle index
+		struct range_index
+		{
+			uint32_t first;
+			uint32_t operator()(size_t i) const { return first + uint32_t(i); }
+		};
+
+		//! maps a position in a list of indices to a triangle index
+		struct list_index
+		{
+			const uint32_t* indices;
+			uint32_t operator()(size_t i) const { return indices[i]; }
+		};
+
+	public:
+		//! the widest instruction set supported by the cpu and the os
+		static simd_level detect()
+		{
+#ifdef RAYTR_CORE_X86
+			int regs[4];
+			cpuid(regs, 0);
+			int maxLeaf = regs[0];
+			cpuid(regs, 1);
+			//sse2 is part of x64, the kernels don't use anything newer
+			simd_level best = (regs[3] & (1 << 26)) ? simd_level::sse : simd_level::scalar;
+			bool osxsave = (regs[2] & (1 << 27)) != 0, avx = (regs[2] & (1 << 28)) != 0;
+			//the os has to save the ymm registers too
+			if (maxLeaf >= 7 && osxsave && avx && (xgetbv() & 6) == 6)
+			{
+				cpuid(regs, 7);
+				if (regs[1] & (1 << 5))
+					best = simd_level::avx2;
+			}
+			return best;
+#else
+			return simd_level::scalar;
+#endif
+		}
+
+		//! the instruction set used by the kernels, can be lowered to compare the implementations
+		static simd_level& level()
+		{
+			static simd_level current = detect();
+			return current;
+		}
+
+		static const char* levelName(simd_level l)
+		{
+			switch (l)
+			{
+			case simd_level::avx2: return "avx2 (8-wide)";
+			case simd_level::sse: return "sse (4-wide)";
+			default: return "scalar";
+			}
+		}
+
+		//! closest hit with the triangles first..first+count-1
+		static bool intersectRange(const triangle_soa_buffer& soa, size_t first, size_t count, const ray& r, float tmin,
+			float& closestSoFar, uint32_t& closestIndex, BasicMath::vec2& closestKs)
+		{
+			RAYTR_CORE_COUNT(triangleTests, count);
+			return dispatchIntersect<true>(soa, count, range_index{ uint32_t(first) }, r, tmin, closestSoFar, closestIndex, closestKs);
+		}
+
+		//! closest hit with the triangles indices[0..count-1]
+		static bool intersectIndexed(const triangle_soa_buffer& soa, const uint32_t* indices, size_t count, const ray& r, float tmin,
+			float& closestSoFar, uint32_t& closestIndex, BasicMath::vec2& closestKs)
+		{
+			RAYTR_CORE_COUNT(triangleTests, count);
+			return dispatchIntersect<false>(soa, count, list_index{ indices }, r, tmin, closestSoFar, closestIndex, closestKs);
+		}
+
+		//! true if any of the triangles first..first+count-1 blocks the ray in [tmin,tmax]
+		static bool occludedRange(const triangle_soa_buffer& soa, size_t first, size_t count, const ray& r, float tmin, float tmax)
+		{
+			RAYTR_CORE_COUNT(triangleTests, count);
+			return dispatchOccluded<true>(soa, count, range_index{ uint32_t(first) }, r, tmin, tmax);
+		}
+
+		//! true if any of the triangles indices[0..count-1] blocks the ray in [tmin,tmax]
+		static bool occludedIndexed(const triangle_soa_buffer& soa, const uint32_t* indices, size_t count, const ray& r, float tmin, float tmax)
+		{
+			RAYTR_CORE_COUNT(triangleTests, count);
+			return dispatchOccluded<false>(soa, count, list_index{ indices }, r, tmin, tmax);
+		}
+	};
+}
+
+#endif
@@ -3,15 +3,65 @@
 #include "rds.h"
 #include "material.h"
 #include "triangle_mesh_data.h"
+#include "triangle_leaf_kernels.h"
+#include "alias_table.h"
 
 namespace Raytr_Core
 {
+	//! the closest triangles found so far for the rays of a packet, mask has the bits of the rays with a hit
+	struct triangle_packet_hits
+	{
+		uint32_t closestIndex[ray_packet::cMAX_RAYS];
+		BasicMath::vec2 closestKs[ray_packet::cMAX_RAYS];
+		uint64_t mask;
+
+		triangle_packet_hits() : mask(0) {}
+	};
+
 	//! A triangle mesh class
+	/*!
+		A mesh with an emitting material is also a light: an alias table over the areas of its triangles is built with the mesh,
+		so the light samples pick a point uniformly over its surface and convert the density to solid angle.
+	*/
 	class triangle_mesh : public object
 	{
 	protected:
 		const triangle_mesh_data& mesh_data;
 		const bounding_volume* boundingVolume;
+		alias_table areaTable;		//!< the triangles weighted by their area, only for emitting meshes
+
+		//! picks a triangle by its area and a uniformly distributed point on it
+		BasicMath::vec3 randomSurfacePoint(const triangle*& picked) const
+		{
+			picked = &mesh_data.getTriangles()[areaTable.sample(BasicMath::randomBits())];
+			return picked->random_area();
+		}
+
+		//! the rays of mask hitting the bounding volume
+		uint64_t packetBoundingVolumeMask(const ray_packet& packet, uint64_t mask) const
+		{
+			uint64_t result = 0;
+			for (; mask != 0; mask &= mask - 1)
+			{
+				int i = ray_packet::firstRay(mask);
+				float tminTemp = packet.tmin, tmaxTemp = packet.tmax[i];
+				if (boundingVolume->intersect(packet.getRay(i), tminTemp, tmaxTemp))
+					result |= uint64_t(1) << i;
+			}
+			return result;
+		}
+
+		//! fills out the shading data of the rays hit, packet.tmax holds their distances
+		void fillPacketInfos(const ray_packet& packet, const triangle_packet_hits& hits, intersection_info* infos) const
+		{
+			for (uint64_t mask = hits.mask; mask != 0; mask &= mask - 1)
+			{
+				int i = ray_packet::firstRay(mask);
+				mesh_data.getTriangles()[hits.closestIndex[i]].fillIntersectionInfo(packet.getRay(i), packet.tmax[i], hits.closestKs[i], infos[i]);
+				infos[i].pObject = this;
+			}
+		}
+
 	public:
 		
 		triangle_mesh(const triangle_mesh_data& mesh_data, material* pMaterial, const bounding_volume* boundingVolume = nullptr)
@@ -24,6 +74,13 @@ namespace Raytr_Core
 				this->boundingVolume = &mesh_data.getBoundingBox();
 			else
 				this->boundingVolume = boundingVolume;
+			if (pMaterial && pMaterial->emits && mesh_data.triangleCount() > 0)
+			{
+				std::vector<float> areas(mesh_data.triangleCount());
+				for (size_t i = 0; i < areas.size(); ++i)
+					areas[i] = mesh_data.getTriangles()[i].area;
+				areaTable.build(areas.data(), areas.size());
+			}
 		}
 
 		bool virtual intersect(const ray& r, float tmin, float tmax, intersection_info& info) const
@@ -33,15 +90,13 @@ namespace Raytr_Core
 				return false;
 
 			float closestSoFar = tmax;
-			//for each triangle check if the ray intersects it - return the closest one
-			for (int i = 0; i< mesh_data.triangleCount(); ++i)
-			{
-				if (mesh_data.getTriangles()[i].intersect(r, tmin, closestSoFar, info))
-					closestSoFar = info.t;
-			}
-			//hit anything
-			if (closestSoFar!=tmax)
+			uint32_t closestIndex = 0;
+			BasicMath::vec2 closestKs;
+			//check all the triangles - several at a time - and keep the closest one
+			if (triangle_leaf_kernels::intersectRange(mesh_data.getIntersectionBuffer(), 0, mesh_data.triangleCount(), r, tmin, closestSoFar, closestIndex, closestKs))
 			{
+				//only the closest hit needs the shading data
+				mesh_data.getTriangles()[closestIndex].fillIntersectionInfo(r, closestSoFar, closestKs, info);
 				info.pObject = this;
 				return true;
 			}
@@ -49,6 +104,16 @@ namespace Raytr_Core
 			return false;
 		}
 
+		bool virtual occluded(const ray& r, float tmin, float tmax) const
+		{
+			float tminTemp = tmin, tmaxTemp = tmax;
+			if (!boundingVolume->intersect(r, tminTemp, tmaxTemp))
+				return false;
+
+			//stop at the first triangle blocking the ray
+			return triangle_leaf_kernels::occludedRange(mesh_data.getIntersectionBuffer(), 0, mesh_data.triangleCount(), r, tmin, tmax);
+		}
+
 		const BasicMath::vec3& getBoundingBoxMin() const
 		{
 			return mesh_data.getBoundingBox().min();
@@ -59,14 +124,51 @@ namespace Raytr_Core
 			return mesh_data.getBoundingBox().max();
 		}
 
-		//nope - have to do it for each triangle
+		virtual bool bounds(bounding_volume_aabb& box) const
+		{
+			box = mesh_data.getBoundingBox();
+			return true;
+		}
+
+		//the direction of a light sample depends on the sampled triangle, not on a cone around the center - see sampleDirection()
 		virtual float pdf_value(const BasicMath::vec3& o, const BasicMath::vec3& v) const { return 0.0f; }
-		//nope - have to do it for each triangle
 		virtual BasicMath::vec3 random(const BasicMath::vec3& o) const { return BasicMath::vec3(0, 1, 0); }
-		//nope - have to do it for each triangle
-		virtual float pdf_value_area() const { return 0.0f; }
-		//nope - have to do it for each triangle
-		virtual BasicMath::vec3 random_area() const { return BasicMath::vec3(0, 1, 0); }
+
+		//! the density of random_area(), one over the surface area of an emitting mesh - 0 for the others
+		virtual float pdf_value_area() const
+		{
+			return areaTable.total() > 0.0f ? 1.0f / areaTable.total() : 0.0f;
+		}
+
+		//! a point distributed uniformly over the surface of an emitting mesh
+		virtual BasicMath::vec3 random_area() const
+		{
+			if (areaTable.empty())
+				return BasicMath::vec3(0, 1, 0);
+			const triangle* picked;
+			return randomSurfacePoint(picked);
+		}
+
+		//! samples a point uniformly over the surface, the pdf is converted to solid angle with its distance and cosine
+		/*!
+			The triangles are only hit from the front (backface culling), a point on a triangle facing away from o gets 0.
+		*/
+		virtual float sampleDirection(const BasicMath::vec3& o, BasicMath::vec3& direction, float& distance) const
+		{
+			if (areaTable.empty() || !(areaTable.total() > 0.0f))
+				return 0.0f;
+			const triangle* picked;
+			BasicMath::vec3 toPoint = randomSurfacePoint(picked) - o;
+			float distanceSquared = toPoint.squared_length();
+			if (!(distanceSquared > 0.0f))
+				return 0.0f;
+			distance = sqrtf(distanceSquared);
+			direction = toPoint / distance;
+			float cosLight = -BasicMath::dotProduct(picked->nnormal, direction);
+			if (cosLight <= 0.0f)
+				return 0.0f;
+			return distanceSquared / (cosLight*areaTable.total());
+		}
 	};
 
 }
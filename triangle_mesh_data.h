@@ -2,6 +2,8 @@
 #define RAYTR_CORE_TRIANGLE_MESH_DATA_H
 #include "aabb.h"
 #include "triangle.h"
+#include "triangle_soa.h"
+#include <deque>
 namespace Raytr_Core
 {
 	//! A class serving as a container and initializer of vertex and triangle buffers - to be used as an argument for triangle mesh classes
@@ -13,19 +15,20 @@ namespace Raytr_Core
 		BasicMath::vec3			mScale;			//!< if you scale to 0 - can't return the vertices to the original size
 
 		BasicMath::mat3			rotationMatrix; //!< the rotation matrix
+		BasicMath::mat3			initialMatrix;	//!< rotation*scaling applied to the positions added with the initial* functions
 
 		bounding_volume_aabb	boundingBox;	//!< the minimal axis aligned bounding box continaing all the vertices
 
 		//! a function to scale,rotate and translate a vertex
 		void					initialTransformVertexPosition(vertex& v) const
 		{
-			v.position = mPosition + rotationMatrix*BasicMath::mat3::scaling(mScale)*v.position;
+			v.position = mPosition + initialMatrix*v.position;
 		}
 
 		//! a function to scale,rotate and translate a vertex's position and normal
 		void					initialTransformVertexPositionAndNormal(vertex& v) const
 		{
-			v.position = mPosition + rotationMatrix*BasicMath::mat3::scaling(mScale)*v.position;
+			v.position = mPosition + initialMatrix*v.position;
 			v.normal = BasicMath::normalize(rotationMatrix*BasicMath::mat3::scaling(1.0f/mScale)*v.normal);
 		}
 
@@ -39,6 +42,7 @@ namespace Raytr_Core
 		size_t					vCount;			//!< vertex count
 		triangle*				triangles;		//!< triangles buffer
 		size_t					tCount;			//! triangles count
+		triangle_soa_buffer		soa;			//!< intersection data of the triangles as a structure of arrays
 	public:
 
 
@@ -46,6 +50,7 @@ namespace Raytr_Core
 			const BasicMath::vec3& rotation = BasicMath::vec3::zero,
 			const BasicMath::vec3& scaling = BasicMath::vec3::one)
 			: mPosition(position), mRotation(rotation), mScale(scaling), rotationMatrix(BasicMath::mat3::rotationXYZ(rotation)),
+			initialMatrix(rotationMatrix*BasicMath::mat3::scaling(scaling)),
 			vertices(nullptr), vCount(0), triangles(nullptr), tCount(0)
 		{
 
@@ -62,6 +67,7 @@ namespace Raytr_Core
 		void initialCreateTriangleBuffer(size_t tCount)
 		{
 			triangles = new triangle[tCount];
+			soa.create(tCount);
 		}
 
 		//! add a vertex to the vertex buffer when initializing, give only the position as argument
@@ -101,11 +107,25 @@ namespace Raytr_Core
 			boundingBox.updateCenterAndHalfSize();
 		}
 
+		//! add an already transformed vertex to the vertex buffer when initializing (from a mesh cache), the bounding box is not updated
+		void initialAddTransformedVertex(const vertex& v)
+		{
+			vertices[vCount] = v;
+			++vCount;
+		}
+
+		//! sets the bounding box when initializing instead of accumulating it from the vertices
+		void initialSetBoundingBox(const BasicMath::vec3& min, const BasicMath::vec3& max)
+		{
+			boundingBox = bounding_volume_aabb(min, max);
+		}
+
 		//! add a triangle to the triangle buffer when initializing, pass the triangle's vertices' indices as argument
 		void initialAddTriangle(size_t i0, size_t i1, size_t i2)
 		{
 			//init triangle
 			triangles[tCount] = triangle(&vertices[i0], &vertices[i1], &vertices[i2]);
+			soa.set(tCount, triangles[tCount]);
 			++tCount;
 		}
 
@@ -114,6 +134,7 @@ namespace Raytr_Core
 		{
 			//init triangle
 			triangles[tCount] = triangle(&vertices[i0], &vertices[i1], &vertices[i2]);
+			soa.set(tCount, triangles[tCount]);
 			//update normals
 			vertices[i0].normal += triangles[tCount].nnormal;
 			vertices[i1].normal += triangles[tCount].nnormal;
@@ -136,12 +157,24 @@ namespace Raytr_Core
 			return vCount;
 		}
 
+		//returns the vertex buffer
+		const vertex* getVertices() const
+		{
+			return vertices;
+		}
+
 		//returns the triangles buffer
 		const triangle* getTriangles() const
 		{
 			return triangles;
 		}
 
+		//returns the structure of arrays used by the intersection kernels
+		const triangle_soa_buffer& getIntersectionBuffer() const
+		{
+			return soa;
+		}
+
 		//returns the triangles count
 		size_t triangleCount() const
 		{
@@ -237,7 +270,8 @@ namespace Raytr_Core
 
 	};
 
-	std::vector<triangle_mesh_data> meshDataVector;
+	//! all the loaded meshes - a deque, so adding one doesn't move the others, the meshes and the scene loader keep pointers to them
+	std::deque<triangle_mesh_data> meshDataVector;
 }
 
 #endif
@@ -0,0 +1,102 @@
+#ifndef RAYTR_CORE_TRIANGLE_SOA_H
+#define RAYTR_CORE_TRIANGLE_SOA_H
+#include "triangle.h"
+
+namespace Raytr_Core
+{
+	//! A structure of arrays copy of the triangle data needed by the intersection test
+	/*!
+		All the components live in one allocation as 12 consecutive float arrays of tCount elements:
+		normal x,y,z | v0 x,y,z | e1 x,y,z | e2 x,y,z
+		The normal comes first since most triangles are rejected by the first (backface) test and never touch the rest.
+		Shading data (uv, vertex normals) stays in the triangle/vertex buffers and is read only for the closest hit.
+		Like the other buffers of triangle_mesh_data it's shallow copied and never freed.
+	*/
+	class triangle_soa_buffer
+	{
+	private:
+		float* data;
+		size_t capacity;
+
+	public:
+		const float* nx; const float* ny; const float* nz;
+		const float* v0x; const float* v0y; const float* v0z;
+		const float* e1x; const float* e1y; const float* e1z;
+		const float* e2x; const float* e2y; const float* e2z;
+
+		triangle_soa_buffer()
+			: data(nullptr), capacity(0),
+			nx(nullptr), ny(nullptr), nz(nullptr), v0x(nullptr), v0y(nullptr), v0z(nullptr),
+			e1x(nullptr), e1y(nullptr), e1z(nullptr), e2x(nullptr), e2y(nullptr), e2z(nullptr)
+		{
+
+		}
+
+		//! creates a new buffer with space for tCount triangles
+		void create(size_t tCount)
+		{
+			capacity = tCount;
+			data = new float[12 * tCount];
+			nx = data; ny = data + tCount; nz = data + 2 * tCount;
+			v0x = data + 3 * tCount; v0y = data + 4 * tCount; v0z = data + 5 * tCount;
+			e1x = data + 6 * tCount; e1y = data + 7 * tCount; e1z = data + 8 * tCount;
+			e2x = data + 9 * tCount; e2y = data + 10 * tCount; e2z = data + 11 * tCount;
+		}
+
+		//! copies the intersection data of a triangle into slot i
+		void set(size_t i, const triangle& t)
+		{
+			float* d = data + i;
+			d[0] = t.normal.x; d[capacity] = t.normal.y; d[2 * capacity] = t.normal.z;
+			d[3 * capacity] = t.v0->position.x; d[4 * capacity] = t.v0->position.y; d[5 * capacity] = t.v0->position.z;
+			d[6 * capacity] = t.e1.x; d[7 * capacity] = t.e1.y; d[8 * capacity] = t.e1.z;
+			d[9 * capacity] = t.e2.x; d[10 * capacity] = t.e2.y; d[11 * capacity] = t.e2.z;
+		}
+
+		//! the test of triangle::intersect (with backface culling) on triangle i, returns t and the barycentric coordinates of the hit
+		inline bool intersect(size_t i, const ray& r, float tmin, float tmax, float& t, BasicMath::vec2& ks) const
+		{
+			float denominator = nx[i] * r.direction.x + ny[i] * r.direction.y + nz[i] * r.direction.z;
+			//backface culling + 0 case
+			if (denominator >= -BasicMath::cEPSILON)
+				return false;
+
+			float ocx = v0x[i] - r.origin.x, ocy = v0y[i] - r.origin.y, ocz = v0z[i] - r.origin.z;
+			t = nx[i] * ocx + ny[i] * ocy + nz[i] * ocz;
+			if (t > tmin*denominator || t < tmax*denominator)
+				return false;
+
+			//oc x direction
+			float cx = ocy*r.direction.z - ocz*r.direction.y;
+			float cy = ocz*r.direction.x - ocx*r.direction.z;
+			float cz = ocx*r.direction.y - ocy*r.direction.x;
+			ks.x = e2x[i] * cx + e2y[i] * cy + e2z[i] * cz;
+			if (ks.x > 0 || ks.x < denominator)
+				return false;
+			ks.y = -(e1x[i] * cx + e1y[i] * cy + e1z[i] * cz);
+			if (ks.y > 0 || ks.x + ks.y < denominator)
+				return false;
+
+			float inv_denom = 1.0f / denominator;
+			t *= inv_denom;
+			ks *= inv_denom;
+			return true;
+		}
+
+		//! same as intersect, but only reports whether there's a hit
+		inline bool occluded(size_t i, const ray& r, float tmin, float tmax) const
+		{
+			float t;
+			BasicMath::vec2 ks;
+			return intersect(i, r, tmin, tmax, t, ks);
+		}
+
+		//! memory used by the buffer in bytes
+		size_t memoryUsage() const
+		{
+			return 12 * capacity*BasicMath::cFLOATBYTES;
+		}
+	};
+}
+
+#endif
@@ -8,6 +8,13 @@
 #include <iostream>
 #include <limits>
 #include <random>
+#include "pcg32.h"
+
+//define BASICMATH_SIMD (in the project's preprocessor definitions) to back vec3, vec4 and mat3 with sse registers
+//the interface stays the same, but vec3 grows to 16 bytes (the 4th lane is padding)
+#ifdef BASICMATH_SIMD
+#include <emmintrin.h>
+#endif
 
 namespace BasicMath
 {
@@ -53,8 +60,42 @@ namespace BasicMath
 		return std::max(a,std::min(x, b));
 	}
 
-	std::default_random_engine generator;
-	std::uniform_real_distribution<float> uniform_distribution(0, 1);
+#ifdef BASICMATH_SIMD
+	//! sum of the first 3 lanes, in the same order as the scalar code: (x+y)+z
+	inline float sum3(__m128 m)
+	{
+		return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(m, m)));
+	}
+
+	//! sum of all 4 lanes, in the same order as the scalar code: ((x+y)+z)+w
+	inline float sum4(__m128 m)
+	{
+		return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(_mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(m, m)),
+			_mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 3, 3, 3))));
+	}
+
+	//! mask with only the sign bits set
+	inline __m128 signMask()
+	{
+		return _mm_set1_ps(-0.0f);
+	}
+#endif
+
+	//! every thread has its own generator, so there's no shared state between the render threads
+	//! the render threads reseed it for every pixel and sample, which makes the result independent of the thread count
+	thread_local pcg32 generator;
+
+	//! returns a uniformly distributed float in [0,1) from the calling thread's generator
+	inline float randomFloat()
+	{
+		return generator.nextFloat();
+	}
+
+	//! returns 32 uniformly distributed random bits from the calling thread's generator
+	inline uint32_t randomBits()
+	{
+		return generator();
+	}
 }
 
 #endif
@@ -10,17 +10,29 @@ namespace BasicMath
 
 
 	public:
+#ifdef BASICMATH_SIMD
+		vec3() : m(_mm_setzero_ps()) {}
+		explicit vec3(float s) : m(_mm_setr_ps(s, s, s, 0)) {}
+		vec3(float e0, float e1, float e2) : m(_mm_setr_ps(e0, e1, e2, 0)) {}
+		vec3(const vec3& other) : m(other.m) {}
+		explicit vec3(__m128 m) : m(m) {}
+#else
 		vec3() {}
 		explicit vec3(float s) { x = s; y = s; z = s; }
 		vec3(float e0, float e1, float e2) { x = e0; y = e1; z = e2; }
 		vec3(const vec3& other) { x = other.x; y = other.y; z = other.z; }
+#endif
 
 		inline vec2 xy() const { return vec2(x, y); }
 		inline vec2 xz() const { return vec2(x, z); }
 		inline vec2 yz() const { return vec2(y, z); }
 
 		inline const vec3& operator+() const { return *this; }
+#ifdef BASICMATH_SIMD
+		inline vec3 operator-() const { return vec3(_mm_xor_ps(m, signMask())); }
+#else
 		inline vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+#endif
 		inline float operator[](int i) const { return e[i]; }
 		inline float& operator[](int i) { return e[i]; };
 
@@ -46,8 +58,13 @@ namespace BasicMath
 
 		bool operator!=(const vec3& v2) const;
 
+#ifdef BASICMATH_SIMD
+		inline float length() const { return sqrtf(sum3(_mm_mul_ps(m, m))); }
+		inline float squared_length() const { return sum3(_mm_mul_ps(m, m)); }
+#else
 		inline float length() const { return sqrtf(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]); }
 		inline float squared_length() const { return e[0] * e[0] + e[1] * e[1] + e[2] * e[2]; }
+#endif
 		//! vector normalization
 		inline vec3& make_unit_vector();
 
@@ -57,6 +74,9 @@ namespace BasicMath
 		static const vec3 infinity;
 
 		union {
+#ifdef BASICMATH_SIMD
+			__m128 m;
+#endif
 			float e[3];
 			struct {
 				float x, y, z;
@@ -75,6 +95,76 @@ namespace BasicMath
 	const vec3 vec3::epsilon(cEPSILON);
 	const vec3 vec3::infinity(cINFINITY);
 
+#ifdef BASICMATH_SIMD
+	inline vec3& vec3::operator+=(const vec3 &v) {
+		m = _mm_add_ps(m, v.m);
+		return *this;
+	}
+
+	inline vec3& vec3::operator*=(const vec3 &v) {
+		m = _mm_mul_ps(m, v.m);
+		return *this;
+	}
+
+	inline vec3& vec3::operator/=(const vec3 &v) {
+		m = _mm_div_ps(m, v.m);
+		return *this;
+	}
+
+	inline vec3& vec3::operator-=(const vec3& v) {
+		m = _mm_sub_ps(m, v.m);
+		return *this;
+	}
+
+	inline vec3& vec3::operator*=(const float t) {
+		m = _mm_mul_ps(m, _mm_set1_ps(t));
+		return *this;
+	}
+
+	inline vec3& vec3::operator/=(const float t) {
+		float k = float(1.0) / t;
+		m = _mm_mul_ps(m, _mm_set1_ps(k));
+		return *this;
+	}
+
+	//the comparisons ignore the padding lane
+	inline bool vec3::operator<(const vec3& v2) const
+	{
+		return (_mm_movemask_ps(_mm_cmplt_ps(m, v2.m)) & 7) == 7;
+	}
+
+	inline bool vec3::operator>(const vec3& v2) const
+	{
+		return (_mm_movemask_ps(_mm_cmpgt_ps(m, v2.m)) & 7) == 7;
+	}
+
+	inline bool vec3::operator<=(const vec3& v2) const
+	{
+		return (_mm_movemask_ps(_mm_cmple_ps(m, v2.m)) & 7) == 7;
+	}
+
+	inline bool vec3::operator>=(const vec3& v2) const
+	{
+		return (_mm_movemask_ps(_mm_cmpge_ps(m, v2.m)) & 7) == 7;
+	}
+
+	bool vec3::operator==(const vec3& v2) const
+	{
+		return (_mm_movemask_ps(_mm_cmpeq_ps(m, v2.m)) & 7) == 7;
+	}
+
+	bool vec3::operator!=(const vec3& v2) const
+	{
+		return (_mm_movemask_ps(_mm_cmpneq_ps(m, v2.m)) & 7) != 0;
+	}
+
+	inline vec3& vec3::make_unit_vector()
+	{
+		float k = float(1.0 / sqrtf(sum3(_mm_mul_ps(m, m))));
+		m = _mm_mul_ps(m, _mm_set1_ps(k));
+		return *this;
+	}
+#else
 	inline vec3& vec3::operator+=(const vec3 &v) {
 		e[0] += v.e[0];
 		e[1] += v.e[1];
@@ -155,6 +245,7 @@ namespace BasicMath
 		e[0] *= k; e[1] *= k; e[2] *= k;
 		return *this;
 	}
+#endif
 
 
 	/**
@@ -173,6 +264,55 @@ namespace BasicMath
 		return os;
 	}
 
+#ifdef BASICMATH_SIMD
+	inline vec3 operator+(const vec3 &v1, const vec3 &v2) {
+		return vec3(_mm_add_ps(v1.m, v2.m));
+	}
+
+	inline vec3 operator-(const vec3 &v1, const vec3 &v2) {
+		return vec3(_mm_sub_ps(v1.m, v2.m));
+	}
+
+	//! componentwise multiplication
+	inline vec3 operator*(const vec3 &v1, const vec3 &v2) {
+		return vec3(_mm_mul_ps(v1.m, v2.m));
+	}
+
+	//! componentwise division
+	inline vec3 operator/(const vec3 &v1, const vec3 &v2) {
+		return vec3(_mm_div_ps(v1.m, v2.m));
+	}
+
+	inline vec3 operator*(float t, const vec3 &v) {
+		return vec3(_mm_mul_ps(_mm_set1_ps(t), v.m));
+	}
+
+	inline vec3 operator/(const vec3& v, float t) {
+		return vec3(_mm_div_ps(v.m, _mm_set1_ps(t)));
+	}
+
+	inline vec3 operator/(float t, const vec3& v) {
+		return vec3(_mm_div_ps(_mm_set1_ps(t), v.m));
+	}
+
+	inline vec3 operator*(const vec3 &v, float t) {
+		return vec3(_mm_mul_ps(_mm_set1_ps(t), v.m));
+	}
+
+	//! dotProduct/scalar product
+	inline float dotProduct(const vec3 &v1, const vec3 &v2) {
+		return sum3(_mm_mul_ps(v1.m, v2.m));
+	}
+
+	//! cross/vector product
+	inline vec3 crossProduct(const vec3 &v1, const vec3 &v2) {
+		__m128 v1yzx = _mm_shuffle_ps(v1.m, v1.m, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 v2yzx = _mm_shuffle_ps(v2.m, v2.m, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 v1zxy = _mm_shuffle_ps(v1.m, v1.m, _MM_SHUFFLE(3, 1, 0, 2));
+		__m128 v2zxy = _mm_shuffle_ps(v2.m, v2.m, _MM_SHUFFLE(3, 1, 0, 2));
+		return vec3(_mm_sub_ps(_mm_mul_ps(v1yzx, v2zxy), _mm_mul_ps(v1zxy, v2yzx)));
+	}
+#else
 	inline vec3 operator+(const vec3 &v1, const vec3 &v2) {
 		return vec3(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2]);
 	}
@@ -218,6 +358,7 @@ namespace BasicMath
 			(-(v1.e[0] * v2.e[2] - v1.e[2] * v2.e[0])),
 			(v1.e[0] * v2.e[1] - v1.e[1] * v2.e[0]));
 	}
+#endif
 	
 	//! returns the normalized vector
 	inline vec3 normalize(const vec3& v) {
@@ -233,7 +374,11 @@ namespace BasicMath
 	//! componentwise fabs
 	inline vec3 fabs(const vec3& v)
 	{
+#ifdef BASICMATH_SIMD
+		return vec3(_mm_andnot_ps(signMask(), v.m));
+#else
 		return vec3(std::fabs(v[0]), std::fabs(v[1]), std::fabs(v[2]));
+#endif
 	}
 
 	//! each component of the vector to the power of power
@@ -245,7 +390,12 @@ namespace BasicMath
 	//! componentwise max between 2 vectors
 	inline vec3 max(const vec3& v1, const vec3& v2)
 	{
+#ifdef BASICMATH_SIMD
+		//operands swapped so a nan is handled like std::max does
+		return vec3(_mm_max_ps(v2.m, v1.m));
+#else
 		return vec3(std::max(v1[0], v2[0]), std::max(v1[1], v2[1]), std::max(v1[2], v2[2]));
+#endif
 	}
 
 	//! return the maximum component of a vector
@@ -257,7 +407,12 @@ namespace BasicMath
 	//! componentwise min between 2 vectors
 	inline vec3 min(const vec3& v1, const vec3& v2)
 	{
+#ifdef BASICMATH_SIMD
+		//operands swapped so a nan is handled like std::min does
+		return vec3(_mm_min_ps(v2.m, v1.m));
+#else
 		return vec3(std::min(v1[0], v2[0]), std::min(v1[1], v2[1]), std::min(v1[2], v2[2]));
+#endif
 	}
 
 	//! return the minimum component of a vector
@@ -10,11 +10,20 @@ namespace BasicMath
 
 
 	public:
+#ifdef BASICMATH_SIMD
+		vec4() : m(_mm_setzero_ps()) {}
+		explicit vec4(float s) : m(_mm_set1_ps(s)) {}
+		vec4(float e0, float e1, float e2, float e3) : m(_mm_setr_ps(e0, e1, e2, e3)) {}
+		vec4(const vec4& other) : m(other.m) {}
+		vec4(const vec3& other, float w) : m(other.m) { e[3] = w; }
+		explicit vec4(__m128 m) : m(m) {}
+#else
 		vec4() {}
 		explicit vec4(float s) { e[0] = s; e[1] = s; e[2] = s; e[3] = s; }
 		vec4(float e0, float e1, float e2, float e3) { e[0] = e0; e[1] = e1; e[2] = e2; e[3] = e3; }
 		vec4(const vec4& other) { e[0] = other[0]; e[1] = other[1]; e[2] = other[2]; e[3] = other[3]; }
 		vec4(const vec3& other, float w) { e[0] = other[0]; e[1] = other[1]; e[2] = other[2]; e[3] = w; }
+#endif
 
 
 		//swizzle operations
@@ -31,7 +40,11 @@ namespace BasicMath
 		inline vec3 xyw() const { return vec3(e[0], e[1], e[3]); }
 
 		inline const vec4& operator+() const { return *this; }
+#ifdef BASICMATH_SIMD
+		inline vec4 operator-() const { return vec4(_mm_xor_ps(m, signMask())); }
+#else
 		inline vec4 operator-() const { return vec4(-e[0], -e[1], -e[2], -e[3]); }
+#endif
 		inline float operator[](int i) const { return e[i]; }
 		inline float& operator[](int i) { return e[i]; };
 
@@ -44,8 +57,13 @@ namespace BasicMath
 		inline vec4& operator*=(const float t);
 		inline vec4& operator/=(const float t);
 
+#ifdef BASICMATH_SIMD
+		inline float length() const { return sqrtf(sum4(_mm_mul_ps(m, m))); }
+		inline float squared_length() const { return sum4(_mm_mul_ps(m, m)); }
+#else
 		inline float length() const { return sqrtf(e[0] * e[0] + e[1] * e[1] + e[2] * e[2] + e[3] * e[3]); }
 		inline float squared_length() const { return e[0] * e[0] + e[1] * e[1] + e[2] * e[2] + e[3] * e[3]; }
+#endif
 		//! vector normalization
 		inline vec4& make_unit_vector();
 
@@ -53,6 +71,9 @@ namespace BasicMath
 		static const vec4 one;
 
 		union {
+#ifdef BASICMATH_SIMD
+			__m128 m;
+#endif
 			float e[4];
 			struct {
 				float x, y, z, w;
@@ -67,6 +88,44 @@ namespace BasicMath
 	const vec4 vec4::zero(0);
 	const vec4 vec4::one(1);
 
+#ifdef BASICMATH_SIMD
+	inline vec4& vec4::operator+=(const vec4 &v) {
+		m = _mm_add_ps(m, v.m);
+		return *this;
+	}
+
+	inline vec4& vec4::operator*=(const vec4 &v) {
+		m = _mm_mul_ps(m, v.m);
+		return *this;
+	}
+
+	inline vec4& vec4::operator/=(const vec4 &v) {
+		m = _mm_div_ps(m, v.m);
+		return *this;
+	}
+
+	inline vec4& vec4::operator-=(const vec4& v) {
+		m = _mm_sub_ps(m, v.m);
+		return *this;
+	}
+
+	inline vec4& vec4::operator*=(const float t) {
+		m = _mm_mul_ps(m, _mm_set1_ps(t));
+		return *this;
+	}
+
+	inline vec4& vec4::operator/=(const float t) {
+		float k = float(1.0) / t;
+		m = _mm_mul_ps(m, _mm_set1_ps(k));
+		return *this;
+	}
+
+	inline vec4& vec4::make_unit_vector() {
+		float k = float(1.0 / sqrtf(sum4(_mm_mul_ps(m, m))));
+		m = _mm_mul_ps(m, _mm_set1_ps(k));
+		return *this;
+	}
+#else
 	inline vec4& vec4::operator+=(const vec4 &v) {
 		e[0] += v.e[0];
 		e[1] += v.e[1];
@@ -122,6 +181,7 @@ namespace BasicMath
 		e[0] *= k; e[1] *= k; e[2] *= k; e[3] *= k;
 		return *this;
 	}
+#endif
 
 	/**
 	* \defgroup vec4_functions vec4 functions
@@ -139,6 +199,42 @@ namespace BasicMath
 		return os;
 	}
 
+#ifdef BASICMATH_SIMD
+	inline vec4 operator+(const vec4 &v1, const vec4 &v2) {
+		return vec4(_mm_add_ps(v1.m, v2.m));
+	}
+
+	inline vec4 operator-(const vec4 &v1, const vec4 &v2) {
+		return vec4(_mm_sub_ps(v1.m, v2.m));
+	}
+
+	//! componentwise multiplication
+	inline vec4 operator*(const vec4 &v1, const vec4 &v2) {
+		return vec4(_mm_mul_ps(v1.m, v2.m));
+	}
+
+	//! componentwise division
+	inline vec4 operator/(const vec4 &v1, const vec4 &v2) {
+		return vec4(_mm_div_ps(v1.m, v2.m));
+	}
+
+	inline vec4 operator*(float t, const vec4 &v) {
+		return vec4(_mm_mul_ps(_mm_set1_ps(t), v.m));
+	}
+
+	inline vec4 operator/(const vec4& v, float t) {
+		return vec4(_mm_div_ps(v.m, _mm_set1_ps(t)));
+	}
+
+	inline vec4 operator*(const vec4 &v, float t) {
+		return vec4(_mm_mul_ps(_mm_set1_ps(t), v.m));
+	}
+
+	//! dotProduct/scalar product
+	inline float dotProduct(const vec4 &v1, const vec4 &v2) {
+		return sum4(_mm_mul_ps(v1.m, v2.m));
+	}
+#else
 	inline vec4 operator+(const vec4 &v1, const vec4 &v2) {
 		return vec4(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2], v1.e[3] + v2.e[3]);
 	}
@@ -173,6 +269,7 @@ namespace BasicMath
 	inline float dotProduct(const vec4 &v1, const vec4 &v2) {
 		return v1.e[0] * v2.e[0] + v1.e[1] * v2.e[1] + v1.e[2] * v2.e[2] + v1.e[3] * v2.e[3];
 	}
+#endif
 
 	//! cross/vector product for the first 3 components, the 4th is taken from the first vector
 	inline vec4 crossProduct(const vec4 &v1, const vec4 &v2) {
@@ -183,7 +280,11 @@ namespace BasicMath
 
 	inline bool operator==(const vec4& v1, const vec4& v2)
 	{
+#ifdef BASICMATH_SIMD
+		return _mm_movemask_ps(_mm_cmpeq_ps(v1.m, v2.m)) == 0xF;
+#else
 		return (v1[0] == v2[0] && v1[1] == v2[1] && v1[2] == v2[2] && v1[3] == v2[3]);
+#endif
 	}
 
 	//! returns the normalized vector
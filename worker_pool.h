@@ -0,0 +1,237 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ThreadsDistribution
+{
+	//! A lock-free work stealing deque (Chase-Lev) with a fixed capacity
+	/*!
+		The owning thread pushes and pops at the bottom, any other thread can steal from the top.
+		T should be a small trivially copyable type - a slot can be read by a thief while it's being claimed.
+		The capacity is not grown, the user has to make sure there are never more than capacity tasks queued.
+	*/
+	template<class T>
+	class work_stealing_queue
+	{
+	private:
+		std::vector<T> buffer;
+		int64_t mask;
+		std::atomic<int64_t> top;		//!< next task to steal
+		std::atomic<int64_t> bottom;	//!< next free slot of the owner
+
+	public:
+		explicit work_stealing_queue(size_t capacity)
+			: top(0), bottom(0)
+		{
+			size_t size = 1;
+			while (size < capacity)
+				size <<= 1;
+			buffer.resize(size);
+			mask = int64_t(size) - 1;
+		}
+
+		//! adds a task at the bottom, only the owner may call it
+		void push(const T& task)
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed);
+			buffer[b & mask] = task;
+			bottom.store(b + 1, std::memory_order_release);
+		}
+
+		//! takes the most recently pushed task, only the owner may call it
+		bool pop(T& task)
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = top.load(std::memory_order_relaxed);
+			if (t > b)
+			{
+				//empty
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return false;
+			}
+			task = buffer[b & mask];
+			if (t == b)
+			{
+				//the last task - race the thieves for it
+				bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return won;
+			}
+			return true;
+		}
+
+		//! takes the oldest task, can be called from any thread
+		bool steal(T& task)
+		{
+			int64_t t = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = bottom.load(std::memory_order_acquire);
+			if (t >= b)
+				return false;
+			task = buffer[t & mask];
+			return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		}
+	};
+
+	//! A pool of threads running tasks from work stealing queues until there are none left
+	/*!
+		The threads are started once and live until all the tasks (including the ones spawned by other tasks) are done
+		or cancel() is called. Each worker runs the tasks of its own queue first and steals from the others when it runs dry,
+		so there's no barrier between the tasks - a slow task only holds up the tasks depending on it.
+		A worker that finds nothing to steal sleeps until a task is queued, all of them are done or the pool is cancelled,
+		so the idle workers don't take the cpu from the busy ones (or from other pools).
+	*/
+	template<class T>
+	class worker_pool
+	{
+	public:
+		//! runs a task on the worker with index worker, it may queue follow up tasks with pool.spawn(worker, ...)
+		typedef std::function<void(worker_pool& pool, int worker, const T& task)> task_function;
+
+	private:
+		std::vector<std::unique_ptr<work_stealing_queue<T>>> queues;
+		std::vector<std::thread> threads;
+		std::atomic<size_t> pending;	//!< tasks queued or running
+		std::atomic<size_t> queued;		//!< tasks waiting in the queues
+		std::atomic<int> sleeping;		//!< workers waiting for wakeUp
+		std::atomic<bool> cancelled;
+		std::mutex sleepMutex;
+		std::condition_variable wakeUp;
+		task_function execute;
+
+		//! wakes one sleeping worker, or all of them - there's no lost wakeup, a worker checks for work under the mutex before it sleeps
+		void notify(bool all)
+		{
+			if (sleeping.load() == 0)
+				return;
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+			}
+			if (all)
+				wakeUp.notify_all();
+			else
+				wakeUp.notify_one();
+		}
+
+		//! sleeps until there's a queued task, all the tasks are done or the pool is cancelled
+		void sleep()
+		{
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			sleeping.fetch_add(1);
+			wakeUp.wait(lock, [this]()
+			{
+				return queued.load() != 0 || pending.load() == 0 || cancelled.load();
+			});
+			sleeping.fetch_sub(1);
+		}
+
+		void workerLoop(int worker)
+		{
+			int numWorkers = int(queues.size());
+			uint32_t victim = uint32_t(worker);
+			T task;
+			while (!cancelled.load(std::memory_order_relaxed) && pending.load(std::memory_order_acquire) != 0)
+			{
+				bool found = queues[worker]->pop(task);
+				//try the other workers' queues, starting after the last successful victim
+				for (int k = 1; !found && k < numWorkers; ++k)
+				{
+					int other = int((victim + k) % numWorkers);
+					if (other != worker && queues[other]->steal(task))
+					{
+						victim = uint32_t(other);
+						found = true;
+					}
+				}
+				if (!found)
+				{
+					sleep();
+					continue;
+				}
+				queued.fetch_sub(1);
+				execute(*this, worker, task);
+				if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+					notify(true);
+			}
+		}
+
+	public:
+		//! starts numThreads workers on the tasks, distributed over the workers' queues round robin
+		/*!
+			maxQueued is the most tasks that can be queued at once (on a single worker in the worst case).
+		*/
+		worker_pool(int numThreads, const std::vector<T>& tasks, size_t maxQueued, task_function execute)
+			: pending(tasks.size()), queued(tasks.size()), sleeping(0), cancelled(false), execute(execute)
+		{
+			if (numThreads < 1)
+				numThreads = 1;
+			for (int i = 0; i < numThreads; ++i)
+				queues.push_back(std::unique_ptr<work_stealing_queue<T>>(new work_stealing_queue<T>(maxQueued)));
+			for (size_t i = 0; i < tasks.size(); ++i)
+				queues[i % numThreads]->push(tasks[i]);
+			for (int i = 0; i < numThreads; ++i)
+				threads.push_back(std::thread(&worker_pool::workerLoop, this, i));
+		}
+
+		//! queues a task on the worker's own queue, may only be called from that worker's task
+		void spawn(int worker, const T& task)
+		{
+			pending.fetch_add(1, std::memory_order_acq_rel);
+			queued.fetch_add(1);
+			queues[worker]->push(task);
+			notify(false);
+		}
+
+		//! true once all the tasks are done
+		bool finished() const
+		{
+			return pending.load(std::memory_order_acquire) == 0;
+		}
+
+		//! the workers stop after their current task
+		void cancel()
+		{
+			cancelled.store(true, std::memory_order_relaxed);
+			notify(true);
+		}
+
+		bool isCancelled() const
+		{
+			return cancelled.load(std::memory_order_relaxed);
+		}
+
+		//! waits for the workers to stop
+		void wait()
+		{
+			for (std::thread& t : threads)
+			{
+				if (t.joinable())
+					t.join();
+			}
+		}
+
+		~worker_pool()
+		{
+			cancel();
+			wait();
+		}
+	};
+
+	//! the number of threads the hardware runs concurrently, at least 1
+	inline int hardwareThreads()
+	{
+		unsigned int n = std::thread::hardware_concurrency();
+		return n == 0 ? 1 : int(n);
+	}
+}
+
+#endif